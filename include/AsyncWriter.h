@@ -0,0 +1,110 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef AsyncWriter_h
+#define AsyncWriter_h
+
+#include <Arduino.h>
+#include "hardconfig.h"
+
+#ifdef USE_SD_CARD_ALT
+#include "SdFat.h"
+#endif
+
+// Streams data to a file on SD card from a low priority background task.
+//
+// write() only copies into a RAM ring buffer and never blocks: when the
+// ring is full, data is dropped and counted. The task writes whole chunks
+// (large contiguous writes) as soon as they are available.
+//
+// Only one producer task may call write().
+
+class AsyncWriter
+{
+public:
+    // bufferSize: RAM ring size (power of 2); chunkSize: bytes per SD write (divides bufferSize)
+    AsyncWriter(const char* name, size_t bufferSize, size_t chunkSize, UBaseType_t priority = 1);
+
+    // create (or truncate) file and start writer task; if preallocate > 0,
+    // that many bytes are reserved upfront for faster, contiguous writes
+    bool open(const char* path, uint32_t preallocate = 0);
+
+    // queue data; false if there is no room (data dropped)
+    bool write(const void* data, size_t len);
+
+    // bytes that can be queued right now
+    size_t available() const { return m_size - (m_head - m_tail); }
+
+    // ask the task to write queued data even if less than a chunk, and
+    // sync the file; does not wait
+    void flush();
+
+    // write remaining data and close file, waiting for the writer task.
+    // if header is given, it overwrites the start of the file before closing.
+    // returns false if any SD write failed.
+    bool close(const void* header = NULL, size_t headerLen = 0);
+
+    bool     isOpen()       const { return m_task != NULL; }
+    uint32_t queued()       const { return m_head; }            // bytes accepted
+    uint32_t written()      const { return m_written; }         // bytes on file
+    uint32_t dropped()      const { return m_dropped; }         // rejected writes
+    uint32_t droppedBytes() const { return m_droppedBytes; }
+    bool     failed()       const { return m_failed; }
+
+private:
+    static void task(void* arg);
+    void drain(bool all);
+
+    const char*       m_name;
+    size_t            m_size;
+    size_t            m_chunk;
+    UBaseType_t       m_priority;
+
+    uint8_t*          m_buf;
+    volatile uint32_t m_head;       // total bytes queued
+    volatile uint32_t m_tail;       // total bytes written
+    volatile bool     m_closing;
+    volatile uint32_t m_flushRequest;
+    uint32_t          m_flushDone;
+    volatile bool     m_failed;
+
+    uint32_t          m_written;
+    uint32_t          m_dropped;
+    uint32_t          m_droppedBytes;
+    bool              m_preallocated;
+
+    TaskHandle_t      m_task;
+    SemaphoreHandle_t m_done;
+
+#ifdef USE_SD_CARD_ALT
+    FsFile            m_file;
+#endif
+};
+
+#endif // AsyncWriter_h
@@ -0,0 +1,118 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef AyChip_h
+#define AyChip_h
+
+#include <stdint.h>
+#include "BlepBuffer.h"
+
+// AY-3-8912 emulation producing band-limited output.
+//
+// Tone, noise and envelope generators run at the chip clock (half the
+// CPU clock on Spectrum models), and every change in channel amplitude
+// is reported as a timestamped delta into a BlepBuffer.
+// Times are CPU T-states since the start of the current frame.
+//
+// Like BlepBuffer, this does not depend on Arduino.
+
+// CPU T-states per tone counter tick (8 AY clocks)
+#define AY_TICK 16
+
+// channel amplitude for volume 15
+#define AY_MAX_AMPLITUDE 8191
+
+// channel placement on stereo output
+#define AY_STEREO_MONO 0
+#define AY_STEREO_ABC  1    // A left, B center, C right
+#define AY_STEREO_ACB  2    // A left, C center, B right
+
+class AyChip
+{
+public:
+    AyChip();
+
+    // output may be mono or stereo; stereo uses the panning set below
+    void setOutput(BlepBuffer* out) { m_out = out; }
+
+    // one of AY_STEREO_*
+    void setStereoMode(int mode);
+    int stereoMode() const { return m_stereoMode; }
+
+    // parse "ABC", "ACB" or "MONO" (case insensitive), -1 if unknown
+    static int parseStereoMode(const char* name);
+
+    void reset();
+
+    void writeRegister(uint8_t reg, uint8_t data, uint32_t time);
+    uint8_t readRegister(uint8_t reg) const { return reg < 16 ? m_regs[reg] : 0xFF; }
+
+    // set all 16 registers at once (restoring a snapshot); unlike writing
+    // register 13, the envelope keeps running where it is
+    void loadRegisters(const uint8_t* regs, uint32_t time);
+
+    // run chip until end of frame, then start counting time from 0
+    void endFrame(uint32_t clocks);
+
+private:
+    void run(uint32_t time);
+    void updateOutput(uint32_t time);
+    void stepEnvelope();
+
+    BlepBuffer* m_out;
+    uint8_t  m_regs[16];
+    int32_t  m_time;            // T-states of last tick, may be slightly negative
+                                // at frame start (tick overlapping frame end)
+
+    uint16_t m_tonePeriod[3];
+    uint16_t m_toneCounter[3];
+    uint8_t  m_toneOutput[3];
+
+    uint16_t m_noisePeriod;     // in ticks (noise runs at half tone rate)
+    uint16_t m_noiseCounter;
+    uint32_t m_noiseShift;
+    uint8_t  m_noiseOutput;
+
+    uint32_t m_envPeriod;       // in ticks (envelope runs at half tone rate)
+    uint32_t m_envCounter;
+    uint8_t  m_envStep;
+    uint8_t  m_envMask;         // 0 when rising, 15 when falling
+    uint8_t  m_envLevel;
+    bool     m_envHolding;
+
+    int      m_amplitude[3];    // channel amplitude
+
+    int      m_stereoMode;
+    int      m_panLeft[3];      // channel gain, 256 = 1.0
+    int      m_panRight[3];
+    int      m_outLeft[3];      // last amplitude sent to output
+    int      m_outRight[3];
+};
+
+#endif // AyChip_h
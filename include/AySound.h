@@ -42,8 +42,18 @@ public:
     static void disable() {}
     static void enable() {}
     static uint8_t getRegisterData() { return 0; }
+    static uint8_t getSelectedRegister() { return 0; }
     static void selectRegister(uint8_t data) {}
     static void setRegisterData(uint8_t data) {}
+    static void loadRegisters(const uint8_t* regs, uint8_t selected) {}
+    static void setBeeper(uint8_t level) {}
+
+    static void printStats(char* buf, size_t len) { if (len) buf[0] = 0; }
+    static void resetStats() {}
+    static bool setDMABuffers(int count, int length) { return false; }
+    static void setMuted(bool muted) {}
+    static bool startWavRecording() { return false; }
+    static void stopWavRecording() {}
 #else
     static void initialize();
 
@@ -55,9 +65,31 @@ public:
     static void enable();
 
     static uint8_t getRegisterData();
+    static uint8_t getSelectedRegister();
     static void selectRegister(uint8_t data);
     static void setRegisterData(uint8_t data);
 
+    // set all 16 registers and the selected one, as in a snapshot;
+    // not seen by the PSG recorder and no envelope restart
+    static void loadRegisters(const uint8_t* regs, uint8_t selected);
+
+    // beeper (ULA port bit 4) state, only with AUDIO_BLEP_MIXER
+    static void setBeeper(uint8_t level);
+
+    // audio output statistics, formatted as short text lines into buf
+    static void printStats(char* buf, size_t len);
+    static void resetStats();
+
+    // change I2S DMA buffer count and length (in samples); false if rejected
+    static bool setDMABuffers(int count, int length);
+
+    // silence output while emulation runs faster than real time
+    static void setMuted(bool muted);
+
+    // record final mix into /rec/audioNNNN.wav; only with AUDIO_BLEP_MIXER
+    static bool startWavRecording();
+    static void stopWavRecording();
+
 private:
     static uint8_t finePitchChannelA;
     static uint8_t coarsePitchChannelA;
@@ -77,6 +109,7 @@ private:
 
     // Status
     static uint8_t selectedRegister;
+    static void storeRegister(uint8_t data);
     static uint8_t channelVolume[3];
     static uint16_t channelFrequency[3];
 #endif
@@ -0,0 +1,143 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef BlepBuffer_h
+#define BlepBuffer_h
+
+#include <stdint.h>
+
+// Band-limited step buffer.
+//
+// Sound sources report amplitude changes (deltas) timestamped in CPU
+// clocks; each delta is spread over a few output samples using a
+// precomputed band-limited step kernel, so square edges do not alias
+// regardless of the output sample rate. Reading samples integrates the
+// deltas back to PCM and applies a DC-blocking high-pass filter.
+//
+// A buffer can be mono or stereo; stereo deltas share the kernel lookup
+// and both channels are integrated and interleaved in a single pass.
+//
+// Everything is integer arithmetic, and the code does not depend on
+// Arduino, so it can be used by host tools too.
+
+// sub-sample phases in the kernel table
+#define BLEP_PHASE_BITS 5
+#define BLEP_PHASES (1 << BLEP_PHASE_BITS)
+// kernel length in samples (output is delayed by half of it)
+#define BLEP_WIDTH 16
+// each kernel phase sums to 1 << BLEP_KERNEL_BITS
+#define BLEP_KERNEL_BITS 14
+// fractional bits of sample position
+#define BLEP_TIME_BITS 32
+// high-pass corner is about sampleRate / (2 * pi * 2^BLEP_BASS_SHIFT)
+#define BLEP_BASS_SHIFT 9
+
+class BlepBuffer
+{
+public:
+    // capacity: maximum number of samples that can be pending (one frame or more)
+    // channels: 1 (mono) or 2 (stereo)
+    BlepBuffer(int capacity, int channels = 1);
+    ~BlepBuffer();
+
+    // set input clock rate (Hz) and output sample rate (Hz), clears buffer
+    void setRates(uint32_t clockRate, uint32_t sampleRate);
+    uint32_t clockRate() const { return m_clockRate; }
+    uint32_t sampleRate() const { return m_sampleRate; }
+
+    // discard pending samples and filter state
+    void clear();
+
+    int channels() const { return m_channels; }
+
+    // add an amplitude change at time (clocks since start of current frame),
+    // on all channels
+    inline void addDelta(uint32_t time, int delta);
+
+    // add an amplitude change with separate left and right values (stereo only)
+    inline void addStereoDelta(uint32_t time, int left, int right);
+
+    // close current frame, which lasted the given number of clocks;
+    // its samples become available for reading
+    void endFrame(uint32_t clocks);
+
+    // number of samples ready to be read
+    int samplesAvailable() const { return (int)(m_offset >> BLEP_TIME_BITS); }
+
+    // read up to count samples (frames) into out, channels interleaved.
+    // returns the number of samples read.
+    int readSamples(int16_t* out, int count);
+
+private:
+    static void initKernel();
+    static int16_t kernel[BLEP_PHASES][BLEP_WIDTH];
+    static bool kernelReady;
+
+    uint32_t m_clockRate;
+    uint32_t m_sampleRate;
+    uint64_t m_factor;      // samples per clock, BLEP_TIME_BITS fraction
+    uint64_t m_offset;      // start of current frame, BLEP_TIME_BITS fraction
+    int32_t  m_integrator[2];
+    int32_t* m_buf;
+    int      m_capacity;
+    int      m_channels;
+};
+
+inline void BlepBuffer::addDelta(uint32_t time, int delta)
+{
+    if (m_channels == 2) {
+        addStereoDelta(time, delta, delta);
+        return;
+    }
+    uint64_t pos = m_offset + (uint64_t)time * m_factor;
+    uint32_t index = (uint32_t)(pos >> BLEP_TIME_BITS);
+    // a source ahead of the end of the buffer is a caller bug; drop it
+    if (index >= (uint32_t)m_capacity)
+        return;
+    const int16_t* k = kernel[(uint32_t)(pos >> (BLEP_TIME_BITS - BLEP_PHASE_BITS)) & (BLEP_PHASES - 1)];
+    int32_t* b = m_buf + index;
+    for (int i = 0; i < BLEP_WIDTH; i++)
+        b[i] += k[i] * delta;
+}
+
+inline void BlepBuffer::addStereoDelta(uint32_t time, int left, int right)
+{
+    uint64_t pos = m_offset + (uint64_t)time * m_factor;
+    uint32_t index = (uint32_t)(pos >> BLEP_TIME_BITS);
+    if (index >= (uint32_t)m_capacity)
+        return;
+    const int16_t* k = kernel[(uint32_t)(pos >> (BLEP_TIME_BITS - BLEP_PHASE_BITS)) & (BLEP_PHASES - 1)];
+    int32_t* b = m_buf + index * 2;
+    for (int i = 0; i < BLEP_WIDTH; i++) {
+        b[i * 2]     += k[i] * left;
+        b[i * 2 + 1] += k[i] * right;
+    }
+}
+
+#endif // BlepBuffer_h
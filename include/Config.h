@@ -44,20 +44,14 @@ public:
     static const String& getRomSet() { return romSet; }
     static String   ram_file;
     static bool     slog_on;
+    static int      audio_dma_count;
+    static int      audio_dma_len;
+    static String   ay_stereo;
 
     // config persistence
     static void           load();
     static void IRAM_ATTR save();
 
-    // list of snapshot file names
-    //static String   sna_file_list;
-    static char sna_file_list [FILE_STRING_MAX];
-    // list of snapshot display names
-    static char     sna_name_list [FILE_STRING_MAX];
-
-    // load lists of snapshots
-    static void loadSnapshotLists();
-
 private:
     static String   arch;
     static String   romSet;
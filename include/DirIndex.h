@@ -0,0 +1,57 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef DirIndex_h
+#define DirIndex_h
+
+#include <Arduino.h>
+
+// Sorted listing of a directory (subdirectories first, then files, by
+// name ignoring case; hidden and .txt files left out), kept in a binary
+// index file under DISK_INDEX_DIR and rebuilt when the directory
+// modification time or size changes, or when invalidated. One directory
+// is loaded at a time.
+
+class DirIndex
+{
+public:
+    // false if dir cannot be read
+    static bool load(const String& dir);
+
+    // drop the index of the directory holding path, after creating or
+    // removing a file there
+    static void invalidate(const String& path);
+
+    static uint16_t count();
+    static const char* name(uint16_t i);
+    static bool isDir(uint16_t i);
+    static uint32_t size(uint16_t i);
+};
+
+#endif // DirIndex_h
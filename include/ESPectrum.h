@@ -68,6 +68,14 @@ public:
     static void waitForVideoTask();
 
     static void processKeyboard();
+    static void processSerialCommands();
+
+    // turbo mode: up to TURBO_MAX_FRAMES frames per displayed frame,
+    // unthrottled and muted; on while the tape plays or F10 is held
+    static bool turbo;
+
+    // emulation speed vs real time, percent (updated every second)
+    static uint16_t speedPercent;
 
 private:
     static void precalcColors();
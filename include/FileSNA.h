@@ -43,8 +43,14 @@ public:
     // using this function you can choose whether to write pages block by block, or byte by byte.
     static bool IRAM_ATTR save(String sna_fn, bool blockMode);
 
+    // quick save slots in memory; without a slot number, the last one
+    // saved, loaded or selected
     static bool IRAM_ATTR loadQuick();
     static bool IRAM_ATTR saveQuick();
+    static bool IRAM_ATTR loadQuick(uint8_t slot);
+    static bool IRAM_ATTR saveQuick(uint8_t slot);
+    static uint8_t quickSlot();
+    static void setQuickSlot(uint8_t slot);
 
     static bool IRAM_ATTR loadFromMem(uint8_t* srcBuffer, uint32_t size);
     static bool IRAM_ATTR saveToMem(uint8_t* dstBuffer, uint32_t size);
@@ -53,7 +59,11 @@ public:
     static bool IRAM_ATTR saveQuick48();
 
     static bool IRAM_ATTR isQuickAvailable();
+    static bool IRAM_ATTR isQuickAvailable(uint8_t slot);
     static bool IRAM_ATTR isPersistAvailable();
+
+    // read the screen (ZX_SCREEN_SIZE bytes of bank 5) without loading
+    static bool loadScreen(String sna_fn, uint8_t* screen);
 };
 
 #endif
\ No newline at end of file
@@ -61,15 +61,33 @@ public:
     static File IRAM_ATTR safeOpenFileRead(String filename);
 #endif
 //    static File IRAM_ATTR safeOpenFileRead(String filename);
-    static int          getFileEntriesFromDir(String path,char * filelist);
+    static int          getFileEntriesFromDir(String path, char * filelist, size_t size);
     static uint16_t       countFileEntriesFromDir(String path);
     static uint16_t       countFileEntriesFromDirQuick(String path);
-    static char*         getSortedSnaFileList(String path);
     static String         getSnaFileList();
 
+    static bool           ensureDir(const char* path);
+    // replace path with a fully written temporary file
+    static bool           replaceFile(const String& tmp, const String& path);
+    // complete an interrupted replaceFile(path + ".tmp", path), true if path exists
+    static bool           recoverFile(const String& path);
+    static bool           removeFile(const String& path);
+    static String         nextFileName(const char* dir, const char* prefix, const char* ext);
+    static uint32_t       fileSize(const String& path);
+
+    // SD card access lock (recursive), see SD_LOCK
+    static void           sdLock();
+    static bool           sdTryLock(TickType_t ticks);  // false if still busy
+    static void           sdUnlock();
+
     static bool           isDirectory(String filename);
     static bool           hasSNAextension(String filename);
     static bool           hasZ80extension(String filename);
+    static bool           hasSZXextension(String filename);
+    static bool           hasTAPextension(String filename);
+    static bool           hasTZXextension(String filename);
+    static bool           hasCSWextension(String filename);
+    static bool           hasWAVextension(String filename);
 
 private:
     friend class          Config;
@@ -80,12 +98,22 @@ private:
 #define DISK_ROM_DIR "/rom"
 #define DISK_SNA_DIR "/sna"
 #define DISK_PSNA_FILE "/persist/persist.sna"
+#define DISK_PZ80_FILE "/persist/persist.z80"
+#define DISK_REC_DIR "/rec"
+#define DISK_INDEX_DIR "/.dircache"
 #define NO_RAM_FILE "none"
 #define SNA_48K_SIZE 49179
 #define SNA_128K_SIZE1 131103
 #define SNA_128K_SIZE2 147487
+#define SNA_HEADER_SIZE 27
+#define ZX_SCREEN_SIZE 6912 // bitmap and attributes
 #define SD_SPEED 20000000  //4000000
 
+// SD card is shared with background writer tasks (see AsyncWriter):
+// any SD access while one may be active must be bracketed by these
+#define SD_LOCK   FileUtils::sdLock()
+#define SD_UNLOCK FileUtils::sdUnlock()
+
 
 
 
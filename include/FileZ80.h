@@ -43,16 +43,29 @@ class FileZ80
 {
 public:
     static bool IRAM_ATTR load(String z80_fn);
-    // static bool IRAM_ATTR save(String z80_fn);
+
+    // save snapshot in version 3 format, memory pages compressed
+    static bool IRAM_ATTR save(String z80_fn);
+
+    // copy the machine state (RAM to a PSRAM shadow) and save it from a
+    // background task while emulation goes on; false if busy or no PSRAM
+    static bool saveAsync(String z80_fn);
+    static bool isSaving();
+
+    // background save state; DONE and FAILED are reported once
+    enum { ASYNC_IDLE, ASYNC_BUSY, ASYNC_DONE, ASYNC_FAILED };
+    static uint8_t asyncStatus();
+
+    static bool IRAM_ATTR isPersistAvailable();
+
+    // read the screen (ZX_SCREEN_SIZE bytes of bank 5) without loading,
+    // decompressing only the start of that page
+    static bool loadScreen(String z80_fn, uint8_t* screen);
 
 private:
-#ifdef USE_SD_CARD_ALT
-    static void loadCompressedMemData(FsFile &f, uint16_t dataLen, uint16_t memStart, uint16_t memlen);
-    static void loadCompressedMemPage(FsFile &f, uint16_t dataLen, uint8_t* memPage, uint16_t memlen);
-#else
-    static void loadCompressedMemData(File f, uint16_t dataLen, uint16_t memStart, uint16_t memlen);
-    static void loadCompressedMemPage(File f, uint16_t dataLen, uint8_t* memPage, uint16_t memlen);
-#endif
+    static void loadBlock(uint16_t dataLen, uint8_t* page);
+    static uint16_t decompress(uint8_t* dst, uint16_t dstLen);
+    static void readRaw(uint8_t* dst, uint16_t len);
 };
 
 #endif
\ No newline at end of file
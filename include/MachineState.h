@@ -0,0 +1,65 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef MachineState_h
+#define MachineState_h
+
+#include <inttypes.h>
+
+// CPU, paging, border and AY state as the emulator holds it, copied
+// directly; RAM is not part of it. Used for snapshots kept in memory
+// (quick save slots, rewind), and converted to SNA, .z80 and SZX
+// headers when saving to a file.
+
+struct MachineState
+{
+    uint16_t af, bc, de, hl;
+    uint16_t afx, bcx, dex, hlx;
+    uint16_t ix, iy, sp, pc;
+    uint8_t i, r, im;
+    bool iff1, iff2, halted;
+
+    bool is128;
+    uint8_t bankLatch, videoLatch, romLatch, pagingLock;
+    uint8_t romInUse, modeSP3, romSP3;
+    uint8_t border;
+
+    uint8_t aySelected;
+    uint8_t ay[16];
+
+    uint32_t tstates;   // into the frame, saved to .z80; restore leaves CPU timing alone
+
+    void capture();
+    void restore() const;
+
+    // port 0x7FFD value for the paging latches
+    uint8_t port7FFD() const;
+};
+
+#endif // MachineState_h
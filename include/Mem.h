@@ -31,11 +31,34 @@
 #define Mem_h
 
 #include <inttypes.h>
+#include <stddef.h>
+#include "hardconfig.h"
 
 #define ADDRESS_IN_LOW_RAM(addr) (1 == (addr >> 14))
 
 #define MEM_PG_SZ 0x4000
 
+// RAM write tracking for rewind: one flag per 256 byte block of each bank
+#define MEM_BLOCK_SHIFT 8
+#define MEM_BLOCKS (MEM_PG_SZ >> MEM_BLOCK_SHIFT)
+
+#if defined(MEM_PLACEMENT) && !defined(BOARD_HAS_PSRAM)
+#undef MEM_PLACEMENT
+#endif
+
+// RAM bank placement: count one in MEM_SAMPLE_MASK+1 accesses to 0xC000
+#ifdef MEM_PLACEMENT
+#define MEM_SAMPLE_ACCESS(bank) if (!(++Mem::sampleTick & MEM_SAMPLE_MASK)) Mem::bankHits[bank]++
+#else
+#define MEM_SAMPLE_ACCESS(bank)
+#endif
+
+#ifdef REWIND_BUFFER
+#define MEM_MARK_DIRTY(bank, offset) Mem::dirty[((bank) * MEM_BLOCKS) | ((offset) >> MEM_BLOCK_SHIFT)] = 1
+#else
+#define MEM_MARK_DIRTY(bank, offset)
+#endif
+
 class Mem
 {
 public:
@@ -69,6 +92,24 @@ public:
     static uint16_t readword(uint16_t addr);
     static void writebyte(uint16_t addr, uint8_t data);
     static void writeword(uint16_t addr, uint16_t data);
+
+#ifdef REWIND_BUFFER
+    static uint8_t dirty[8 * MEM_BLOCKS];
+#endif
+    // for memory written other than thru writebyte
+    static void markDirty(uint16_t addr, uint16_t len);
+
+#ifdef MEM_PLACEMENT
+    static uint8_t sampleTick;
+    static uint32_t bankHits[8];
+
+    // at frame end: move hot banks from PSRAM to SRAM
+    static void placeBanks();
+    static void printPlacement(char* buf, size_t len);
+#else
+    static void placeBanks() {}
+    static void printPlacement(char* buf, size_t len) { if (len) buf[0] = 0; }
+#endif
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -85,6 +126,7 @@ inline uint8_t Mem::readbyte(uint16_t addr) {
     case 2:
         return ram2[addr - 0x8000];
     case 3:
+        MEM_SAMPLE_ACCESS(bankLatch);
         return ram[bankLatch][addr - 0xC000];
     }
 }
@@ -101,12 +143,16 @@ inline void Mem::writebyte(uint16_t addr, uint8_t data)
         return;
     case 1:
         ram5[addr - 0x4000] = data;
+        MEM_MARK_DIRTY(5, addr - 0x4000);
         break;
     case 2:
         ram2[addr - 0x8000] = data;
+        MEM_MARK_DIRTY(2, addr - 0x8000);
         break;
     case 3:
+        MEM_SAMPLE_ACCESS(bankLatch);
         ram[bankLatch][addr - 0xC000] = data;
+        MEM_MARK_DIRTY(bankLatch, addr - 0xC000);
         break;
     }
     return;
@@ -118,4 +164,18 @@ inline void Mem::writeword(uint16_t addr, uint16_t data) {
 }
 
 
+inline void Mem::markDirty(uint16_t addr, uint16_t len)
+{
+#ifdef REWIND_BUFFER
+    uint32_t end = (uint32_t)addr + len;
+    for (uint32_t a = addr & ~((1 << MEM_BLOCK_SHIFT) - 1); a < end && a < 0x10000; a += 1 << MEM_BLOCK_SHIFT) {
+        switch (a >> 14) {
+        case 1: MEM_MARK_DIRTY(5, a - 0x4000); break;
+        case 2: MEM_MARK_DIRTY(2, a - 0x8000); break;
+        case 3: MEM_MARK_DIRTY(bankLatch, a - 0xC000); break;
+        }
+    }
+#endif
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,71 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef PsgRecorder_h
+#define PsgRecorder_h
+
+#include <Arduino.h>
+#include "hardconfig.h"
+
+// Records every AY register write to a .psg file on SD card.
+//
+// Standard PSG layout: 16 byte header ("PSG" 0x1A), then register/value
+// pairs, with 0xFF marking the end of each frame (interrupt).
+// Writes are gathered per frame in RAM and handed to an AsyncWriter,
+// so recording never waits for the SD card.
+
+class PsgRecorder
+{
+public:
+    // start recording into next free /rec/ayNNNN.psg
+    static bool start();
+    static void stop();
+
+    static bool isRecording() { return recording; }
+    static const String& fileName() { return path; }
+    static uint32_t frames() { return frameCount; }
+    static uint32_t dropped();
+
+    // from AySound, on each register write
+    static inline void registerWrite(uint8_t reg, uint8_t data) { if (recording) record(reg, data); }
+
+    // from emulation loop, at the end of each frame
+    static inline void endFrame() { if (recording) frame(); }
+
+private:
+    static void record(uint8_t reg, uint8_t data);
+    static void frame();
+    static void flush();
+
+    static bool recording;
+    static String path;
+    static uint32_t frameCount;
+};
+
+#endif // PsgRecorder_h
@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef Rewind_h
+#define Rewind_h
+
+#include <Arduino.h>
+#include "hardconfig.h"
+
+// History of machine states in PSRAM, captured every REWIND_INTERVAL
+// frames. Each capture keeps the CPU, paging and AY state, and the RAM
+// blocks changed since the previous capture as XOR deltas, so stepping
+// back replays the deltas from a reference copy of RAM.
+
+class Rewind
+{
+public:
+#ifndef REWIND_BUFFER
+    static void setup() {}
+    static void reset() {}
+    static void endFrame() {}
+    static bool stepBack() { return false; }
+    static uint16_t captures() { return 0; }
+    static void printStats(char* buf, size_t len) { if (len) buf[0] = 0; }
+#else
+    static void setup();
+
+    // forget history, RAM is taken as is (after reset or snapshot load)
+    static void reset();
+
+    // called after each emulated frame
+    static void endFrame();
+
+    // restore the previous capture; false if there is none
+    static bool stepBack();
+
+    static uint16_t captures();
+    static void printStats(char* buf, size_t len);
+#endif
+};
+
+#endif // Rewind_h
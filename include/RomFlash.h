@@ -0,0 +1,64 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef RomFlash_h
+#define RomFlash_h
+
+#include <Arduino.h>
+#include "hardconfig.h"
+
+// ROM sets kept in a raw flash data partition and run in place from
+// memory-mapped flash: Mem::rom[] points into the mapping, so ROM pages
+// take no SRAM/PSRAM. A set is copied there from SD the first time it
+// is loaded.
+
+class RomFlash
+{
+public:
+#ifndef ROM_FLASH_PARTITION
+    static bool setup() { return false; }
+    static bool select(const String& arch, const String& romSet) { return false; }
+    static bool store(const String& arch, const String& romSet, const String& path, uint8_t count) { return false; }
+    static void benchmark() {}
+#else
+    // map the partition; false if not usable (ROMs must go to RAM)
+    static bool setup();
+
+    // point Mem::rom[] to a stored set; false if not stored
+    static bool select(const String& arch, const String& romSet);
+
+    // copy path/0.rom .. path/<count-1>.rom to flash and select them
+    static bool store(const String& arch, const String& romSet, const String& path, uint8_t count);
+
+    // print ROM fetch timings from flash, SRAM and PSRAM
+    static void benchmark();
+#endif
+};
+
+#endif // RomFlash_h
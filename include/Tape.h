@@ -0,0 +1,121 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef Tape_h
+#define Tape_h
+
+#include <Arduino.h>
+#include "hardconfig.h"
+
+// ROM loader entry point (LD-BYTES) and its common exit (SA/LD-RET),
+// same addresses in the 48K ROM and in the 48K BASIC ROM of 128K models
+#define TAPE_LD_BYTES   0x0556
+#define TAPE_SA_BYTES   0x04C2
+#define TAPE_SA_LD_RET  0x053F
+
+// Virtual tape player for .tap and .tzx files, and .csw/.wav captures.
+//
+// The block index is built once when the tape is inserted. While playing,
+// blocks are decoded lazily into a small ring of pulse lengths (T-states),
+// topped up at the end of each frame, and the EAR level seen by the CPU
+// is derived by comparing the next edge time against CPU::tstates.
+// The file is read in chunks, the next one read ahead by a background
+// task, so captures of any length play without being held in memory.
+// Playback starts when the ROM loader is entered and a block cannot be
+// loaded instantly, and stops at the end of tape or on TZX stop blocks.
+
+class Tape
+{
+public:
+    // insert tape: build block index and rewind; false if not a valid file
+    static bool open(String filename);
+    static void close();
+    static void rewind();
+
+    static void play();
+    static void stop();
+
+    static bool isOpen() { return inserted; }
+    static bool isPlaying() { return playing; }
+    static uint16_t blockCount();
+    static uint16_t currentBlock();
+
+    // file of the inserted tape
+    static const String& fileName();
+    // stop and continue from given block (snapshot restore)
+    static void seekBlock(uint16_t n);
+
+    // call before executing each instruction: when the ROM loader is
+    // entered, loads next block instantly (TAPE_LOAD_TRAP) or starts playing;
+    // when the ROM saver is entered, appends the block to a .tap file
+    static inline void checkTrap(uint16_t pc) {
+        if (pc == TAPE_LD_BYTES) { if (inserted && !playing) romLoader(); }
+#ifdef TAPE_SAVE_TRAP
+        else if (pc == TAPE_SA_BYTES) saBytes();
+#endif
+    }
+
+#ifdef TAPE_SAVE_TRAP
+    // file saved blocks go to, empty if none open
+    static const String& saveFileName();
+#endif
+
+#ifdef TAPE_ACCELERATE
+    // call before executing each instruction: if PC is at a known edge
+    // detection loop, runs as many iterations as possible in one step
+    static inline void checkEdgeLoop(uint16_t pc) { if (playing) edgeLoop(pc); }
+#endif
+
+    // EAR level (0/1) at the given T-state of current frame
+    static inline uint8_t ear(uint32_t now) {
+        while (playing && (int32_t)(now - edge) >= 0) nextEdge();
+        return level;
+    }
+
+    // call at the end of each frame with the T-states it lasted
+    static void endFrame(uint32_t frameStates);
+
+private:
+    static void romLoader();
+    static bool ldBytes();
+    static bool saBytes();
+    static void nextEdge();
+    static void edgeLoop(uint16_t pc);
+#ifdef TAPE_SAVE_TRAP
+    static void saveIdle();
+    static bool saveEnd;        // close save file at end of frame
+#endif
+
+    static bool inserted;
+    static bool playing;
+    static uint8_t level;
+    static int32_t edge;        // T-state of next edge, in current frame
+};
+
+#endif // Tape_h
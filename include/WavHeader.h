@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef WavHeader_h
+#define WavHeader_h
+
+#include <stdint.h>
+
+// Canonical 44 byte header for 16 bit PCM WAV files.
+// Shared by the SD card recorder and the host tools.
+
+#define WAV_HEADER_SIZE 44
+
+static inline void wavPut32(uint8_t* p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static inline void wavPut16(uint8_t* p, uint16_t v)
+{
+    p[0] = v; p[1] = v >> 8;
+}
+
+// fill header for dataBytes of sample data following it
+static inline void wavMakeHeader(uint8_t* h, uint32_t sampleRate, uint16_t channels, uint32_t dataBytes)
+{
+    const uint16_t blockAlign = channels * 2;
+    h[0] = 'R'; h[1] = 'I'; h[2] = 'F'; h[3] = 'F';
+    wavPut32(h + 4, 36 + dataBytes);
+    h[8] = 'W'; h[9] = 'A'; h[10] = 'V'; h[11] = 'E';
+    h[12] = 'f'; h[13] = 'm'; h[14] = 't'; h[15] = ' ';
+    wavPut32(h + 16, 16);                       // fmt chunk size
+    wavPut16(h + 20, 1);                        // PCM
+    wavPut16(h + 22, channels);
+    wavPut32(h + 24, sampleRate);
+    wavPut32(h + 28, sampleRate * blockAlign);  // byte rate
+    wavPut16(h + 32, blockAlign);
+    wavPut16(h + 34, 16);                       // bits per sample
+    h[36] = 'd'; h[37] = 'a'; h[38] = 't'; h[39] = 'a';
+    wavPut32(h + 40, dataBytes);
+}
+
+#endif // WavHeader_h
@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef WavRecorder_h
+#define WavRecorder_h
+
+#include <Arduino.h>
+#include "hardconfig.h"
+
+// Records the final audio mix into a 16 bit PCM WAV file on SD card.
+//
+// PCM produced each frame is copied into a double buffer in RAM; a low
+// priority task writes each half to SD as a single contiguous write,
+// into a preallocated file. The header is patched with the real length
+// on stop. If the SD card cannot keep up, whole frames are dropped and
+// counted, emulation is never delayed.
+
+class WavRecorder
+{
+public:
+    // start recording into next free /rec/audioNNNN.wav
+    static bool start(uint32_t sampleRate, uint16_t channels);
+    static void stop();
+
+    static bool isRecording() { return recording; }
+    static const String& fileName() { return path; }
+    static uint32_t dropped();          // dropped frames (PCM buffers)
+    static uint32_t seconds();
+
+    // interleaved samples, count frames; from the audio mixer
+    static inline void addSamples(const int16_t* pcm, int count) { if (recording) add(pcm, count); }
+
+private:
+    static void add(const int16_t* pcm, int count);
+
+    static bool recording;
+    static String path;
+    static uint32_t rate;
+    static uint16_t channels;
+};
+
+#endif // WavRecorder_h
@@ -0,0 +1,146 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef Z80Access_h
+#define Z80Access_h
+
+#include "hardconfig.h"
+
+// Uniform access to Z80 registers, whichever CPU core is in use.
+
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef CPU_LINKEFONG
+#include "Z80_LKF/z80emu.h"
+extern Z80_STATE _zxCpu;
+
+#define Z80_SET_AF(v) _zxCpu.registers.word[Z80_AF] = (v)
+#define Z80_SET_BC(v) _zxCpu.registers.word[Z80_BC] = (v)
+#define Z80_SET_DE(v) _zxCpu.registers.word[Z80_DE] = (v)
+#define Z80_SET_HL(v) _zxCpu.registers.word[Z80_HL] = (v)
+
+#define Z80_SET_AFx(v) _zxCpu.alternates[Z80_AF] = (v)
+#define Z80_SET_BCx(v) _zxCpu.alternates[Z80_BC] = (v)
+#define Z80_SET_DEx(v) _zxCpu.alternates[Z80_DE] = (v)
+#define Z80_SET_HLx(v) _zxCpu.alternates[Z80_HL] = (v)
+
+#define Z80_SET_IY(v) _zxCpu.registers.word[Z80_IY] = (v)
+#define Z80_SET_IX(v) _zxCpu.registers.word[Z80_IX] = (v)
+
+#define Z80_SET_SP(v) _zxCpu.registers.word[Z80_SP] = (v)
+#define Z80_SET_PC(v) _zxCpu.pc = (v)
+
+#define Z80_SET_I(v) _zxCpu.i = (v)
+#define Z80_SET_R(v) _zxCpu.r = (v)
+#define Z80_SET_IM(v) _zxCpu.im = (v)
+#define Z80_SET_IFF1(v) _zxCpu.iff1 = (v)
+#define Z80_SET_IFF2(v) _zxCpu.iff2 = (v)
+
+#define Z80_GET_AF() (_zxCpu.registers.word[Z80_AF])
+#define Z80_GET_BC() (_zxCpu.registers.word[Z80_BC])
+#define Z80_GET_DE() (_zxCpu.registers.word[Z80_DE])
+#define Z80_GET_HL() (_zxCpu.registers.word[Z80_HL])
+
+#define Z80_GET_AFx() (_zxCpu.alternates[Z80_AF])
+#define Z80_GET_BCx() (_zxCpu.alternates[Z80_BC])
+#define Z80_GET_DEx() (_zxCpu.alternates[Z80_DE])
+#define Z80_GET_HLx() (_zxCpu.alternates[Z80_HL])
+
+#define Z80_GET_IY() (_zxCpu.registers.word[Z80_IY])
+#define Z80_GET_IX() (_zxCpu.registers.word[Z80_IX])
+
+#define Z80_GET_SP() (_zxCpu.registers.word[Z80_SP])
+#define Z80_GET_PC() (_zxCpu.pc)
+
+#define Z80_GET_I() (_zxCpu.i)
+#define Z80_GET_R() (_zxCpu.r)
+#define Z80_GET_IM() (_zxCpu.im)
+#define Z80_GET_IFF1() (_zxCpu.iff1)
+#define Z80_GET_IFF2() (_zxCpu.iff2)
+#define Z80_GET_HALTED() (_zxCpu.halted)
+#define Z80_SET_HALTED(v) _zxCpu.halted = (v)
+
+#endif // CPU_LINKEFONG
+
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef CPU_JLSANCHEZ
+#include "Z80_JLS/z80.h"
+
+#define Z80_GET_AF() Z80::getRegAF()
+#define Z80_GET_BC() Z80::getRegBC()
+#define Z80_GET_DE() Z80::getRegDE()
+#define Z80_GET_HL() Z80::getRegHL()
+
+#define Z80_GET_AFx() Z80::getRegAFx()
+#define Z80_GET_BCx() Z80::getRegBCx()
+#define Z80_GET_DEx() Z80::getRegDEx()
+#define Z80_GET_HLx() Z80::getRegHLx()
+
+#define Z80_GET_IY() Z80::getRegIY()
+#define Z80_GET_IX() Z80::getRegIX()
+
+#define Z80_GET_SP() Z80::getRegSP()
+#define Z80_GET_PC() Z80::getRegPC()
+
+#define Z80_GET_I() Z80::getRegI()
+#define Z80_GET_R() Z80::getRegR()
+#define Z80_GET_IM() Z80::getIM()
+#define Z80_GET_IFF1() Z80::isIFF1()
+#define Z80_GET_IFF2() Z80::isIFF2()
+
+#define Z80_SET_AF(v) Z80::setRegAF(v)
+#define Z80_SET_BC(v) Z80::setRegBC(v)
+#define Z80_SET_DE(v) Z80::setRegDE(v)
+#define Z80_SET_HL(v) Z80::setRegHL(v)
+
+#define Z80_SET_AFx(v) Z80::setRegAFx(v)
+#define Z80_SET_BCx(v) Z80::setRegBCx(v)
+#define Z80_SET_DEx(v) Z80::setRegDEx(v)
+#define Z80_SET_HLx(v) Z80::setRegHLx(v)
+
+#define Z80_SET_IY(v) Z80::setRegIY(v)
+#define Z80_SET_IX(v) Z80::setRegIX(v)
+
+#define Z80_SET_SP(v) Z80::setRegSP(v)
+#define Z80_SET_PC(v) Z80::setRegPC(v)
+
+#define Z80_SET_I(v) Z80::setRegI(v)
+#define Z80_SET_R(v) Z80::setRegR(v)
+#define Z80_SET_IM(v) Z80::setIM((Z80::IntMode)(v))
+#define Z80_SET_IFF1(v) Z80::setIFF1(v)
+#define Z80_SET_IFF2(v) Z80::setIFF2(v)
+#define Z80_GET_HALTED() Z80::isHalted()
+#define Z80_SET_HALTED(v) Z80::setHalted(v)
+
+#endif  // CPU_JLSANCHEZ
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // Z80Access_h
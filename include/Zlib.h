@@ -0,0 +1,60 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef Zlib_h
+#define Zlib_h
+
+#include <inttypes.h>
+
+// Small zlib (RFC 1950/1951) codec for snapshot memory pages.
+//
+// inflate() decodes straight into the destination buffer, which also
+// serves as the history window, reading input thru a small fixed buffer:
+// no heap allocation. deflate() emits fixed Huffman blocks with greedy
+// LZ77 matching (one hash table, allocated while compressing).
+
+class Zlib
+{
+public:
+    // input source: copy up to len bytes into buf; returns count, 0 at end
+    typedef int (*ReadFunc)(uint8_t* buf, int len);
+    // output sink: false on write error
+    typedef bool (*WriteFunc)(const uint8_t* buf, int len);
+
+    // decompress a zlib stream into dst; bytes written, -1 if corrupt
+    static int32_t inflate(ReadFunc read, uint8_t* dst, uint32_t dstLen);
+
+    // compress len bytes (up to 32K) as a zlib stream; compressed length,
+    // -1 on write error or if out of memory
+    static int32_t deflate(const uint8_t* src, uint32_t len, WriteFunc write);
+
+    static uint32_t adler32(const uint8_t* data, uint32_t len);
+};
+
+#endif // Zlib_h
@@ -77,6 +77,11 @@
 
 #define VIDEO_FRAME_TIMING
 
+// TURBO_MAX_FRAMES is the maximum number of frames emulated per displayed
+// frame in turbo mode (while the tape plays or F10 is held), which also
+// runs unthrottled and muted. Set it to 1 to just run unthrottled.
+#define TURBO_MAX_FRAMES 16
+
 // LOG_DEBUG_TIMING generates simple timing log messages to console very second.
 // #define LOG_DEBUG_TIMING
 ///////////////////////////////////////////////////////////////////////////////
@@ -173,9 +178,6 @@
 #endif
 
 //#define XDEBUG                  //Enable debug serial output
-#define FILE_STRING_MAX 16384   //Size of directory buffer - directory listings will truncate when full
-//#define FILE_STRING_MAX 8192
-//#define FILE_STRING_MAX 1024
 ///////////////////////////////////////////////////////////////////////////////
 
 
@@ -246,6 +248,162 @@
 // 
 
 #define USE_AY_SOUND
+
+// I2S DMA buffering used for audio output: number of buffers and samples
+// per buffer. Output latency is roughly count * len * 2 / sample rate.
+// Both can be overridden in boot.cfg (audio_dma_count:, audio_dma_len:)
+// or changed at runtime with the "dma <count> <len>" serial command.
+// Send "stats" thru serial (or press F6 for the on-screen overlay)
+// to check for underruns after changing these.
+
+#define DEFAULT_AUDIO_DMA_COUNT 2
+#define DEFAULT_AUDIO_DMA_LEN   32
+
+// define AUDIO_BLEP_MIXER to emulate the AY tone, noise and envelope
+// generators and the beeper at CPU T-state resolution, mixed through a
+// band-limited step buffer (no aliasing even at low sample rates).
+// Beeper goes thru the I2S DAC then, instead of toggling SPEAKER_PIN.
+// If undefined, AY channels are approximated by FabGL square waves.
+//
+// AUDIO_SAMPLE_RATE is the output rate in Hz.
+
+#define AUDIO_BLEP_MIXER
+#define AUDIO_SAMPLE_RATE 16000
+
+#if defined(AUDIO_BLEP_MIXER) && !defined(USE_AY_SOUND)
+#error "AUDIO_BLEP_MIXER requires USE_AY_SOUND"
+#endif
+
+// define AUDIO_I2S_DAC to send audio to an external I2S DAC (PCM5102 and
+// similar) as 16 bit stereo, instead of the ESP32 built-in 8 bit DAC on
+// GPIO25. See hardpins.h for pins.
+//
+// DEFAULT_AY_STEREO sets AY channel placement with AUDIO_BLEP_MIXER and
+// a stereo output: "ABC", "ACB" or "MONO". Can be changed in boot.cfg
+// (ay_stereo:). Beeper is always centered.
+
+// #define AUDIO_I2S_DAC
+#define DEFAULT_AY_STEREO "ABC"
+
+#if defined(AUDIO_I2S_DAC) && defined(SPEAKER_PRESENT) && !defined(AUDIO_BLEP_MIXER)
+#error "AUDIO_I2S_DAC uses SPEAKER_PIN, define AUDIO_BLEP_MIXER to route beeper thru the DAC"
+#endif
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// Tape
+//
+// .tap, .tzx, .csw and .wav files in the snapshot menu are inserted as a
+// tape (then LOAD ""). The tape plays in real time when the ROM loader is
+// entered, or with F9 (play/stop); loaders read it from the EAR bit of
+// port 0xFE. CSW (RLE) and WAV (8/16 bit PCM) captures always play in
+// real time, streamed from SD.
+// define TAPE_LOAD_TRAP to load standard blocks instantly when the ROM
+// loader (LD-BYTES) is entered, with the 48K BASIC ROM paged in.
+//
+// define TAPE_ACCELERATE to fast-forward the edge detection loops of the
+// ROM and of common turbo loaders while the tape plays. CPU runs
+// unthrottled while the tape is playing either way.
+//
+// define TAPE_SAVE_TRAP to append blocks saved thru the ROM saver
+// (SA-BYTES) to /sna/saveNNNN.tap, one new file per run of saves.
+
+#define TAPE_LOAD_TRAP
+#define TAPE_ACCELERATE
+#define TAPE_SAVE_TRAP
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// ROM flash
+//
+// define ROM_FLASH_PARTITION (partition name) to run ROMs in place from
+// memory-mapped flash instead of copying them to SRAM/PSRAM, which leaves
+// that SRAM to RAM banks. Each ROM set is copied from SD to the partition
+// (subtype ROM_FLASH_SUBTYPE) the first time it is used; the partition is
+// in partitions_hibernate.csv. The serial command "rombench" compares
+// fetch timings from flash, SRAM and PSRAM. Without the partition, ROMs
+// are loaded to RAM (see ROM_CACHE_SETS).
+
+#define ROM_FLASH_PARTITION "roms"
+#define ROM_FLASH_SUBTYPE 0x41
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// ROM cache
+//
+// ROM_CACHE_SETS is the number of ROM sets (arch + romset) kept loaded in
+// PSRAM: switching back to a cached set only swaps the ROM page pointers,
+// with no SD access. The first set loaded stays in the boot ROM buffers.
+// Needs BOARD_HAS_PSRAM; undefine to always reload ROMs from SD. Only used
+// for sets that are not in flash (ROM_FLASH_PARTITION).
+
+#define ROM_CACHE_SETS 4
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// Quick save
+//
+// QUICK_SLOTS is the number of quick save slots kept in memory (PSRAM
+// if available). RAM pages equal in several slots are stored once.
+
+#define QUICK_SLOTS 10
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// Rewind
+//
+// define REWIND_BUFFER to keep a history of the machine state in PSRAM,
+// captured every REWIND_INTERVAL frames; F11 steps back one capture.
+// A capture holds the CPU and paging state plus the 256 byte RAM blocks
+// written since the previous one, XOR'ed with their previous contents
+// and run length encoded. REWIND_BUFFER_SIZE is the memory budget in
+// bytes (at least 136K); oldest captures are dropped to stay within it.
+
+#define REWIND_BUFFER
+#define REWIND_INTERVAL 25
+#define REWIND_BUFFER_SIZE (1024 * 1024)
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// Hibernate
+//
+// define HIBERNATE_PARTITION (partition name) to add "Hibernate" to the
+// reset menu: machine state and RAM are written to that flash data
+// partition, and restored at next boot from memory-mapped flash instead
+// of loading the boot.cfg snapshot from SD. The image is resumed once.
+// The partition (subtype HIBERNATE_SUBTYPE, 132K at least) is in
+// partitions_hibernate.csv, selected in platformio.ini.
+
+#define HIBERNATE_PARTITION "hibernate"
+#define HIBERNATE_SUBTYPE 0x40
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// RAM bank placement
+//
+// define MEM_PLACEMENT to move the RAM banks a program uses most into
+// SRAM: one in MEM_SAMPLE_MASK+1 reads and writes at 0xC000 is counted
+// for the bank mapped there, and every MEM_PLACE_FRAMES frames the most
+// used bank in PSRAM is swapped with the least used one in SRAM, if
+// clearly hotter.
+// Banks 2 and 5 are always mapped, and stay in place.
+// Needs BOARD_HAS_PSRAM.
+
+#define MEM_PLACEMENT
+#define MEM_SAMPLE_MASK 63
+#define MEM_PLACE_FRAMES 50
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// Snapshot previews
+//
+// define OSD_PREVIEW to show a half size picture of the screen of the
+// SNA/Z80 snapshot focused in the snapshot menu. Screens read are kept in
+// PSRAM (if available), PREVIEW_CACHE at most, replacing the least
+// recently shown.
+
+#define OSD_PREVIEW
+#define PREVIEW_CACHE 32
 ///////////////////////////////////////////////////////////////////////////////
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -38,6 +38,13 @@
 #define SPEAKER_PIN 25
 #endif // SPEAKER_PRESENT
 
+#ifdef AUDIO_I2S_DAC
+// external I2S DAC; GPIO25 is free as the built-in DAC is not used then
+#define AUDIO_I2S_BCK_PIN 26
+#define AUDIO_I2S_WS_PIN 25
+#define AUDIO_I2S_DATA_PIN 27
+#endif // AUDIO_I2S_DAC
+
 #ifdef EAR_PRESENT
 #define EAR_PIN 16
 #endif // EAR_PRESENT
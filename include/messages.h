@@ -34,6 +34,9 @@
 #define MSG_LOADING "Loading file"
 #define MSG_LOADING_SNA "Loading SNA file"
 #define MSG_LOADING_Z80 "Loading Z80 file"
+#define MSG_LOADING_SZX "Loading SZX file"
+#define MSG_LOADING_TAP "Inserting tape file"
+#define MSG_TAP_INSERTED "Tape inserted: LOAD \"\""
 #define MSG_SAVE_CONFIG "Saving config file"
 #define MSG_CHIP_SETUP "Chip setup"
 #define MSG_VGA_INIT "Initalizing VGA"
@@ -81,6 +84,24 @@
 #define OSD_PSNA_LOADED "Persist Snapshot Loaded"
 #define OSD_PSNA_LOAD_ERR "ERROR Loading Persist Snapshot"
 #define OSD_PSNA_SAVED "Persist Snapshot Saved"
+#define OSD_PSNA_BUSY "Persist Snapshot save in progress"
+
+#define OSD_HIBERNATING "Hibernating..."
+#define OSD_HIBERNATED "Hibernated: safe to power off"
+#define OSD_HIBERNATE_ERR "ERROR Hibernating"
+
+#define OSD_REWIND "<< Rewind"
+#define OSD_REWIND_NONE "Nothing to rewind"
+
+#define OSD_PSG_REC_ON "PSG Recording Started"
+#define OSD_PSG_REC_OFF "PSG Recording Saved"
+#define OSD_PSG_REC_ERR "ERROR Starting PSG Recording"
+#define OSD_WAV_REC_ON "WAV Recording Started"
+#define OSD_WAV_REC_OFF "WAV Recording Saved"
+#define OSD_WAV_REC_ERR "ERROR Starting WAV Recording"
+#define OSD_TAPE_PLAY "Tape Playing"
+#define OSD_TAPE_STOP "Tape Stopped"
+#define OSD_TAPE_NONE "No Tape Inserted"
 
 #define MENU_SNA_TITLE "Select Snapshot"
 #define MENU_MAIN \
@@ -94,11 +115,15 @@
     "Reset\n"\
     "About...\n"\
     "Return\n"
+#define MENU_QSNA_SAVE "Quick Save to Slot\n"
+#define MENU_QSNA_LOAD "Quick Load from Slot\n"
+#define MENU_QSNA_SLOT "Slot "
 #define MENU_RESET \
     "Reset Menu\n"\
     "Soft reset\n"\
     "Hard reset\n"\
     "ESP host reset\n"\
+    "Hibernate\n"\
     "Cancel\n"
 #define MENU_DEMO "Demo mode\nOFF\n 1 minute\n 3 minutes\n 5 minutes\n15 minutes\n30 minutes\n 1 hour\n"
 #define MENU_ARCH "Select Arch\n"
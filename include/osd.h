@@ -38,6 +38,13 @@
 #define OSD_FONT_W 6
 #define OSD_FONT_H 8
 
+#define NOTICE_KEEP 0xFFFF
+#define NOTICE_FRAMES 100
+
+// snapshot preview: half size screen plus a 1 pixel frame
+#define PREVIEW_W (128 + 2)
+#define PREVIEW_H (96 + 2)
+
 // OSD Interface
 class OSD
 {
@@ -74,18 +81,35 @@ public:
     static void menuRedraw();
     static String getArchMenu();
     static String getRomsetMenu(String arch);
+    static String getQuickSlotMenu(String title);
     static unsigned short menuRun(String new_menu);
     static unsigned short menuRun(char * new_menu);
+    // menu of the entries in dir, after a ".." row if parent is set
+    static unsigned short menuRunDir(String title, String dir, bool parent);
+    // text of a row of the last menu run
+    static String menuRowGet(unsigned short row);
     static void menuScroll(boolean up);
     static void menuAt(short int row, short int col);
     static void menuScrollBar();
     static String getTestMenu(unsigned short n_lines);
 
-    // Rows
-    static unsigned short rowCount(String menu);
-    static unsigned short rowCount(char * charmenu);
-    static String rowGet(String menu, unsigned short row_number);
-    static String rowGet(char * menu, unsigned short row_number);
+    // next menuRun shows a preview of the snapshot file in dir named by
+    // the focused row, to the right of the menu; size 0 if not known
+    static void menuPreview(String dir);
+    static void previewDraw(String path, uint32_t size, unsigned short x, unsigned short y);
+
+    // Statistics overlay
+    static bool statsVisible;
+    static uint32_t statsCpuMicros;
+    static void statsToggle();
+    static void statsUpdate(bool force = false);
+    static void statsDraw();
+    static void turboDraw();
+
+    // short message in the bottom left corner while emulation runs,
+    // shown for the given number of frames (NOTICE_KEEP: until replaced)
+    static void notice(const char* text, uint16_t frames);
+    static void noticeDraw();
 
     // Snapshot (SNA/Z80) Management
     static bool changeSnapshot(String sna_filename);
@@ -36,6 +36,7 @@
   #include "hal/i2s_types.h"
 #endif
 #include "esp_log.h"
+#include "esp_timer.h"
 
 
 #include "soundgen.h"
@@ -47,9 +48,6 @@
 namespace fabgl {
 
 
-// maximum value is I2S_SAMPLE_BUFFER_SIZE
-#define FABGL_SAMPLE_BUFFER_SIZE 32
-
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -461,10 +459,19 @@ SoundGenerator::SoundGenerator(int sampleRate)
     m_volume(100),
     m_sampleRate(sampleRate),
     m_play(false),
-    m_state(SoundGeneratorState::Stop)
+    m_state(SoundGeneratorState::Stop),
+    m_output(SoundGeneratorOutput::BuiltInDAC),
+    m_bckPin(-1),
+    m_wsPin(-1),
+    m_dataPin(-1),
+    m_dmaBufferCount(DEFAULT_DMA_BUFFER_COUNT),
+    m_dmaBufferLength(DEFAULT_DMA_BUFFER_LENGTH),
+    m_i2sEventQueue(nullptr),
+    m_queuedBytes(0)
 {
   m_mutex = xSemaphoreCreateMutex();
   i2s_audio_init();
+  resetStats();
 }
 
 
@@ -487,28 +494,129 @@ void SoundGenerator::clear()
 
 void SoundGenerator::i2s_audio_init()
 {
+  bool builtInDAC = (m_output == SoundGeneratorOutput::BuiltInDAC);
+
   i2s_config_t i2s_config;
-  i2s_config.mode                 = (i2s_mode_t) (I2S_MODE_MASTER | I2S_MODE_TX | I2S_MODE_DAC_BUILT_IN);
+  i2s_config.mode                 = builtInDAC ? (i2s_mode_t) (I2S_MODE_MASTER | I2S_MODE_TX | I2S_MODE_DAC_BUILT_IN)
+                                               : (i2s_mode_t) (I2S_MODE_MASTER | I2S_MODE_TX);
   i2s_config.sample_rate          = m_sampleRate;
   i2s_config.bits_per_sample      = I2S_BITS_PER_SAMPLE_16BIT;
   #if FABGL_ESP_IDF_VERSION <= FABGL_ESP_IDF_VERSION_VAL(4, 1, 1)
-    i2s_config.communication_format = (i2s_comm_format_t) I2S_COMM_FORMAT_I2S_MSB;
+    i2s_config.communication_format = builtInDAC ? (i2s_comm_format_t) I2S_COMM_FORMAT_I2S_MSB : (i2s_comm_format_t) I2S_COMM_FORMAT_I2S;
   #else
     i2s_config.communication_format = I2S_COMM_FORMAT_STAND_I2S;
   #endif
-  i2s_config.channel_format       = I2S_CHANNEL_FMT_ONLY_RIGHT;
+  i2s_config.channel_format       = builtInDAC ? I2S_CHANNEL_FMT_ONLY_RIGHT : I2S_CHANNEL_FMT_RIGHT_LEFT;
   i2s_config.intr_alloc_flags     = 0;
-  i2s_config.dma_buf_count        = 2;
-  i2s_config.dma_buf_len          = FABGL_SAMPLE_BUFFER_SIZE * sizeof(uint16_t);
+  i2s_config.dma_buf_count        = m_dmaBufferCount;
+  // built-in DAC: 16 bit mono frames, each DMA buffer holds two mixed buffers
+  // external DAC: 16 bit stereo frames, each DMA buffer holds one mixed buffer
+  i2s_config.dma_buf_len          = builtInDAC ? m_dmaBufferLength * sizeof(uint16_t) : m_dmaBufferLength;
   i2s_config.use_apll             = 0;
   i2s_config.tx_desc_auto_clear   = 0;
   i2s_config.fixed_mclk           = 0;
-  // install and start i2s driver
-  i2s_driver_install(I2S_NUM_0, &i2s_config, 0, NULL);
-  // init DAC pad
-  i2s_set_dac_mode(I2S_DAC_CHANNEL_RIGHT_EN); // GPIO25
+  // install and start i2s driver, with an event queue for tracking DMA buffer consumption
+  i2s_driver_install(I2S_NUM_0, &i2s_config, m_dmaBufferCount + 2, &m_i2sEventQueue);
+
+  m_dmaBufferBytes = m_dmaBufferLength * 2 * sizeof(uint16_t);
+
+  if (builtInDAC) {
+    // init DAC pad
+    i2s_set_dac_mode(I2S_DAC_CHANNEL_RIGHT_EN); // GPIO25
+    m_writeBytes = m_dmaBufferLength * sizeof(uint16_t);
+  } else {
+    i2s_pin_config_t pin_config;
+    pin_config.bck_io_num   = m_bckPin;
+    pin_config.ws_io_num    = m_wsPin;
+    pin_config.data_out_num = m_dataPin;
+    pin_config.data_in_num  = I2S_PIN_NO_CHANGE;
+    i2s_set_pin(I2S_NUM_0, &pin_config);
+    m_writeBytes = m_dmaBufferLength * 2 * sizeof(uint16_t);
+  }
+
+  m_sampleBuffer = (uint16_t*) heap_caps_malloc(m_writeBytes, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+  m_queuedBytes = 0;
+}
+
+
+void SoundGenerator::i2s_audio_deinit()
+{
+  i2s_driver_uninstall(I2S_NUM_0);
+  m_i2sEventQueue = nullptr;
+  heap_caps_free(m_sampleBuffer);
+  m_sampleBuffer = nullptr;
+}
+
+
+void SoundGenerator::resetStats()
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+  m_stats.queueDepthMin = m_dmaBufferCount * m_dmaBufferBytes / m_writeBytes;
+}
+
+
+bool SoundGenerator::setDMABuffers(int count, int length)
+{
+  if (count < 2 || count > 128 || length < 8 || length > I2S_SAMPLE_BUFFER_SIZE || (length & 1))
+    return false;
+
+  AutoSemaphore autoSemaphore(m_mutex);
+
+  m_dmaBufferCount  = count;
+  m_dmaBufferLength = length;
+  reinstall();
+  return true;
+}
+
+
+void SoundGenerator::setOutput(SoundGeneratorOutput output, int bckPin, int wsPin, int dataPin)
+{
+  AutoSemaphore autoSemaphore(m_mutex);
+
+  m_output  = output;
+  m_bckPin  = bckPin;
+  m_wsPin   = wsPin;
+  m_dataPin = dataPin;
+  reinstall();
+}
+
+
+// reinstalls I2S driver with current configuration, must be called with m_mutex taken
+void SoundGenerator::reinstall()
+{
+  bool isPlaying = forcePlay(false);
+
+  i2s_audio_deinit();
+  i2s_audio_init();
 
-  m_sampleBuffer = (uint16_t*) heap_caps_malloc(FABGL_SAMPLE_BUFFER_SIZE * sizeof(uint16_t), MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+  // sample rate and channels are set again by the task when resuming
+  if (m_waveGenTaskHandle) {
+    vTaskDelete(m_waveGenTaskHandle);
+    m_waveGenTaskHandle = nullptr;
+  }
+  m_state = SoundGeneratorState::Stop;
+
+  resetStats();
+
+  forcePlay(isPlaying || m_play);
+}
+
+
+// drains I2S events, accounting for DMA buffers already sent to the DAC
+void SoundGenerator::updateQueueStats()
+{
+  i2s_event_t event;
+  while (xQueueReceive(m_i2sEventQueue, &event, 0) == pdTRUE) {
+    if (event.type == I2S_EVENT_TX_DONE) {
+      m_queuedBytes -= m_dmaBufferBytes;
+      if (m_queuedBytes < 0) {
+        // DMA ran out of fresh samples and replayed stale ones
+        ++m_stats.underruns;
+        m_queuedBytes = 0;
+      }
+    }
+  }
+  m_stats.queueDepth = m_queuedBytes / m_writeBytes;
 }
 
 
@@ -621,9 +729,9 @@ void SoundGenerator::waveGenTask(void * arg)
 {
   SoundGenerator * soundGenerator = (SoundGenerator*) arg;
 
-  i2s_set_clk(I2S_NUM_0, soundGenerator->m_sampleRate, I2S_BITS_PER_SAMPLE_16BIT, I2S_CHANNEL_MONO);
+  const bool stereo = (soundGenerator->m_output == SoundGeneratorOutput::ExternalI2S);
 
-  uint16_t * buf = soundGenerator->m_sampleBuffer;
+  i2s_set_clk(I2S_NUM_0, soundGenerator->m_sampleRate, I2S_BITS_PER_SAMPLE_16BIT, stereo ? I2S_CHANNEL_STEREO : I2S_CHANNEL_MONO);
 
   // number of mute (without channels to play) cycles
   int muteCyclesCount = 0;
@@ -648,30 +756,92 @@ void SoundGenerator::waveGenTask(void * arg)
 
     int mainVolume = soundGenerator->volume();
 
-    for (int i = 0; i < FABGL_SAMPLE_BUFFER_SIZE; ++i) {
-      int sample = 0, tvol = 0;
-      for (auto g = soundGenerator->m_channels; g; ) {
-        if (g->enabled()) {
-          sample += g->getSample();
-          tvol += g->volume();
-        } else if (g->duration() == 0 && g->autoDetach()) {
-          auto curr = g;
-          g = g->next;  // setup next item before detaching this one
-          soundGenerator->detachNoSuspend(curr);
-          continue; // bypass "g = g->next;"
+    uint16_t * buf = soundGenerator->m_sampleBuffer;
+    const int bufLen = soundGenerator->m_dmaBufferLength;
+
+    int64_t mixStart = esp_timer_get_time();
+
+    if (stereo) {
+
+      // 16 bit signed stereo frames, right channel at lower address
+      int16_t * sbuf = (int16_t *) buf;
+
+      for (int i = 0; i < bufLen; ++i) {
+        int left = 0, right = 0, tvol = 0;
+        for (auto g = soundGenerator->m_channels; g; ) {
+          if (g->enabled()) {
+            int l, r;
+            g->getStereoSample(&l, &r);
+            left  += l;
+            right += r;
+            tvol  += g->volume();
+          } else if (g->duration() == 0 && g->autoDetach()) {
+            auto curr = g;
+            g = g->next;  // setup next item before detaching this one
+            soundGenerator->detachNoSuspend(curr);
+            continue; // bypass "g = g->next;"
+          }
+          g = g->next;
         }
-        g = g->next;
+
+        int avol = tvol ? imin(127, 127 * 127 / tvol) : 127;
+        int mul  = avol * mainVolume;
+        left  = left  * mul / (127 * 127);
+        right = right * mul / (127 * 127);
+
+        sbuf[i * 2]     = iclamp(right, -32768, 32767);
+        sbuf[i * 2 + 1] = iclamp(left,  -32768, 32767);
       }
 
-      int avol = tvol ? imin(127, 127 * 127 / tvol) : 127;
-      sample = sample * avol / 127;
-      sample = sample * mainVolume / 127;
+    } else {
+
+      for (int i = 0; i < bufLen; ++i) {
+        int sample = 0, tvol = 0;
+        for (auto g = soundGenerator->m_channels; g; ) {
+          if (g->enabled()) {
+            sample += g->getSample();
+            tvol += g->volume();
+          } else if (g->duration() == 0 && g->autoDetach()) {
+            auto curr = g;
+            g = g->next;  // setup next item before detaching this one
+            soundGenerator->detachNoSuspend(curr);
+            continue; // bypass "g = g->next;"
+          }
+          g = g->next;
+        }
+
+        int avol = tvol ? imin(127, 127 * 127 / tvol) : 127;
+        sample = sample * avol / 127;
+        sample = sample * mainVolume / 127;
+
+        buf[i + (i & 1 ? -1 : 1)] = (127 + sample) << 8;
+      }
 
-      buf[i + (i & 1 ? -1 : 1)] = (127 + sample) << 8;
     }
 
+    SoundGeneratorStats & stats = soundGenerator->m_stats;
+
+    int64_t mixEnd = esp_timer_get_time();
+    stats.mixerTimeLast = (uint32_t)(mixEnd - mixStart);
+    stats.mixerTimeTotal += stats.mixerTimeLast;
+    if (stats.mixerTimeLast > stats.mixerTimeMax)
+      stats.mixerTimeMax = stats.mixerTimeLast;
+
+    soundGenerator->updateQueueStats();
+
     size_t bytes_written;
-    i2s_write(I2S_NUM_0, buf, FABGL_SAMPLE_BUFFER_SIZE * sizeof(uint16_t), &bytes_written, portMAX_DELAY);
+    i2s_write(I2S_NUM_0, buf, soundGenerator->m_writeBytes, &bytes_written, portMAX_DELAY);
+
+    int64_t now = esp_timer_get_time();
+    if (stats.lastWriteTime != 0 && now - stats.lastWriteTime > stats.writeIntervalMax)
+      stats.writeIntervalMax = (uint32_t)(now - stats.lastWriteTime);
+    stats.lastWriteTime = now;
+    ++stats.buffersWritten;
+
+    soundGenerator->m_queuedBytes += bytes_written;
+    soundGenerator->updateQueueStats();
+    if (stats.queueDepth < stats.queueDepthMin)
+      stats.queueDepthMin = stats.queueDepth;
 
     muteCyclesCount = soundGenerator->m_channels == nullptr ? muteCyclesCount + 1 : 0;
   }
@@ -680,11 +850,13 @@ void SoundGenerator::waveGenTask(void * arg)
 
 void SoundGenerator::mutizeOutput()
 {
-  for (int i = 0; i < FABGL_SAMPLE_BUFFER_SIZE; ++i)
-    m_sampleBuffer[i] = 127 << 8;
+  // external DAC takes signed samples, built-in DAC unsigned
+  uint16_t silence = (m_output == SoundGeneratorOutput::BuiltInDAC) ? 127 << 8 : 0;
+  for (int i = 0; i < m_writeBytes / sizeof(uint16_t); ++i)
+    m_sampleBuffer[i] = silence;
   size_t bytes_written;
   for (int i = 0; i < 4; ++i)
-    i2s_write(I2S_NUM_0, m_sampleBuffer, FABGL_SAMPLE_BUFFER_SIZE * sizeof(uint16_t), &bytes_written, portMAX_DELAY);
+    i2s_write(I2S_NUM_0, m_sampleBuffer, m_writeBytes, &bytes_written, portMAX_DELAY);
 }
 
 
@@ -53,6 +53,10 @@ namespace fabgl {
 
 #define WAVEGENTASK_STACK_SIZE 2000
 
+// default DMA configuration: 2 buffers of 32 samples each
+#define DEFAULT_DMA_BUFFER_COUNT  2
+#define DEFAULT_DMA_BUFFER_LENGTH 32
+
 
 /** @brief Base abstract class for waveform generators. A waveform generator can be seen as an audio channel that will be mixed by SoundGenerator. */
 class WaveformGenerator {
@@ -107,6 +111,16 @@ public:
    */
   virtual int getSample() = 0;
 
+  /**
+   * @brief Gets next stereo sample, used when output is an external stereo DAC
+   *
+   * Default implementation duplicates getSample() on both channels.
+   *
+   * @param left Left sample as signed 16 bit
+   * @param right Right sample as signed 16 bit
+   */
+  virtual void getStereoSample(int * left, int * right) { *left = *right = getSample() << 8; }
+
   /**
    * @brief Sets volume of this generator
    *
@@ -310,6 +324,31 @@ private:
 };
 
 
+/**
+ * @brief Audio output statistics, updated by the waveform generation task
+ *
+ * Counters are cumulative since the last call to SoundGenerator.resetStats().
+ */
+struct SoundGeneratorStats {
+  uint32_t buffersWritten;    /**< Number of sample buffers sent to I2S */
+  uint32_t underruns;         /**< Number of times DMA consumed all queued samples before a new buffer arrived */
+  uint32_t mixerTimeLast;     /**< Microseconds spent mixing the last buffer */
+  uint32_t mixerTimeMax;      /**< Maximum microseconds spent mixing a buffer */
+  uint64_t mixerTimeTotal;    /**< Accumulated microseconds spent mixing */
+  int      queueDepth;        /**< Sample buffers queued in DMA and not played yet */
+  int      queueDepthMin;     /**< Minimum queue depth seen after a write */
+  int64_t  lastWriteTime;     /**< Timestamp (esp_timer_get_time) of the last buffer write */
+  uint32_t writeIntervalMax;  /**< Longest time between two buffer writes, in microseconds */
+};
+
+
+/** @brief Audio output device */
+enum class SoundGeneratorOutput {
+  BuiltInDAC,   /**< ESP32 8 bit DAC on GPIO25, mono */
+  ExternalI2S,  /**< External I2S DAC, 16 bit stereo */
+};
+
+
 enum class SoundGeneratorState {
   Stop,
   RequestToPlay,
@@ -455,10 +494,63 @@ public:
    */
   int volume() { return m_volume; }
 
+  /**
+   * @brief Gets audio output statistics
+   *
+   * @return Reference to statistics, updated by the waveform generation task
+   */
+  SoundGeneratorStats const & stats() { return m_stats; }
+
+  /**
+   * @brief Resets audio output statistics
+   */
+  void resetStats();
+
+  /**
+   * @brief Reconfigures I2S DMA buffers
+   *
+   * Playing is suspended while the I2S driver is reinstalled, then resumed.
+   * Lower values reduce latency, but may produce underruns.
+   *
+   * @param count Number of DMA buffers (2..128)
+   * @param length Samples per buffer (8..I2S_SAMPLE_BUFFER_SIZE, must be even)
+   *
+   * @return True on success
+   */
+  bool setDMABuffers(int count, int length);
+
+  int dmaBufferCount()  { return m_dmaBufferCount; }
+  int dmaBufferLength() { return m_dmaBufferLength; }
+
+  /**
+   * @brief Determines output latency introduced by DMA buffering
+   *
+   * @return Latency in microseconds
+   */
+  int latencyMicros() { return (int)((int64_t)m_dmaBufferCount * m_dmaBufferBytes / m_writeBytes * m_dmaBufferLength * 1000000 / m_sampleRate); }
+
+  /**
+   * @brief Selects audio output device
+   *
+   * Playing is suspended while the I2S driver is reinstalled, then resumed.
+   * With ExternalI2S, generators are mixed with getStereoSample().
+   *
+   * @param output Output device
+   * @param bckPin Bit clock pin (ExternalI2S only)
+   * @param wsPin Word select (LR clock) pin (ExternalI2S only)
+   * @param dataPin Serial data pin (ExternalI2S only)
+   */
+  void setOutput(SoundGeneratorOutput output, int bckPin = -1, int wsPin = -1, int dataPin = -1);
+
+  SoundGeneratorOutput output() { return m_output; }
+
 
 private:
 
   void i2s_audio_init();
+  void i2s_audio_deinit();
+  void updateQueueStats();
+  void reinstall();
   static void waveGenTask(void * arg);
   bool forcePlay(bool value);
   void mutizeOutput();
@@ -480,6 +572,20 @@ private:
   SoundGeneratorState m_state;
   SemaphoreHandle_t   m_mutex;
 
+  SoundGeneratorOutput m_output;
+  int                 m_bckPin;
+  int                 m_wsPin;
+  int                 m_dataPin;
+
+  int                 m_dmaBufferCount;
+  int                 m_dmaBufferLength;
+  int                 m_dmaBufferBytes;   // bytes in each DMA buffer
+  int                 m_writeBytes;       // bytes sent to I2S for each mixed buffer
+  QueueHandle_t       m_i2sEventQueue;
+  int                 m_queuedBytes;
+
+  SoundGeneratorStats m_stats;
+
 };
 
 
@@ -0,0 +1,216 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "AsyncWriter.h"
+#include "FileUtils.h"
+
+#ifndef O_WRONLY
+    #define O_WRONLY 1
+#endif
+
+// writer tasks run on core 0, next to the video task, which has higher priority
+#define ASYNC_WRITER_CORE 0
+#define ASYNC_WRITER_STACK 3072
+// idle wake-up period, in ms
+#define ASYNC_WRITER_POLL 100
+
+AsyncWriter::AsyncWriter(const char* name, size_t bufferSize, size_t chunkSize, UBaseType_t priority)
+    : m_name(name), m_size(bufferSize), m_chunk(chunkSize), m_priority(priority),
+      m_buf(NULL), m_head(0), m_tail(0), m_closing(false),
+      m_flushRequest(0), m_flushDone(0), m_failed(false),
+      m_written(0), m_dropped(0), m_droppedBytes(0), m_preallocated(false),
+      m_task(NULL), m_done(NULL)
+{
+}
+
+bool AsyncWriter::open(const char* path, uint32_t preallocate)
+{
+#ifdef USE_SD_CARD_ALT
+    if (m_task != NULL)
+        return false;
+
+    m_buf = (uint8_t*)malloc(m_size);
+    if (m_buf == NULL)
+        m_buf = (uint8_t*)ps_malloc(m_size);
+    if (m_buf == NULL) {
+        Serial.printf("AsyncWriter %s: unable to allocate %u bytes\n", m_name, m_size);
+        return false;
+    }
+
+    SD_LOCK;
+    bool ok = m_file.open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    m_preallocated = false;
+    if (ok && preallocate > 0)
+        m_preallocated = m_file.preAllocate(preallocate);
+    SD_UNLOCK;
+    if (!ok) {
+        Serial.printf("AsyncWriter %s: unable to create %s\n", m_name, path);
+        free(m_buf);
+        m_buf = NULL;
+        return false;
+    }
+
+    m_head = m_tail = 0;
+    m_closing = false;
+    m_flushRequest = m_flushDone = 0;
+    m_failed = false;
+    m_written = 0;
+    m_dropped = 0;
+    m_droppedBytes = 0;
+
+    if (m_done == NULL)
+        m_done = xSemaphoreCreateBinary();
+    xTaskCreatePinnedToCore(&AsyncWriter::task, m_name, ASYNC_WRITER_STACK, this, m_priority, &m_task, ASYNC_WRITER_CORE);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool AsyncWriter::write(const void* data, size_t len)
+{
+    if (m_task == NULL || m_closing)
+        return false;
+
+    uint32_t head = m_head;
+    uint32_t used = head - m_tail;
+    if (len > m_size - used) {
+        m_dropped++;
+        m_droppedBytes += len;
+        return false;
+    }
+
+    // copy, wrapping around the end of the ring
+    size_t pos = head & (m_size - 1);
+    size_t first = m_size - pos;
+    if (first > len) first = len;
+    memcpy(m_buf + pos, data, first);
+    if (len > first)
+        memcpy(m_buf, (const uint8_t*)data + first, len - first);
+    m_head = head + len;
+
+    // wake writer when a chunk gets completed
+    if (used < m_chunk && used + len >= m_chunk)
+        xTaskNotifyGive(m_task);
+    return true;
+}
+
+void AsyncWriter::flush()
+{
+    if (m_task == NULL)
+        return;
+    m_flushRequest++;
+    xTaskNotifyGive(m_task);
+}
+
+void AsyncWriter::drain(bool all)
+{
+#ifdef USE_SD_CARD_ALT
+    for (;;) {
+        uint32_t tail = m_tail;
+        uint32_t avail = m_head - tail;
+        if (avail == 0 || (!all && avail < m_chunk))
+            return;
+
+        size_t pos = tail & (m_size - 1);
+        size_t n = avail < m_chunk ? avail : m_chunk;
+        if (n > m_size - pos)
+            n = m_size - pos;
+
+        SD_LOCK;
+        size_t w = m_failed ? 0 : m_file.write(m_buf + pos, n);
+        SD_UNLOCK;
+        if (w != n)
+            m_failed = true;
+        else
+            m_written += n;
+
+        // on failure keep consuming, so the producer never stalls
+        m_tail = tail + n;
+    }
+#endif
+}
+
+void AsyncWriter::task(void* arg)
+{
+    AsyncWriter* w = (AsyncWriter*)arg;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ASYNC_WRITER_POLL));
+        if (w->m_closing) {
+            w->drain(true);
+            break;
+        }
+        uint32_t flush = w->m_flushRequest;
+        w->drain(flush != w->m_flushDone);
+        if (flush != w->m_flushDone) {
+#ifdef USE_SD_CARD_ALT
+            SD_LOCK;
+            w->m_file.sync();
+            SD_UNLOCK;
+#endif
+            w->m_flushDone = flush;
+        }
+    }
+    xSemaphoreGive(w->m_done);
+    vTaskDelete(NULL);
+}
+
+bool AsyncWriter::close(const void* header, size_t headerLen)
+{
+#ifdef USE_SD_CARD_ALT
+    if (m_task == NULL)
+        return false;
+
+    m_closing = true;
+    xTaskNotifyGive(m_task);
+    xSemaphoreTake(m_done, portMAX_DELAY);
+    m_task = NULL;
+
+    SD_LOCK;
+    if (m_preallocated)
+        m_file.truncate(m_written);
+    if (header != NULL && headerLen > 0) {
+        m_file.seekSet(0);
+        if (m_file.write(header, headerLen) != headerLen)
+            m_failed = true;
+    }
+    if (!m_file.close())
+        m_failed = true;
+    SD_UNLOCK;
+
+    free(m_buf);
+    m_buf = NULL;
+
+    if (m_dropped)
+        Serial.printf("AsyncWriter %s: %u writes (%u bytes) dropped\n", m_name, m_dropped, m_droppedBytes);
+    return !m_failed;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,292 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "AyChip.h"
+#include <string.h>
+#include <strings.h>
+
+// Tone periods below this produce frequencies above any usable output
+// sample rate; such channels are output as a constant half level, which
+// is what the analog filtering on real hardware does and keeps volume
+// modulated sample playback working.
+#define AY_ULTRASONIC_PERIOD 5
+
+// logarithmic DAC levels, scaled to AY_MAX_AMPLITUDE
+static const int16_t ayLevels[16] = {
+       0,  112,  168,  238,  346,  506,  694, 1121,
+    1385, 2168, 2889, 3685, 4672, 5630, 6948, 8191
+};
+
+// valid bits for each register
+static const uint8_t ayRegMask[16] = {
+    0xFF, 0x0F, 0xFF, 0x0F, 0xFF, 0x0F, 0x1F, 0xFF,
+    0x1F, 0x1F, 0x1F, 0xFF, 0xFF, 0x0F, 0xFF, 0xFF
+};
+
+// stereo gains, 256 = 1.0: side channels leak a bit into the opposite
+// side (as most ABC stereo mods do), center channel at -3dB on both
+#define AY_PAN_SIDE     256
+#define AY_PAN_OPPOSITE  64
+#define AY_PAN_CENTER   181
+
+AyChip::AyChip() : m_out(NULL)
+{
+    setStereoMode(AY_STEREO_ABC);
+    reset();
+}
+
+void AyChip::setStereoMode(int mode)
+{
+    static const int gains[3][2] = {
+        { AY_PAN_SIDE, AY_PAN_OPPOSITE },   // left
+        { AY_PAN_CENTER, AY_PAN_CENTER },   // center
+        { AY_PAN_OPPOSITE, AY_PAN_SIDE },   // right
+    };
+    // position of channels A, B, C for each mode
+    static const int place[3][3] = {
+        { 1, 1, 1 },    // mono
+        { 0, 1, 2 },    // ABC
+        { 0, 2, 1 },    // ACB
+    };
+
+    if (mode < AY_STEREO_MONO || mode > AY_STEREO_ACB)
+        mode = AY_STEREO_ABC;
+    m_stereoMode = mode;
+    for (int ch = 0; ch < 3; ch++) {
+        int p = place[mode][ch];
+        m_panLeft[ch] = (mode == AY_STEREO_MONO) ? 256 : gains[p][0];
+        m_panRight[ch] = (mode == AY_STEREO_MONO) ? 256 : gains[p][1];
+    }
+}
+
+int AyChip::parseStereoMode(const char* name)
+{
+    if (strcasecmp(name, "MONO") == 0) return AY_STEREO_MONO;
+    if (strcasecmp(name, "ABC") == 0) return AY_STEREO_ABC;
+    if (strcasecmp(name, "ACB") == 0) return AY_STEREO_ACB;
+    return -1;
+}
+
+void AyChip::reset()
+{
+    memset(m_regs, 0, sizeof(m_regs));
+    m_time = 0;
+    for (int ch = 0; ch < 3; ch++) {
+        m_tonePeriod[ch] = 1;
+        m_toneCounter[ch] = 0;
+        m_toneOutput[ch] = 0;
+        m_amplitude[ch] = 0;
+        m_outLeft[ch] = 0;
+        m_outRight[ch] = 0;
+    }
+    m_noisePeriod = 2;
+    m_noiseCounter = 0;
+    m_noiseShift = 1;
+    m_noiseOutput = 0;
+    m_envPeriod = 2;
+    m_envCounter = 0;
+    m_envStep = 0;
+    m_envMask = 15;
+    m_envLevel = 0;
+    m_envHolding = true;
+}
+
+void AyChip::writeRegister(uint8_t reg, uint8_t data, uint32_t time)
+{
+    if (reg > 15)
+        return;
+
+    run(time);
+
+    data &= ayRegMask[reg];
+    m_regs[reg] = data;
+
+    switch (reg)
+    {
+    case 0: case 1: case 2: case 3: case 4: case 5:
+    {
+        int ch = reg >> 1;
+        uint16_t period = ((m_regs[ch * 2 + 1] << 8) | m_regs[ch * 2]);
+        m_tonePeriod[ch] = period ? period : 1;
+        break;
+    }
+    case 6:
+        m_noisePeriod = (data ? data : 1) * 2;
+        break;
+    case 11: case 12:
+    {
+        uint32_t period = (m_regs[12] << 8) | m_regs[11];
+        m_envPeriod = (period ? period : 1) * 2;
+        break;
+    }
+    case 13:
+        // writing the shape restarts the envelope
+        m_envCounter = 0;
+        m_envStep = 0;
+        m_envMask = (data & 0x04) ? 0 : 15;
+        m_envLevel = m_envMask;
+        m_envHolding = false;
+        break;
+    }
+
+    updateOutput(time);
+}
+
+void AyChip::loadRegisters(const uint8_t* regs, uint32_t time)
+{
+    run(time);
+
+    for (int reg = 0; reg < 16; reg++)
+        m_regs[reg] = regs[reg] & ayRegMask[reg];
+
+    for (int ch = 0; ch < 3; ch++) {
+        uint16_t period = ((m_regs[ch * 2 + 1] << 8) | m_regs[ch * 2]);
+        m_tonePeriod[ch] = period ? period : 1;
+    }
+    m_noisePeriod = (m_regs[6] ? m_regs[6] : 1) * 2;
+    uint32_t period = (m_regs[12] << 8) | m_regs[11];
+    m_envPeriod = (period ? period : 1) * 2;
+
+    updateOutput(time);
+}
+
+void AyChip::stepEnvelope()
+{
+    if (m_envHolding)
+        return;
+
+    if (++m_envStep > 15) {
+        uint8_t shape = m_regs[13];
+        if (!(shape & 0x08)) {
+            // single cycle, then silence
+            m_envHolding = true;
+            m_envLevel = 0;
+            return;
+        }
+        if (shape & 0x01) {
+            // hold last level, inverted when alternating
+            m_envHolding = true;
+            m_envLevel = (15 ^ m_envMask) ^ ((shape & 0x02) ? 15 : 0);
+            return;
+        }
+        m_envStep = 0;
+        if (shape & 0x02)
+            m_envMask ^= 15;
+    }
+    m_envLevel = m_envStep ^ m_envMask;
+}
+
+void AyChip::updateOutput(uint32_t time)
+{
+    uint8_t mixer = m_regs[7];
+    for (int ch = 0; ch < 3; ch++) {
+        uint8_t vol = m_regs[8 + ch];
+        int level = ayLevels[(vol & 0x10) ? m_envLevel : (vol & 0x0F)];
+
+        bool toneOff  = (mixer >> ch) & 1;
+        bool noiseOff = (mixer >> (ch + 3)) & 1;
+
+        int amp;
+        if (!toneOff && m_tonePeriod[ch] < AY_ULTRASONIC_PERIOD)
+            amp = (noiseOff || m_noiseOutput) ? level >> 1 : 0;
+        else
+            amp = ((toneOff || m_toneOutput[ch]) && (noiseOff || m_noiseOutput)) ? level : 0;
+
+        if (amp == m_amplitude[ch])
+            continue;
+        m_amplitude[ch] = amp;
+
+        if (m_out == NULL)
+            continue;
+        if (m_out->channels() == 2) {
+            int left = (amp * m_panLeft[ch]) >> 8;
+            int right = (amp * m_panRight[ch]) >> 8;
+            m_out->addStereoDelta(time, left - m_outLeft[ch], right - m_outRight[ch]);
+            m_outLeft[ch] = left;
+            m_outRight[ch] = right;
+        } else {
+            m_out->addDelta(time, amp - m_outLeft[ch]);
+            m_outLeft[ch] = amp;
+        }
+    }
+}
+
+// Advance all generators up to time. Instead of ticking one by one,
+// jump straight to the next tick where some counter expires.
+void AyChip::run(uint32_t time)
+{
+    while (m_time + AY_TICK <= (int32_t)time) {
+        uint32_t n = ((int32_t)time - m_time) / AY_TICK;
+        for (int ch = 0; ch < 3; ch++) {
+            uint32_t left = m_toneCounter[ch] >= m_tonePeriod[ch] ? 1 : m_tonePeriod[ch] - m_toneCounter[ch];
+            if (left < n) n = left;
+        }
+        uint32_t noiseLeft = m_noiseCounter >= m_noisePeriod ? 1 : m_noisePeriod - m_noiseCounter;
+        if (noiseLeft < n) n = noiseLeft;
+        if (!m_envHolding) {
+            uint32_t envLeft = m_envCounter >= m_envPeriod ? 1 : m_envPeriod - m_envCounter;
+            if (envLeft < n) n = envLeft;
+        }
+
+        m_time += n * AY_TICK;
+
+        for (int ch = 0; ch < 3; ch++) {
+            m_toneCounter[ch] += n;
+            if (m_toneCounter[ch] >= m_tonePeriod[ch]) {
+                m_toneCounter[ch] = 0;
+                m_toneOutput[ch] ^= 1;
+            }
+        }
+
+        m_noiseCounter += n;
+        if (m_noiseCounter >= m_noisePeriod) {
+            m_noiseCounter = 0;
+            // 17 bit LFSR, taps at bits 0 and 3
+            m_noiseShift = (m_noiseShift >> 1) | (((m_noiseShift ^ (m_noiseShift >> 3)) & 1) << 16);
+            m_noiseOutput = m_noiseShift & 1;
+        }
+
+        if (!m_envHolding) {
+            m_envCounter += n;
+            if (m_envCounter >= m_envPeriod) {
+                m_envCounter = 0;
+                stepEnvelope();
+            }
+        }
+
+        updateOutput(m_time);
+    }
+}
+
+void AyChip::endFrame(uint32_t clocks)
+{
+    run(clocks);
+    // keep the part of the tick that falls into next frame
+    m_time -= clocks;
+}
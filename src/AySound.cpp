@@ -30,12 +30,190 @@
 #include "hardconfig.h"
 #include <Arduino.h>
 #include "AySound.h"
+#include "Config.h"
+#include "hardpins.h"
+#include "PsgRecorder.h"
+#include "WavRecorder.h"
 
 #ifdef USE_AY_SOUND
 
 #include "fabgl.h"
 
-static SoundGenerator _soundGenerator;
+static SoundGenerator _soundGenerator(AUDIO_SAMPLE_RATE);
+
+#ifdef AUDIO_BLEP_MIXER
+
+#include "AyChip.h"
+#include "BlepBuffer.h"
+#include "CPU.h"
+
+// amplitude of beeper output, comparable to an AY channel at full volume
+#define BEEPER_AMPLITUDE 8191
+
+// external DAC is fed stereo, built-in DAC mono
+#ifdef AUDIO_I2S_DAC
+#define PCM_CHANNELS 2
+#else
+#define PCM_CHANNELS 1
+#endif
+
+// mixed PCM frames waiting to be played (power of 2), about 6 emulated frames at 16KHz
+#define PCM_RING_SIZE 2048
+// frames above this are dropped, to keep latency bounded
+#define PCM_RING_MAX_FILL (PCM_RING_SIZE * 3 / 4)
+
+static BlepBuffer _blep(PCM_RING_SIZE / 2, PCM_CHANNELS);
+static AyChip _ay;
+static uint8_t _selectedRegister = 0;
+static uint8_t _beeperLevel = 0;
+static uint32_t _clockRate = 0;
+
+// single producer (emulation loop, once per frame) single consumer (sound task) ring;
+// head and tail count frames, each frame holds PCM_CHANNELS interleaved samples
+static int16_t _pcmRing[PCM_RING_SIZE * PCM_CHANNELS];
+static volatile uint32_t _pcmHead = 0;
+static volatile uint32_t _pcmTail = 0;
+static int16_t _pcmFrame[PCM_RING_SIZE / 2 * PCM_CHANNELS];
+static uint32_t _pcmUnderruns = 0;
+static uint32_t _pcmDropped = 0;
+static volatile bool _muted = false;
+
+// plays back the PCM produced by the band-limited mixer
+class PcmWaveformGenerator : public WaveformGenerator
+{
+public:
+    void setFrequency(int value) {}
+
+    // built-in DAC: 8 bit mono
+    int getSample() {
+        int left, right;
+        getStereoSample(&left, &right);
+        return (left + right) >> 9;
+    }
+
+    // external DAC: 16 bit stereo
+    void getStereoSample(int* left, int* right) {
+        uint32_t tail = _pcmTail;
+        if (tail == _pcmHead) {
+            // starved: repeat last sample to avoid a click, or fade when muted
+            if (_muted) {
+                m_left -= m_left >> 4;
+                m_right -= m_right >> 4;
+            }
+            else _pcmUnderruns++;
+        } else {
+            const int16_t* frame = &_pcmRing[(tail & (PCM_RING_SIZE - 1)) * PCM_CHANNELS];
+            m_left = frame[0];
+            m_right = frame[PCM_CHANNELS - 1];
+            _pcmTail = tail + 1;
+        }
+        *left = m_left;
+        *right = m_right;
+    }
+
+private:
+    int m_left = 0;
+    int m_right = 0;
+};
+
+static PcmWaveformGenerator _pcm;
+
+void AySound::initialize()
+{
+    if (!_soundGenerator.setDMABuffers(Config::audio_dma_count, Config::audio_dma_len))
+        Serial.printf("AySound: invalid DMA buffers %d x %d, using defaults\n", Config::audio_dma_count, Config::audio_dma_len);
+    int stereoMode = AyChip::parseStereoMode(Config::ay_stereo.c_str());
+    if (stereoMode < 0) {
+        Serial.printf("AySound: unknown stereo mode '%s', using ABC\n", Config::ay_stereo.c_str());
+        stereoMode = AY_STEREO_ABC;
+    }
+    _ay.setStereoMode(stereoMode);
+    _ay.setOutput(&_blep);
+#ifdef AUDIO_I2S_DAC
+    _soundGenerator.setOutput(SoundGeneratorOutput::ExternalI2S, AUDIO_I2S_BCK_PIN, AUDIO_I2S_WS_PIN, AUDIO_I2S_DATA_PIN);
+#endif
+    _soundGenerator.setVolume(126);
+    _soundGenerator.play(true);
+    _soundGenerator.attach(&_pcm);
+    _pcm.setVolume(127);
+    _pcm.enable(true);
+}
+
+// called once per frame, after CPU::loop()
+void AySound::update()
+{
+    // clock rate follows machine type (3.5 or 3.5469 MHz)
+    uint32_t clockRate = (uint64_t)CPU::statesPerFrame() * 1000000 / CPU::microsPerFrame();
+    if (clockRate != _clockRate) {
+        _clockRate = clockRate;
+        _blep.setRates(clockRate, AUDIO_SAMPLE_RATE);
+    }
+
+    // the frame ran for CPU::tstates, overshoot included, as for the tape
+    _ay.endFrame(CPU::tstates);
+    _blep.endFrame(CPU::tstates);
+
+    int count = _blep.readSamples(_pcmFrame, PCM_RING_SIZE / 2);
+    if (_muted)
+        return;
+    WavRecorder::addSamples(_pcmFrame, count);
+
+    uint32_t head = _pcmHead;
+    uint32_t room = PCM_RING_MAX_FILL - (head - _pcmTail);
+    if ((uint32_t)count > room) {
+        _pcmDropped += count - room;
+        count = room;
+    }
+    for (int i = 0; i < count; i++) {
+        int16_t* frame = &_pcmRing[((head + i) & (PCM_RING_SIZE - 1)) * PCM_CHANNELS];
+        for (int c = 0; c < PCM_CHANNELS; c++)
+            frame[c] = _pcmFrame[i * PCM_CHANNELS + c];
+    }
+    _pcmHead = head + count;
+}
+
+uint8_t AySound::getRegisterData()
+{
+    return _ay.readRegister(_selectedRegister);
+}
+
+uint8_t AySound::getSelectedRegister()
+{
+    return _selectedRegister;
+}
+
+void AySound::selectRegister(uint8_t registerNumber)
+{
+    _selectedRegister = registerNumber;
+}
+
+void AySound::setRegisterData(uint8_t data)
+{
+    PsgRecorder::registerWrite(_selectedRegister, data);
+    _ay.writeRegister(_selectedRegister, data, CPU::tstates);
+}
+
+void AySound::loadRegisters(const uint8_t* regs, uint8_t selected)
+{
+    _ay.loadRegisters(regs, CPU::tstates);
+    _selectedRegister = selected;
+}
+
+void AySound::setBeeper(uint8_t level)
+{
+    if (level == _beeperLevel)
+        return;
+    _blep.addDelta(CPU::tstates, level ? BEEPER_AMPLITUDE : -BEEPER_AMPLITUDE);
+    _beeperLevel = level;
+}
+
+void AySound::reset()
+{
+    _ay.reset();
+    _selectedRegister = 0;
+}
+#else
+
 static SquareWaveformGenerator _channel[3];
 
 // Registers
@@ -66,6 +244,11 @@ const unsigned char volume[] = {
 
 void AySound::initialize()
 {
+    if (!_soundGenerator.setDMABuffers(Config::audio_dma_count, Config::audio_dma_len))
+        Serial.printf("AySound: invalid DMA buffers %d x %d, using defaults\n", Config::audio_dma_count, Config::audio_dma_len);
+#ifdef AUDIO_I2S_DAC
+    _soundGenerator.setOutput(SoundGeneratorOutput::ExternalI2S, AUDIO_I2S_BCK_PIN, AUDIO_I2S_WS_PIN, AUDIO_I2S_DATA_PIN);
+#endif
     _soundGenerator.setVolume(126);
     _soundGenerator.play(true);
 	for (int8_t channel = 0; channel < 3; channel++)
@@ -76,16 +259,6 @@ void AySound::initialize()
 	}
 }
 
-void AySound::enable()
-{
-    _soundGenerator.play(true);
-}
-
-void AySound::disable()
-{
-    _soundGenerator.play(false);
-}
-
 // Reference frequency is calculated like this:
 // for a AY-3-8912 running at 4MHz, reference frequency is 125000 Hz.
 // But on a Spectrum 128K, it runs at 3.5469MHz, so the
@@ -221,12 +394,25 @@ uint8_t AySound::getRegisterData()
 	}
 }
 
+uint8_t AySound::getSelectedRegister()
+{
+	return selectedRegister;
+}
+
 void AySound::selectRegister(uint8_t registerNumber)
 {
 	selectedRegister = registerNumber;
 }
 
 void AySound::setRegisterData(uint8_t data)
+{
+    PsgRecorder::registerWrite(selectedRegister, data);
+    storeRegister(data);
+    update();
+}
+
+// set selected register, without updating the channels
+void AySound::storeRegister(uint8_t data)
 {
 	switch (selectedRegister)
 	{
@@ -279,8 +465,20 @@ void AySound::setRegisterData(uint8_t data)
             // invalid register - do nothing
             return;
     }
+}
 
-    update();
+void AySound::loadRegisters(const uint8_t* regs, uint8_t selected)
+{
+    for (uint8_t n = 0; n < 16; n++) {
+        selectedRegister = n;
+        storeRegister(regs[n]);
+    }
+    // mixer, then each channel pitch
+    for (uint8_t n = 0; n <= 7; n += 2) {
+        selectedRegister = (n == 6) ? 7 : n;
+        update();
+    }
+    selectedRegister = selected;
 }
 
 void AySound::reset()
@@ -311,4 +509,78 @@ void AySound::reset()
     }
 }
 
+#endif // AUDIO_BLEP_MIXER
+
+void AySound::enable()
+{
+    _soundGenerator.play(true);
+}
+
+void AySound::disable()
+{
+    _soundGenerator.play(false);
+}
+
+void AySound::printStats(char* buf, size_t len)
+{
+    const SoundGeneratorStats& st = _soundGenerator.stats();
+    uint32_t avg = st.buffersWritten ? (uint32_t)(st.mixerTimeTotal / st.buffersWritten) : 0;
+    snprintf(buf, len,
+        "DMA %dx%d lat %dus\n"
+        "buf %u und %u\n"
+        "mix %u/%u/%uus\n"
+        "que %d min %d gap %uus",
+        _soundGenerator.dmaBufferCount(), _soundGenerator.dmaBufferLength(), _soundGenerator.latencyMicros(),
+        st.buffersWritten, st.underruns,
+        st.mixerTimeLast, avg, st.mixerTimeMax,
+        st.queueDepth, st.queueDepthMin, st.writeIntervalMax);
+#ifdef AUDIO_BLEP_MIXER
+    size_t n = strlen(buf);
+    snprintf(buf + n, len - n, "\npcm und %u drop %u", _pcmUnderruns, _pcmDropped);
+    if (WavRecorder::isRecording()) {
+        n = strlen(buf);
+        snprintf(buf + n, len - n, "\nwav %us drop %u", WavRecorder::seconds(), WavRecorder::dropped());
+    }
+#endif
+}
+
+void AySound::resetStats()
+{
+    _soundGenerator.resetStats();
+#ifdef AUDIO_BLEP_MIXER
+    _pcmUnderruns = 0;
+    _pcmDropped = 0;
+#endif
+}
+
+bool AySound::setDMABuffers(int count, int length)
+{
+    return _soundGenerator.setDMABuffers(count, length);
+}
+
+void AySound::setMuted(bool muted)
+{
+#ifdef AUDIO_BLEP_MIXER
+    // keep mixing so the chip state advances, but output nothing
+    _muted = muted;
+#else
+    _soundGenerator.play(!muted);
+#endif
+}
+
+bool AySound::startWavRecording()
+{
+#ifdef AUDIO_BLEP_MIXER
+    return WavRecorder::start(AUDIO_SAMPLE_RATE, PCM_CHANNELS);
+#else
+    // square wave generators are mixed inside FabGL, no PCM to tap
+    return false;
+#endif
+}
+
+void AySound::stopWavRecording()
+{
+    WavRecorder::stop();
+}
+
 #endif
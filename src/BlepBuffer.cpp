@@ -0,0 +1,163 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "BlepBuffer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// cutoff relative to Nyquist frequency, leaving room for the window transition
+#define BLEP_CUTOFF 0.85
+
+int16_t BlepBuffer::kernel[BLEP_PHASES][BLEP_WIDTH];
+bool BlepBuffer::kernelReady = false;
+
+// Each phase holds the differences of a band-limited step, that is, a
+// Blackman-windowed sinc impulse sampled at the step's sub-sample offset.
+// Taps are rounded to integers and the rounding error is put into the
+// central tap, so integrating a phase gives exactly 1 << BLEP_KERNEL_BITS
+// and steps leave no residual DC.
+void BlepBuffer::initKernel()
+{
+    const double half = BLEP_WIDTH / 2;
+    for (int p = 0; p < BLEP_PHASES; p++) {
+        double frac = (double)p / BLEP_PHASES;
+        double taps[BLEP_WIDTH];
+        double sum = 0;
+        for (int i = 0; i < BLEP_WIDTH; i++) {
+            double x = i - half + 1 - frac;
+            double s = (x == 0) ? 1.0 : sin(M_PI * BLEP_CUTOFF * x) / (M_PI * BLEP_CUTOFF * x);
+            double w = 0.42 + 0.5 * cos(M_PI * x / half) + 0.08 * cos(2 * M_PI * x / half);
+            if (fabs(x) >= half) w = 0;
+            taps[i] = s * w;
+            sum += taps[i];
+        }
+        int total = 0;
+        for (int i = 0; i < BLEP_WIDTH; i++) {
+            kernel[p][i] = (int16_t)lround(taps[i] / sum * (1 << BLEP_KERNEL_BITS));
+            total += kernel[p][i];
+        }
+        kernel[p][BLEP_WIDTH / 2 - 1] += (1 << BLEP_KERNEL_BITS) - total;
+    }
+    kernelReady = true;
+}
+
+BlepBuffer::BlepBuffer(int capacity, int channels)
+    : m_clockRate(0), m_sampleRate(0), m_factor(0), m_offset(0), m_capacity(capacity), m_channels(channels)
+{
+    if (!kernelReady)
+        initKernel();
+    m_integrator[0] = m_integrator[1] = 0;
+    // extra room for the kernel tail of deltas near the end
+    m_buf = (int32_t*)calloc((capacity + BLEP_WIDTH) * channels, sizeof(int32_t));
+    if (m_buf == NULL)
+        m_capacity = 0;
+}
+
+BlepBuffer::~BlepBuffer()
+{
+    free(m_buf);
+}
+
+void BlepBuffer::setRates(uint32_t clockRate, uint32_t sampleRate)
+{
+    m_clockRate = clockRate;
+    m_sampleRate = sampleRate;
+    m_factor = ((uint64_t)sampleRate << BLEP_TIME_BITS) / clockRate;
+    clear();
+}
+
+void BlepBuffer::clear()
+{
+    m_offset = 0;
+    m_integrator[0] = m_integrator[1] = 0;
+    if (m_buf)
+        memset(m_buf, 0, (m_capacity + BLEP_WIDTH) * m_channels * sizeof(int32_t));
+}
+
+void BlepBuffer::endFrame(uint32_t clocks)
+{
+    m_offset += (uint64_t)clocks * m_factor;
+    // never let pending samples overflow the buffer
+    if ((m_offset >> BLEP_TIME_BITS) > (uint64_t)m_capacity)
+        m_offset = (uint64_t)m_capacity << BLEP_TIME_BITS;
+}
+
+static inline int16_t blepClamp(int32_t s)
+{
+    if (s > 32767) return 32767;
+    if (s < -32768) return -32768;
+    return (int16_t)s;
+}
+
+int BlepBuffer::readSamples(int16_t* out, int count)
+{
+    int avail = samplesAvailable();
+    if (count > avail)
+        count = avail;
+    if (count <= 0)
+        return 0;
+
+    // leaky integration of deltas: this is also the DC-blocking high-pass
+    const int32_t* in = m_buf;
+    if (m_channels == 2) {
+        int32_t left = m_integrator[0];
+        int32_t right = m_integrator[1];
+        for (int i = 0; i < count; i++) {
+            left += in[i * 2];
+            right += in[i * 2 + 1];
+            out[i * 2] = blepClamp(left >> BLEP_KERNEL_BITS);
+            out[i * 2 + 1] = blepClamp(right >> BLEP_KERNEL_BITS);
+            left -= left >> BLEP_BASS_SHIFT;
+            right -= right >> BLEP_BASS_SHIFT;
+        }
+        m_integrator[0] = left;
+        m_integrator[1] = right;
+    } else {
+        int32_t sum = m_integrator[0];
+        for (int i = 0; i < count; i++) {
+            sum += in[i];
+            out[i] = blepClamp(sum >> BLEP_KERNEL_BITS);
+            sum -= sum >> BLEP_BASS_SHIFT;
+        }
+        m_integrator[0] = sum;
+    }
+
+    // shift remaining samples (and kernel tails) to the start of the buffer
+    int remain = (m_capacity + BLEP_WIDTH - count) * m_channels;
+    memmove(m_buf, m_buf + count * m_channels, remain * sizeof(int32_t));
+    memset(m_buf + remain, 0, count * m_channels * sizeof(int32_t));
+    m_offset -= (uint64_t)count << BLEP_TIME_BITS;
+
+    return count;
+}
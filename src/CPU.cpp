@@ -38,6 +38,8 @@
 #include "PS2Kbd.h"
 #include "CPU.h"
 #include "Config.h"
+#include "Tape.h"
+#include "Z80Access.h"
 
 #pragma GCC optimize ("O3")
 
@@ -167,11 +169,18 @@ void CPU::loop()
 
 	while (tstates < statesInFrame)
 	{
+        Tape::checkTrap(Z80_GET_PC());
+        #ifdef TAPE_ACCELERATE
+            Tape::checkEdgeLoop(Z80_GET_PC());
+        #endif
+
 		DO_Z80_INSTRUCTION;
 
         #ifdef CPU_PER_INSTRUCTION_TIMING
             if (partTstates > PIT_PERIOD) {
-                delay_instruction(tstates);
+                // unthrottled in turbo mode
+                if (!ESPectrum::turbo)
+                    delay_instruction(tstates);
                 partTstates -= PIT_PERIOD;
             } 
             else {
@@ -181,7 +190,8 @@ void CPU::loop()
         #endif
 	}
     #ifdef CPU_PER_INSTRUCTION_TIMING
-        delay_instruction(tstates);
+        if (!ESPectrum::turbo)
+            delay_instruction(tstates);
     #endif
 
     DO_Z80_INTERRUPT;
@@ -65,9 +65,10 @@ static SPIClass customSPI;
 String   Config::arch = "128K";
 String   Config::ram_file = NO_RAM_FILE;
 String   Config::romSet = "SINCLAIR";
-char   Config::sna_file_list[]; // list of file names
-char   Config::sna_name_list[]; // list of names (without ext, '_' -> ' ')
 bool     Config::slog_on = true;
+int      Config::audio_dma_count = DEFAULT_AUDIO_DMA_COUNT;
+int      Config::audio_dma_len = DEFAULT_AUDIO_DMA_LEN;
+String   Config::ay_stereo = DEFAULT_AY_STEREO;
 
 // Read config from FS
 void Config::load() {
@@ -111,6 +112,15 @@ void Config::load() {
             } else if (line.startsWith("slog:")) {
                 slog_on = (line.substring(line.lastIndexOf(':') + 1) == "true");
                 Serial.printf("  + slog_on: '%s'\n", (slog_on ? "true" : "false"));
+            } else if (line.startsWith("audio_dma_count:")) {
+                audio_dma_count = line.substring(line.lastIndexOf(':') + 1).toInt();
+                Serial.printf("  + audio_dma_count: %d\n", audio_dma_count);
+            } else if (line.startsWith("audio_dma_len:")) {
+                audio_dma_len = line.substring(line.lastIndexOf(':') + 1).toInt();
+                Serial.printf("  + audio_dma_len: %d\n", audio_dma_len);
+            } else if (line.startsWith("ay_stereo:")) {
+                ay_stereo = line.substring(line.lastIndexOf(':') + 1);
+                Serial.printf("  + ay_stereo: '%s'\n", ay_stereo.c_str());
             }
             line = "";
         } else {
@@ -135,26 +145,6 @@ void Config::load() {
     }
 }*/
 
-void Config::loadSnapshotLists()
-{
-#ifdef XDEBUG
-    Serial.println("loadSnapshoList()");
-#endif
-    KB_INT_STOP;
-    strcpy(sna_file_list,MENU_SNA_TITLE);
-    strcat(sna_file_list,"\n");
-    strcat(sna_file_list,FileUtils::getSortedSnaFileList(DISK_SNA_DIR));
-    Serial.println(sna_file_list);
-    strcpy(sna_name_list,sna_file_list);
-    //sna_name_list.replace(".SNA", "");
-    //sna_name_list.replace(".sna", "");
-    //sna_name_list.replace(".Z80", "");
-    //sna_name_list.replace(".z80", "");
-    //sna_name_list.replace("_", " ");
-    //sna_name_list.replace("-", " ");
-    KB_INT_START;
-}
-
 // Dump actual config to FS
 void Config::save() {
     KB_INT_STOP;
@@ -179,6 +169,14 @@ void Config::save() {
     // Serial logging
     Serial.printf("  + slog:%s\n", (slog_on ? "true" : "false"));
     f.printf("slog:%s\n", (slog_on ? "true" : "false"));
+    // Audio DMA buffers
+    Serial.printf("  + audio_dma_count:%d\n", audio_dma_count);
+    f.printf("audio_dma_count:%d\n", audio_dma_count);
+    Serial.printf("  + audio_dma_len:%d\n", audio_dma_len);
+    f.printf("audio_dma_len:%d\n", audio_dma_len);
+    // AY stereo mode
+    Serial.printf("  + ay_stereo:%s\n", ay_stereo.c_str());
+    f.printf("ay_stereo:%s\n", ay_stereo.c_str());
     f.close();
     vTaskDelay(5);
     Serial.println("Config saved OK");
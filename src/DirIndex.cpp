@@ -0,0 +1,349 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "DirIndex.h"
+#include "hardconfig.h"
+#include "FileUtils.h"
+#include "PS2Kbd.h"
+#include <FS.h>
+
+#ifdef USE_INT_FLASH
+// using internal storage (spi flash)
+#include <SPIFFS.h>
+// set The Filesystem to SPIFFS
+#define THE_FS SPIFFS
+#endif
+
+#ifdef USE_SD_CARD
+// using external storage (SD card)
+#include <SD.h>
+// set The Filesystem to SD
+#define THE_FS SD
+#endif
+
+#ifdef USE_SD_CARD_ALT
+// using external storage (SD card with Arduino SFAT Lib)
+#include <SPI.h>
+#include "SdFat.h"
+extern SdFs sd;
+#endif
+
+#ifndef O_RDONLY
+    #define O_RDONLY 0
+#endif
+
+#ifdef BOARD_HAS_PSRAM
+#define INDEX_REALLOC ps_realloc
+#else
+#define INDEX_REALLOC realloc
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Index file: header, entries sorted, then the names (NUL terminated)
+// the entries point to. The header keeps the directory modification time
+// and the clusters the directory takes. Neither is reliable alone: SdFat
+// and many hosts do not update directory times when adding files, and
+// the size only changes when the directory grows into another cluster.
+// So files created here also drop the index (invalidate).
+
+#define INDEX_MAGIC 0x5844495A          // "ZIDX"
+#define INDEX_VERSION 2
+#define INDEX_PATH_MAX 128
+
+#define ENTRY_DIR 0x01
+
+struct IndexHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t mtime;
+    uint32_t clusters;
+    uint32_t namesSize;
+    char path[INDEX_PATH_MAX];          // for hash collisions
+};
+
+struct IndexEntry {
+    uint32_t name;                      // offset in names
+    uint32_t size;
+    uint8_t type;
+    uint8_t pad[3];
+};
+
+static IndexHeader header;
+static IndexEntry* entries = NULL;
+static char* names = NULL;
+static uint32_t entriesCap = 0;
+static uint32_t namesCap = 0;
+static bool truncated;                  // out of memory while scanning
+
+static bool reserve(uint32_t count, uint32_t namesSize)
+{
+    if (count > entriesCap) {
+        uint32_t cap = entriesCap ? entriesCap : 64;
+        while (cap < count) cap *= 2;
+        IndexEntry* e = (IndexEntry*)INDEX_REALLOC(entries, cap * sizeof(IndexEntry));
+        if (e == NULL) return false;
+        entries = e;
+        entriesCap = cap;
+    }
+    if (namesSize > namesCap) {
+        uint32_t cap = namesCap ? namesCap : 1024;
+        while (cap < namesSize) cap *= 2;
+        char* n = (char*)INDEX_REALLOC(names, cap);
+        if (n == NULL) return false;
+        names = n;
+        namesCap = cap;
+    }
+    return true;
+}
+
+// FNV-1a
+static String indexFile(const String& dir)
+{
+    uint32_t h = 2166136261u;
+    for (unsigned int i = 0; i < dir.length(); i++)
+        h = (h ^ (uint8_t)dir.charAt(i)) * 16777619u;
+    char fn[32];
+    snprintf(fn, sizeof(fn), "%s/%08x.idx", DISK_INDEX_DIR, h);
+    return fn;
+}
+
+static int compareEntries(const void* a, const void* b)
+{
+    const IndexEntry* ea = (const IndexEntry*)a;
+    const IndexEntry* eb = (const IndexEntry*)b;
+    if ((ea->type ^ eb->type) & ENTRY_DIR)
+        return (eb->type & ENTRY_DIR) - (ea->type & ENTRY_DIR);
+    return strcasecmp(names + ea->name, names + eb->name);
+}
+
+static bool add(const char* name, uint32_t size, bool dir)
+{
+    if (name[0] == '.')
+        return true;    // hidden
+    size_t len = strlen(name);
+    if (len >= 4 && strcasecmp(name + len - 4, ".txt") == 0)
+        return true;
+    if (header.count == 0xFFFF || !reserve(header.count + 1, header.namesSize + len + 1))
+        return false;
+    IndexEntry& e = entries[header.count++];
+    e.name = header.namesSize;
+    e.size = size;
+    e.type = dir ? ENTRY_DIR : 0;
+    memcpy(names + header.namesSize, name, len + 1);
+    header.namesSize += len + 1;
+    return true;
+}
+
+// read the directory
+static bool scan(const String& dir)
+{
+    header.count = 0;
+    header.namesSize = 0;
+    truncated = false;
+#ifdef USE_SD_CARD_ALT
+    FsFile root;
+    root.open(dir.c_str());
+    if (!root || !root.isDir())
+        return false;
+    FsFile file;
+    char name[256];
+    while (file.openNext(&root, O_RDONLY)) {
+        file.getName(name, sizeof(name));
+        bool ok = add(name, file.size(), file.isDir());
+        file.close();
+        if (!ok) {
+            Serial.printf("DirIndex: out of memory at %u entries\n", header.count);
+            truncated = true;
+            break;
+        }
+    }
+    root.close();
+#else
+    File root = THE_FS.open(dir.c_str());
+    if (!root || !root.isDirectory())
+        return false;
+    File file = root.openNextFile();
+    while (file) {
+        // name may come with the path
+        String name = file.name();
+        name = name.substring(name.lastIndexOf("/") + 1);
+        if (!add(name.c_str(), file.size(), file.isDirectory())) {
+            Serial.printf("DirIndex: out of memory at %u entries\n", header.count);
+            truncated = true;
+            break;
+        }
+        file = root.openNextFile();
+    }
+#endif
+    qsort(entries, header.count, sizeof(IndexEntry), compareEntries);
+    return true;
+}
+
+#ifdef USE_SD_CARD_ALT
+// clusters in the chain of an open directory: seeking past its end fails
+static uint32_t dirClusters(FsFile& root)
+{
+    uint64_t cluster = sd.bytesPerCluster();
+    uint32_t lo = 1;
+    while (lo < 0x8000 && root.seekSet(cluster * lo * 2))
+        lo *= 2;
+    uint32_t hi = lo * 2;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (root.seekSet(cluster * mid))
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+#endif
+
+// directory modification time (0 if not available) and size in clusters
+static void dirStamp(const String& dir, uint32_t& mtime, uint32_t& clusters)
+{
+    mtime = 0;
+    clusters = 0;
+#ifdef USE_SD_CARD_ALT
+    FsFile root;
+    uint16_t date, time;
+    if (root.open(dir.c_str())) {
+        if (root.getModifyDateTime(&date, &time))
+            mtime = ((uint32_t)date << 16) | time;
+        clusters = dirClusters(root);
+    }
+    root.close();
+#else
+    File root = THE_FS.open(dir.c_str());
+    if (root)
+        mtime = root.getLastWrite();
+#endif
+}
+
+static bool readIndex(const String& dir, uint32_t mtime, uint32_t clusters)
+{
+    String fn = indexFile(dir);
+#ifdef USE_SD_CARD_ALT
+    FsFile f;
+    if (!f.open(fn.c_str(), O_RDONLY))
+        return false;
+#else
+    File f = THE_FS.open(fn.c_str(), FILE_READ);
+    if (!f)
+        return false;
+#endif
+    IndexHeader h;
+    bool ok = (size_t)f.read((uint8_t*)&h, sizeof(h)) == sizeof(h)
+        && h.magic == INDEX_MAGIC && h.version == INDEX_VERSION
+        && h.mtime == mtime && h.clusters == clusters && strncmp(h.path, dir.c_str(), INDEX_PATH_MAX) == 0
+        && reserve(h.count, h.namesSize);
+    if (ok) {
+        size_t entriesSize = h.count * sizeof(IndexEntry);
+        ok = (size_t)f.read((uint8_t*)entries, entriesSize) == entriesSize
+          && (size_t)f.read((uint8_t*)names, h.namesSize) == h.namesSize;
+    }
+    f.close();
+    if (ok)
+        header = h;
+    return ok;
+}
+
+static void writeIndex(const String& dir)
+{
+    if (!FileUtils::ensureDir(DISK_INDEX_DIR))
+        return;
+    String fn = indexFile(dir);
+    String tmp = fn + ".tmp";
+    memset(header.path, 0, sizeof(header.path));
+    strncpy(header.path, dir.c_str(), sizeof(header.path) - 1);
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+#ifdef USE_SD_CARD_ALT
+    FsFile f;
+    if (!f.open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC))
+        return;
+#else
+    File f = THE_FS.open(tmp, FILE_WRITE);
+    if (!f)
+        return;
+#endif
+    size_t entriesSize = header.count * sizeof(IndexEntry);
+    bool ok = f.write((const uint8_t*)&header, sizeof(header)) == sizeof(header)
+        && f.write((const uint8_t*)entries, entriesSize) == entriesSize
+        && f.write((const uint8_t*)names, header.namesSize) == header.namesSize;
+    f.close();
+    if (ok)
+        ok = FileUtils::replaceFile(tmp, fn);
+    else
+        FileUtils::removeFile(tmp);
+    if (!ok)
+        Serial.printf("DirIndex: unable to write %s\n", fn.c_str());
+}
+
+bool DirIndex::load(const String& dir)
+{
+    uint32_t start = millis();
+    bool cacheable = dir.length() < INDEX_PATH_MAX;
+    KB_INT_STOP;
+    SD_LOCK;
+
+    uint32_t mtime, clusters;
+    dirStamp(dir, mtime, clusters);
+    bool ok = true;
+    bool cached = cacheable && mtime != 0 && readIndex(dir, mtime, clusters);
+    if (!cached) {
+        ok = scan(dir);
+        header.mtime = mtime;
+        header.clusters = clusters;
+        if (ok && cacheable && mtime != 0 && !truncated)
+            writeIndex(dir);
+    }
+
+    SD_UNLOCK;
+    KB_INT_START;
+    if (ok)
+        Serial.printf("DirIndex: %s, %u entries %s in %u ms\n", dir.c_str(), header.count,
+            cached ? "from index" : "scanned", millis() - start);
+    return ok;
+}
+
+void DirIndex::invalidate(const String& path)
+{
+    int slash = path.lastIndexOf('/');
+    String dir = slash > 0 ? path.substring(0, slash) : String("/");
+    if (dir.length() < INDEX_PATH_MAX)
+        FileUtils::removeFile(indexFile(dir));
+}
+
+uint16_t DirIndex::count() { return header.count; }
+const char* DirIndex::name(uint16_t i) { return names + entries[i].name; }
+bool DirIndex::isDir(uint16_t i) { return entries[i].type & ENTRY_DIR; }
+uint32_t DirIndex::size(uint16_t i) { return entries[i].size; }
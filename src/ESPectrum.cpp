@@ -44,6 +44,7 @@
 
 #include "ESPectrum.h"
 #include "FileSNA.h"
+#include "FileSZX.h"
 #include "Config.h"
 #include "FileUtils.h"
 #include "osd.h"
@@ -51,6 +52,12 @@
 #include "Ports.h"
 #include "Mem.h"
 #include "AySound.h"
+#include "PsgRecorder.h"
+#include "WavRecorder.h"
+#include "Tape.h"
+#include "Rewind.h"
+#include "Hibernate.h"
+#include "RomFlash.h"
 
 // works, but not needed for now
 #pragma GCC optimize ("O3")
@@ -61,6 +68,8 @@ void setup_cpuspeed();
 // ESPectrum graphics variables
 byte ESPectrum::borderColor = 7;
 VGA ESPectrum::vga;
+bool ESPectrum::turbo = false;
+uint16_t ESPectrum::speedPercent = 100;
 
 volatile byte flashing = 0;
 const int SAMPLING_RATE = 44100;
@@ -138,7 +147,6 @@ void ESPectrum::setup()
 
     FileUtils::initFileSystem();
     Config::load();
-    Config::loadSnapshotLists();
 
     Serial.printf("Free heap after filesystem: %d\n", ESP.getFreeHeap());
 
@@ -167,12 +175,16 @@ void ESPectrum::setup()
 
     Serial.printf("Free heap after vga: %d \n", ESP.getFreeHeap());
 
+    // ROMs run in place from flash if possible, leaving SRAM to RAM banks
+    bool romFlash = RomFlash::setup();
+
 #ifdef BOARD_HAS_PSRAM
     Mem::ram5 = staticMemPage;
     Serial.printf("Page RAM5 statically allocated (fastest)\n");
     tryAllocateSRamThenPSRam(Mem::ram2, "RAM2");
     tryAllocateSRamThenPSRam(Mem::ram0, "RAM0");
-    tryAllocateSRamThenPSRam(Mem::rom0, "ROM0");
+    if (!romFlash)
+        tryAllocateSRamThenPSRam(Mem::rom0, "ROM0");
 
     tryAllocateSRamThenPSRam(Mem::ram7, "RAM7");
     tryAllocateSRamThenPSRam(Mem::ram1, "RAM1");
@@ -180,12 +192,15 @@ void ESPectrum::setup()
     tryAllocateSRamThenPSRam(Mem::ram4, "RAM4");
     tryAllocateSRamThenPSRam(Mem::ram6, "RAM6");
 
-    tryAllocateSRamThenPSRam(Mem::rom1, "ROM1");
-    tryAllocateSRamThenPSRam(Mem::rom2, "ROM2");
-    tryAllocateSRamThenPSRam(Mem::rom3, "ROM3");
+    if (!romFlash) {
+        tryAllocateSRamThenPSRam(Mem::rom1, "ROM1");
+        tryAllocateSRamThenPSRam(Mem::rom2, "ROM2");
+        tryAllocateSRamThenPSRam(Mem::rom3, "ROM3");
+    }
 
 #else
-    Mem::rom0 = (byte *)malloc(16384);
+    if (!romFlash)
+        Mem::rom0 = (byte *)malloc(16384);
 
     Mem::ram0 = (byte *)malloc(16384);
     Mem::ram2 = (byte *)malloc(16384);
@@ -210,7 +225,7 @@ void ESPectrum::setup()
 
     
 
-#ifdef SPEAKER_PRESENT
+#if defined(SPEAKER_PRESENT) && !defined(AUDIO_BLEP_MIXER)
     pinMode(SPEAKER_PIN, OUTPUT);
     digitalWrite(SPEAKER_PIN, LOW);
 #endif
@@ -227,6 +242,7 @@ void ESPectrum::setup()
     // START Z80
     Serial.println(MSG_Z80_RESET);
     CPU::setup();
+    Rewind::setup();
 
     // make sure keyboard ports are FF
     for (int t = 0; t < 32; t++) {
@@ -242,7 +258,10 @@ void ESPectrum::setup()
     AySound::initialize();
 
     Config::requestMachine(Config::getArch(), Config::getRomSet(), true);
-    if ((String)Config::ram_file != (String)NO_RAM_FILE) {
+    if (Hibernate::resume()) {
+        // boot.cfg snapshot not loaded
+    }
+    else if ((String)Config::ram_file != (String)NO_RAM_FILE) {
         OSD::changeSnapshot(Config::ram_file);
     }
 
@@ -280,6 +299,7 @@ void ESPectrum::reset()
     Mem::romInUse = 0;
 
     CPU::reset();
+    Rewind::reset();
 }
 
 #define NUM_SPECTRUM_COLORS 16
@@ -397,13 +417,17 @@ void ESPectrum::videoTask(void *unused) {
             }
         }
 
+        OSD::statsDraw();
+        OSD::turboDraw();
+        OSD::noticeDraw();
+
         uint32_t ts_end = micros();
 
         uint32_t elapsed = ts_end - ts_start;
         uint32_t target = CPU::microsPerFrame();
         uint32_t idle = target - elapsed;
 #ifdef VIDEO_FRAME_TIMING
-        if (idle < target)
+        if (idle < target && !turbo)
             delayMicroseconds(idle);
 #endif
 
@@ -535,11 +559,127 @@ void ESPectrum::processKeyboard() {
 #endif // PS2_CONVENIENCE_KEYS_ES
 }
 
+// Serial console commands, one per line:
+//   stats           print audio output statistics
+//   stats reset     clear audio output statistics
+//   dma <n> <len>   set audio DMA buffer count and length (samples)
+//   overlay         toggle on-screen statistics (same as F6)
+//   psg             start/stop AY register recording (same as F7)
+//   wav             start/stop audio recording (same as F8)
+//   tape            tape status; tape play|stop|rewind (play/stop as F9)
+//   szx             save snapshot to /sna/snapNNNN.szx
+//   rombench        time ROM fetches from flash, SRAM and PSRAM
+void ESPectrum::processSerialCommands()
+{
+    static char cmd[32];
+    static uint8_t len = 0;
+
+    while (Serial.available()) {
+        char c = Serial.read();
+        if (c != '\n' && c != '\r') {
+            if (len < sizeof(cmd) - 1)
+                cmd[len++] = c;
+            continue;
+        }
+        if (len == 0)
+            continue;
+        cmd[len] = 0;
+        len = 0;
+
+        int count, length;
+        if (strcmp(cmd, "stats") == 0) {
+            // audio alone is up to 6 lines when recording
+            char buf[256];
+            Serial.printf("speed %u%%%s\n", speedPercent, turbo ? " (turbo)" : "");
+            AySound::printStats(buf, sizeof(buf));
+            Serial.println(buf);
+            Rewind::printStats(buf, sizeof(buf));
+            Serial.println(buf);
+            Mem::printPlacement(buf, sizeof(buf));
+            Serial.println(buf);
+        }
+        else if (strcmp(cmd, "stats reset") == 0) {
+            AySound::resetStats();
+            Serial.println("Audio stats reset");
+        }
+        else if (sscanf(cmd, "dma %d %d", &count, &length) == 2) {
+            if (AySound::setDMABuffers(count, length)) {
+                Config::audio_dma_count = count;
+                Config::audio_dma_len = length;
+                Serial.printf("Audio DMA set to %d x %d\n", count, length);
+            }
+            else Serial.printf("Invalid audio DMA %d x %d\n", count, length);
+        }
+        else if (strcmp(cmd, "overlay") == 0) {
+            OSD::statsToggle();
+        }
+        else if (strcmp(cmd, "psg") == 0) {
+            if (PsgRecorder::isRecording())
+                PsgRecorder::stop();
+            else if (!PsgRecorder::start())
+                Serial.println("Unable to start PSG recording");
+        }
+        else if (strcmp(cmd, "wav") == 0) {
+            if (WavRecorder::isRecording())
+                AySound::stopWavRecording();
+            else if (!AySound::startWavRecording())
+                Serial.println("Unable to start WAV recording");
+        }
+        else if (strcmp(cmd, "tape") == 0) {
+            if (Tape::isOpen())
+                Serial.printf("Tape: block %u/%u, %s\n", Tape::currentBlock(), Tape::blockCount(),
+                    Tape::isPlaying() ? "playing" : "stopped");
+            else
+                Serial.println("Tape: none");
+            #ifdef TAPE_SAVE_TRAP
+            if (Tape::saveFileName().length())
+                Serial.printf("Tape: saving to %s\n", Tape::saveFileName().c_str());
+            #endif
+        }
+        else if (strcmp(cmd, "tape play") == 0) Tape::play();
+        else if (strcmp(cmd, "tape stop") == 0) Tape::stop();
+        else if (strcmp(cmd, "tape rewind") == 0) Tape::rewind();
+        else if (strcmp(cmd, "szx") == 0) {
+            String fn = FileUtils::nextFileName(DISK_SNA_DIR, "snap", "szx");
+            SD_LOCK;
+            bool ok = FileSZX::save(fn);
+            SD_UNLOCK;
+            if (!ok)
+                Serial.println("Unable to save snapshot");
+        }
+        else if (strcmp(cmd, "rombench") == 0) {
+            RomFlash::benchmark();
+        }
+        else Serial.printf("Unknown command '%s'\n", cmd);
+    }
+}
+
+// emulated frames vs real time, measured every second
+static void updateSpeed(int frames)
+{
+    static uint32_t ts_start = 0;
+    static uint32_t emulated = 0;
+
+    emulated += frames;
+    uint32_t elapsed = micros() - ts_start;
+    if (elapsed >= 1000000) {
+        ESPectrum::speedPercent = (uint64_t)emulated * CPU::microsPerFrame() * 100 / elapsed;
+        emulated = 0;
+        ts_start += elapsed;
+    }
+}
+
 /* +-------------+
    | LOOP core 1 |
    +-------------+
  */
 void ESPectrum::loop() {
+    static bool firstFrame = true;
+    if (firstFrame) {
+        Serial.printf("Boot to first frame: %u ms\n", millis());
+        firstFrame = false;
+    }
+
     if (halfsec) {
         flashing = ~flashing;
     }
@@ -549,13 +689,36 @@ void ESPectrum::loop() {
     processKeyboard();
     updateWiimote2Keys();
     OSD::do_OSD();
+    processSerialCommands();
 
-    xQueueSend(vidQueue, &param, portMAX_DELAY);
+    bool wasTurbo = turbo;
+    turbo = Tape::isPlaying() || PS2Keyboard::keymap[KEY_F10] == 0;
+    if (turbo != wasTurbo)
+        AySound::setMuted(turbo);
+
+    // in turbo mode, render only if the video task is idle, never wait for it
+    xQueueSend(vidQueue, &param, turbo ? 0 : portMAX_DELAY);
     uint32_t ts_start = micros();
 
-    CPU::loop();
+    // one frame, or in turbo mode as many as fit in a frame's time
+    int frames = 0;
+    uint32_t ts_end;
+    do {
+        CPU::loop();
+        frames++;
 
-    uint32_t ts_end = micros();
+        AySound::update();
+        PsgRecorder::endFrame();
+        Tape::endFrame(CPU::tstates);
+        Rewind::endFrame();
+        Mem::placeBanks();
+
+        ts_end = micros();
+    } while (turbo && frames < TURBO_MAX_FRAMES && ts_end - ts_start < CPU::microsPerFrame());
+
+    OSD::statsCpuMicros = (ts_end - ts_start) / frames;
+    OSD::statsUpdate();
+    updateSpeed(frames);
 
 #ifdef LOG_DEBUG_TIMING
     uint32_t elapsed = ts_end - ts_start;
@@ -572,8 +735,6 @@ void ESPectrum::loop() {
     else ctr--;
 #endif
 
-    AySound::update();
-
     while (videoTaskIsRunning) {
     }
 
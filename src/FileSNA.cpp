@@ -39,109 +39,13 @@
 #include "Wiimote2Keys.h"
 #include "Config.h"
 #include "FileSNA.h"
+#include "Rewind.h"
+#include "MachineState.h"
+#include "DirIndex.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 
-#ifdef CPU_LINKEFONG
-#include "Z80_LKF/z80emu.h"
-extern Z80_STATE _zxCpu;
-
-#define Z80_SET_AF(v) _zxCpu.registers.word[Z80_AF] = (v)
-#define Z80_SET_BC(v) _zxCpu.registers.word[Z80_BC] = (v)
-#define Z80_SET_DE(v) _zxCpu.registers.word[Z80_DE] = (v)
-#define Z80_SET_HL(v) _zxCpu.registers.word[Z80_HL] = (v)
-
-#define Z80_SET_AFx(v) _zxCpu.alternates[Z80_AF] = (v)
-#define Z80_SET_BCx(v) _zxCpu.alternates[Z80_BC] = (v)
-#define Z80_SET_DEx(v) _zxCpu.alternates[Z80_DE] = (v)
-#define Z80_SET_HLx(v) _zxCpu.alternates[Z80_HL] = (v)
-
-#define Z80_SET_IY(v) _zxCpu.registers.word[Z80_IY] = (v)
-#define Z80_SET_IX(v) _zxCpu.registers.word[Z80_IX] = (v)
-
-#define Z80_SET_SP(v) _zxCpu.registers.word[Z80_SP] = (v)
-#define Z80_SET_PC(v) _zxCpu.pc = (v)
-
-#define Z80_SET_I(v) _zxCpu.i = (v)
-#define Z80_SET_R(v) _zxCpu.r = (v)
-#define Z80_SET_IM(v) _zxCpu.im = (v)
-#define Z80_SET_IFF1(v) _zxCpu.iff1 = (v)
-#define Z80_SET_IFF2(v) _zxCpu.iff2 = (v)
-
-#define Z80_GET_AF() (_zxCpu.registers.word[Z80_AF])
-#define Z80_GET_BC() (_zxCpu.registers.word[Z80_BC])
-#define Z80_GET_DE() (_zxCpu.registers.word[Z80_DE])
-#define Z80_GET_HL() (_zxCpu.registers.word[Z80_HL])
-
-#define Z80_GET_AFx() (_zxCpu.alternates[Z80_AF])
-#define Z80_GET_BCx() (_zxCpu.alternates[Z80_BC])
-#define Z80_GET_DEx() (_zxCpu.alternates[Z80_DE])
-#define Z80_GET_HLx() (_zxCpu.alternates[Z80_HL])
-
-#define Z80_GET_IY() (_zxCpu.registers.word[Z80_IY])
-#define Z80_GET_IX() (_zxCpu.registers.word[Z80_IX])
-
-#define Z80_GET_SP() (_zxCpu.registers.word[Z80_SP])
-#define Z80_GET_PC() (_zxCpu.pc)
-
-#define Z80_GET_I() (_zxCpu.i)
-#define Z80_GET_R() (_zxCpu.r)
-#define Z80_GET_IM() (_zxCpu.im)
-#define Z80_GET_IFF1() (_zxCpu.iff1)
-#define Z80_GET_IFF2() (_zxCpu.iff2)
-
-#endif // CPU_LINKEFONG
-
-///////////////////////////////////////////////////////////////////////////////
-
-#ifdef CPU_JLSANCHEZ
-#include "Z80_JLS/z80.h"
-
-#define Z80_GET_AF() Z80::getRegAF()
-#define Z80_GET_BC() Z80::getRegBC()
-#define Z80_GET_DE() Z80::getRegDE()
-#define Z80_GET_HL() Z80::getRegHL()
-
-#define Z80_GET_AFx() Z80::getRegAFx()
-#define Z80_GET_BCx() Z80::getRegBCx()
-#define Z80_GET_DEx() Z80::getRegDEx()
-#define Z80_GET_HLx() Z80::getRegHLx()
-
-#define Z80_GET_IY() Z80::getRegIY()
-#define Z80_GET_IX() Z80::getRegIX()
-
-#define Z80_GET_SP() Z80::getRegSP()
-#define Z80_GET_PC() Z80::getRegPC()
-
-#define Z80_GET_I() Z80::getRegI()
-#define Z80_GET_R() Z80::getRegR()
-#define Z80_GET_IM() Z80::getIM()
-#define Z80_GET_IFF1() Z80::isIFF1()
-#define Z80_GET_IFF2() Z80::isIFF2()
-
-#define Z80_SET_AF(v) Z80::setRegAF(v)
-#define Z80_SET_BC(v) Z80::setRegBC(v)
-#define Z80_SET_DE(v) Z80::setRegDE(v)
-#define Z80_SET_HL(v) Z80::setRegHL(v)
-
-#define Z80_SET_AFx(v) Z80::setRegAFx(v)
-#define Z80_SET_BCx(v) Z80::setRegBCx(v)
-#define Z80_SET_DEx(v) Z80::setRegDEx(v)
-#define Z80_SET_HLx(v) Z80::setRegHLx(v)
-
-#define Z80_SET_IY(v) Z80::setRegIY(v)
-#define Z80_SET_IX(v) Z80::setRegIX(v)
-
-#define Z80_SET_SP(v) Z80::setRegSP(v)
-#define Z80_SET_PC(v) Z80::setRegPC(v)
-
-#define Z80_SET_I(v) Z80::setRegI(v)
-#define Z80_SET_R(v) Z80::setRegR(v)
-#define Z80_SET_IM(v) Z80::setIM((Z80::IntMode)(v))
-#define Z80_SET_IFF1(v) Z80::setIFF1(v)
-#define Z80_SET_IFF2(v) Z80::setIFF2(v)
-
-#endif  // CPU_JLSANCHEZ
+#include "Z80Access.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -308,6 +212,7 @@ bool FileSNA::load(String sna_fn)
         }
     }
 
+    Rewind::reset();
     KB_INT_START;
     return true;
 }
@@ -329,6 +234,26 @@ bool FileSNA::isPersistAvailable()
 #endif
 }
 
+// bank 5 comes first, right after the header, in 48K and 128K files
+bool FileSNA::loadScreen(String sna_fn, uint8_t* screen)
+{
+    bool ok = false;
+    KB_INT_STOP;
+#ifdef USE_SD_CARD_ALT
+    FsFile file;
+    if (file.open(sna_fn.c_str(), O_RDONLY)) {
+#else
+    File file = THE_FS.open(sna_fn.c_str(), FILE_READ);
+    if (file) {
+#endif
+        ok = file.size() >= SNA_48K_SIZE && file.seek(SNA_HEADER_SIZE)
+          && readBlockFile(file, screen, ZX_SCREEN_SIZE) == ZX_SCREEN_SIZE;
+        file.close();
+    }
+    KB_INT_START;
+    return ok;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 #ifdef USE_SD_CARD_ALT
 static bool IRAM_ATTR writeMemPage(uint8_t page, FsFile &file, bool blockMode)
@@ -396,6 +321,7 @@ bool FileSNA::save(String sna_file) {
 ///////////////////////////////////////////////////////////////////////////////
 
 bool FileSNA::save(String sna_file, bool blockMode) {
+    DirIndex::invalidate(sna_file);
     KB_INT_STOP;
 
     // open file
@@ -494,265 +420,403 @@ bool FileSNA::save(String sna_file, bool blockMode) {
 }
 
 ///////////////////////////////////////////////////////////////////////////////
+//
+// SNA header conversion: 27 bytes (registers, border), and for 128K
+// 4 more after the first three pages (PC, port 0x7FFD, TR-DOS). A 48K
+// snapshot has no PC: it is pushed on the stack, in the RAM image.
 
-static uint8_t* quick_sna_buffer = NULL;
-static uint32_t quick_sna_size   = 0;
+#define SNA_HEADER_SIZE 27
+#define SNA_PAGING_SIZE 4
 
-bool FileSNA::isQuickAvailable()
+// paging is NULL for 48K
+static void stateToSNA(const MachineState& s, uint8_t* snaptr, uint8_t* paging)
 {
-    return quick_sna_buffer != NULL;
+    // write registers: begin with I
+    writeByteMem(s.i, snaptr);
+
+    writeWordMemLE(s.hlx, snaptr);
+    writeWordMemLE(s.dex, snaptr);
+    writeWordMemLE(s.bcx, snaptr);
+    writeWordMemLE(s.afx, snaptr);
+
+    writeWordMemLE(s.hl, snaptr);
+    writeWordMemLE(s.de, snaptr);
+    writeWordMemLE(s.bc, snaptr);
+
+    writeWordMemLE(s.iy, snaptr);
+    writeWordMemLE(s.ix, snaptr);
+
+    uint8_t inter = s.iff2 ? 0x04 : 0;
+    writeByteMem(inter, snaptr);
+    writeByteMem(s.r, snaptr);
+
+    writeWordMemLE(s.af, snaptr);
+
+    // decrement stack pointer for pushing PC to stack, only on 48K
+    writeWordMemLE(s.is128 ? s.sp : s.sp - 2, snaptr);
+
+    writeByteMem(s.im, snaptr);
+    writeByteMem(s.border, snaptr);
+
+    if (paging != NULL) {
+        writeWordMemLE(s.pc, paging);
+        writeByteMem(s.port7FFD(), paging);
+        writeByteMem(0, paging);     // TR-DOS not paged
+    }
 }
 
-bool FileSNA::saveQuick()
+// paging is NULL for 48K: PC is to be popped from the stack once RAM
+// is loaded
+static void stateFromSNA(MachineState& s, uint8_t* snaptr, uint8_t* paging)
 {
-    KB_INT_STOP;
+    s.i = readByteMem(snaptr);
+
+    s.hlx = readWordMemLE(snaptr);
+    s.dex = readWordMemLE(snaptr);
+    s.bcx = readWordMemLE(snaptr);
+    s.afx = readWordMemLE(snaptr);
+
+    s.hl = readWordMemLE(snaptr);
+    s.de = readWordMemLE(snaptr);
+    s.bc = readWordMemLE(snaptr);
+
+    s.iy = readWordMemLE(snaptr);
+    s.ix = readWordMemLE(snaptr);
+
+    uint8_t inter = readByteMem(snaptr);
+    s.iff2 = (inter & 0x04) ? true : false;
+    s.iff1 = s.iff2;
+    s.r = readByteMem(snaptr);
+
+    s.af = readWordMemLE(snaptr);
+    s.sp = readWordMemLE(snaptr);
+
+    s.im = readByteMem(snaptr);
+    s.border = readByteMem(snaptr);
+    s.halted = false;
+
+    s.is128 = paging != NULL;
+    s.bankLatch = 0;
+    s.pagingLock = 1;
+    s.videoLatch = 0;
+    s.romLatch = 0;
+    s.romInUse = 0;
+
+    if (paging != NULL) {
+        s.pc = readWordMemLE(paging);
+
+        // tmp_port contains page switching status, including current page number (latch)
+        uint8_t tmp_port = readByteMem(paging);
+        uint8_t tr_dos = readByteMem(paging);     // unused
+
+        s.videoLatch = bitRead(tmp_port, 3);
+        s.romLatch = bitRead(tmp_port, 4);
+        s.pagingLock = bitRead(tmp_port, 5);
+        s.bankLatch = tmp_port & 0x07;
+        s.romInUse = s.romLatch;
+    }
+}
+
+// in 48K mode, pop PC from stack
+static void popPC()
+{
+    uint16_t SP = Z80_GET_SP();
+    Z80_SET_PC(Mem::readword(SP));
+    Z80_SET_SP(SP + 2);
+}
 
-    // deallocate buffer if it does not fit required size
-    if (quick_sna_buffer != NULL)
+static void setSnapshotArch(String snapshotArch)
+{
+    // just architecturey things
+    if (Config::getArch() == "128K")
     {
-        if (quick_sna_size == SNA_48K_SIZE && Config::getArch() != "48K") {
-            free(quick_sna_buffer);
-            quick_sna_buffer = NULL;
-            quick_sna_size = 0;
-        }
-        else if (quick_sna_size != SNA_48K_SIZE && Config::getArch() == "48K") {
-            free(quick_sna_buffer);
-            quick_sna_buffer = NULL;
-            quick_sna_size = 0;
+        if (snapshotArch == "48K")
+        {
+            #ifdef SNAPSHOT_LOAD_FORCE_ARCH
+                Config::requestMachine("48K", "SINCLAIR", true);
+                Mem::romInUse = 0;
+            #else
+                Mem::romInUse = 1;
+            #endif
         }
-    } 
-
-    // allocate buffer it not allocated
-    if (quick_sna_buffer == NULL)
+    }
+    else if (Config::getArch() == "48K")
     {
-        uint32_t requested_sna_size = 0;
-        if (Config::getArch() == "48K")
-            requested_sna_size = SNA_48K_SIZE;
-        else
-            requested_sna_size = SNA_128K_SIZE2;
-
-        #ifdef BOARD_HAS_PSRAM
-            quick_sna_buffer = (uint8_t*)ps_calloc(1, requested_sna_size);
-        #else
-            quick_sna_buffer = (uint8_t*)calloc(1, requested_sna_size);
-        #endif
-        if (quick_sna_buffer == NULL) {
-            Serial.printf("FileSNA::saveQuick: cannot allocate %d bytes for snapshot buffer\n", requested_sna_size);
-            KB_INT_START;
-            return false;
+        if (snapshotArch == "128K")
+        {
+            Config::requestMachine("128K", "SINCLAIR", true);
+            Mem::romInUse = 1;
         }
-        quick_sna_size = requested_sna_size;
-        Serial.printf("saveQuick: allocated %d bytes for snapshot buffer\n", quick_sna_size);
     }
 
-    bool result = saveToMem(quick_sna_buffer, quick_sna_size);
-    KB_INT_START;
-    return result;
+    Rewind::reset();
 }
 
-bool FileSNA::saveToMem(uint8_t* dstBuffer, uint32_t size)
-{
-    uint8_t* snaptr = dstBuffer;
+///////////////////////////////////////////////////////////////////////////////
+//
+// Quick save slots: machine state, and the RAM banks in a page pool
+// shared by all slots. A page equal to one already in the pool (same
+// hash, then compared) is stored once, with a reference count, so pages
+// unchanged between saves, or empty, take no extra memory.
 
-    // write registers: begin with I
-    writeByteMem(Z80_GET_I(), snaptr);
+#define NO_PAGE 0xFF
+// all slots, plus the banks of a slot being replaced
+#define QUICK_POOL_SIZE ((QUICK_SLOTS + 1) * 8)
 
-    writeWordMemLE(Z80_GET_HLx(), snaptr);
-    writeWordMemLE(Z80_GET_DEx(), snaptr);
-    writeWordMemLE(Z80_GET_BCx(), snaptr);
-    writeWordMemLE(Z80_GET_AFx(), snaptr);
+#if QUICK_POOL_SIZE >= NO_PAGE
+#error "QUICK_SLOTS is too big"
+#endif
 
-    writeWordMemLE(Z80_GET_HL(), snaptr);
-    writeWordMemLE(Z80_GET_DE(), snaptr);
-    writeWordMemLE(Z80_GET_BC(), snaptr);
+struct QuickPage {
+    uint8_t* data;
+    uint32_t hash;
+    uint16_t refs;
+};
 
-    writeWordMemLE(Z80_GET_IY(), snaptr);
-    writeWordMemLE(Z80_GET_IX(), snaptr);
+struct QuickSlot {
+    bool used;
+    MachineState state;
+    uint8_t pages[8];   // pool index of each RAM bank
+};
 
-    uint8_t inter = Z80_GET_IFF2() ? 0x04 : 0;
-    writeByteMem(inter, snaptr);
-    writeByteMem(Z80_GET_R(), snaptr);
+static QuickPage quickPool[QUICK_POOL_SIZE];
+static QuickSlot quickSlots[QUICK_SLOTS];
+static uint8_t currentSlot = 0;
 
-    writeWordMemLE(Z80_GET_AF(), snaptr);
+static uint32_t pageHash(const uint8_t* page)
+{
+    // FNV-1a over 32 bit words, RAM pages are word aligned
+    const uint32_t* w = (const uint32_t*)page;
+    uint32_t h = 2166136261U;
+    for (uint16_t i = 0; i < MEM_PG_SZ / 4; i++)
+        h = (h ^ w[i]) * 16777619U;
+    return h;
+}
 
-    uint16_t SP = Z80_GET_SP();
-    if (Config::getArch() == "48K") {
-        // decrement stack pointer it for pushing PC to stack, only on 48K
-        SP -= 2;
-        Mem::writeword(SP, Z80_GET_PC());
+// pool index of a page with these contents, stored if not there yet
+static uint8_t internPage(const uint8_t* page)
+{
+    uint32_t hash = pageHash(page);
+    uint8_t unused = NO_PAGE;
+    for (uint8_t i = 0; i < QUICK_POOL_SIZE; i++) {
+        QuickPage& p = quickPool[i];
+        if (p.refs == 0) {
+            if (unused == NO_PAGE) unused = i;
+        }
+        else if (p.hash == hash && memcmp(p.data, page, MEM_PG_SZ) == 0) {
+            p.refs++;
+            return i;
+        }
     }
-    writeWordMemLE(SP, snaptr);
-
-    writeByteMem(Z80_GET_IM(), snaptr);
-    uint8_t bordercol = ESPectrum::borderColor;
-    writeByteMem(bordercol, snaptr);
-
-    // write RAM pages in 48K address space (0x4000 - 0xFFFF)
-    uint8_t pages[3] = {5, 2, 0};
-    if (Config::getArch() == "128K")
-        pages[2] = Mem::bankLatch;
+    if (unused == NO_PAGE)
+        return NO_PAGE;
 
-    for (uint8_t ipage = 0; ipage < 3; ipage++) {
-        uint8_t page = pages[ipage];
-        writeBlockMem(Mem::ram[page], snaptr, MEM_PG_SZ);
+    QuickPage& p = quickPool[unused];
+    #ifdef BOARD_HAS_PSRAM
+        p.data = (uint8_t*)ps_malloc(MEM_PG_SZ);
+    #else
+        p.data = (uint8_t*)malloc(MEM_PG_SZ);
+    #endif
+    if (p.data == NULL) {
+        Serial.println("FileSNA::saveQuick: cannot allocate page");
+        return NO_PAGE;
     }
+    memcpy(p.data, page, MEM_PG_SZ);
+    p.hash = hash;
+    p.refs = 1;
+    return unused;
+}
 
-    if (Config::getArch() == "48K")
-    {
-        // nothing to do here
+static void releasePages(QuickSlot& slot)
+{
+    for (uint8_t bank = 0; bank < 8; bank++) {
+        uint8_t i = slot.pages[bank];
+        if (i == NO_PAGE)
+            continue;
+        if (--quickPool[i].refs == 0) {
+            free(quickPool[i].data);
+            quickPool[i].data = NULL;
+        }
+        slot.pages[bank] = NO_PAGE;
     }
-    else if (Config::getArch() == "128K")
-    {
-        // write pc
-        writeWordMemLE(Z80_GET_PC(), snaptr);
+}
 
-        // write mem bank control port
-        uint8_t tmp_port = Mem::bankLatch;
-        bitWrite(tmp_port, 3, Mem::videoLatch);
-        bitWrite(tmp_port, 4, Mem::romLatch);
-        bitWrite(tmp_port, 5, Mem::pagingLock);
-        writeByteMem(tmp_port, snaptr);
+uint8_t FileSNA::quickSlot()
+{
+    return currentSlot;
+}
 
-        writeByteMem(0, snaptr);     // TR-DOS not paged
+void FileSNA::setQuickSlot(uint8_t slot)
+{
+    if (slot < QUICK_SLOTS)
+        currentSlot = slot;
+}
 
-        // write remaining ram pages
-        for (int page = 0; page < 8; page++) {
-            if (page != Mem::bankLatch && page != 2 && page != 5) {
-                writeBlockMem(Mem::ram[page], snaptr, MEM_PG_SZ);
-            }
-        }
-    }
+bool FileSNA::isQuickAvailable(uint8_t slot)
+{
+    return slot < QUICK_SLOTS && quickSlots[slot].used;
+}
 
-    return true;
+bool FileSNA::isQuickAvailable()
+{
+    return isQuickAvailable(currentSlot);
 }
 
-///////////////////////////////////////////////////////////////////////////////
+bool FileSNA::saveQuick()
+{
+    return saveQuick(currentSlot);
+}
 
 bool FileSNA::loadQuick()
 {
+    return loadQuick(currentSlot);
+}
+
+bool FileSNA::saveQuick(uint8_t slot)
+{
+    if (slot >= QUICK_SLOTS)
+        return false;
+
     KB_INT_STOP;
 
-    if (NULL == quick_sna_buffer) {
+    QuickSlot next;
+    next.used = true;
+    next.state.capture();
+
+    bool ok = true;
+    for (uint8_t bank = 0; bank < 8; bank++) {
+        next.pages[bank] = NO_PAGE;
+        if (ok && (next.state.is128 || bank == 0 || bank == 2 || bank == 5)) {
+            next.pages[bank] = internPage(Mem::ram[bank]);
+            ok = next.pages[bank] != NO_PAGE;
+        }
+    }
+    if (!ok) {
+        releasePages(next);
+        KB_INT_START;
+        return false;
+    }
+
+    // pages of the old contents released once the new ones hold theirs
+    QuickSlot& slotRef = quickSlots[slot];
+    if (slotRef.used)
+        releasePages(slotRef);
+    slotRef = next;
+    currentSlot = slot;
+
+    uint8_t stored = 0;
+    for (uint8_t i = 0; i < QUICK_POOL_SIZE; i++)
+        if (quickPool[i].refs) stored++;
+    Serial.printf("saveQuick: slot %u saved, %u pages stored for all slots\n", slot + 1, stored);
+
+    KB_INT_START;
+    return true;
+}
+
+bool FileSNA::loadQuick(uint8_t slot)
+{
+    if (!isQuickAvailable(slot)) {
         // nothing to read
         Serial.println("FileSNA::loadQuick(): nothing to load");
-        KB_INT_START;
         return false;
     }
 
-    bool result = loadFromMem(quick_sna_buffer, quick_sna_size);
+    KB_INT_STOP;
+
+    QuickSlot& s = quickSlots[slot];
+    for (uint8_t bank = 0; bank < 8; bank++) {
+        if (s.pages[bank] != NO_PAGE)
+            memcpy(Mem::ram[bank], quickPool[s.pages[bank]].data, MEM_PG_SZ);
+    }
+    s.state.restore();
+    setSnapshotArch(s.state.is128 ? "128K" : "48K");
+    currentSlot = slot;
+
     KB_INT_START;
-    return result;
+    return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-bool FileSNA::loadFromMem(uint8_t* srcBuffer, uint32_t size)
+bool FileSNA::saveToMem(uint8_t* dstBuffer, uint32_t size)
 {
-    uint8_t* snaptr = srcBuffer;
+    MachineState s;
+    s.capture();
 
-    String snapshotArch = "48K";
+    uint8_t* snaptr = dstBuffer + SNA_HEADER_SIZE;
 
-    Mem::bankLatch = 0;
-    Mem::pagingLock = 1;
-    Mem::videoLatch = 0;
-    Mem::romLatch = 0;
-    Mem::romInUse = 0;
+    // write RAM pages in 48K address space (0x4000 - 0xFFFF)
+    uint8_t pages[3] = {5, 2, 0};
+    if (s.is128)
+        pages[2] = s.bankLatch;
 
-    Z80_SET_I(readByteMem(snaptr));
+    for (uint8_t ipage = 0; ipage < 3; ipage++) {
+        uint8_t page = pages[ipage];
+        writeBlockMem(Mem::ram[page], snaptr, MEM_PG_SZ);
+    }
 
-    Z80_SET_HLx(readWordMemLE(snaptr));
-    Z80_SET_DEx(readWordMemLE(snaptr));
-    Z80_SET_BCx(readWordMemLE(snaptr));
-    Z80_SET_AFx(readWordMemLE(snaptr));
+    if (s.is128)
+    {
+        stateToSNA(s, dstBuffer, snaptr);
+        snaptr += SNA_PAGING_SIZE;
 
-    Z80_SET_HL(readWordMemLE(snaptr));
-    Z80_SET_DE(readWordMemLE(snaptr));
-    Z80_SET_BC(readWordMemLE(snaptr));
+        // write remaining ram pages
+        for (int page = 0; page < 8; page++) {
+            if (page != s.bankLatch && page != 2 && page != 5) {
+                writeBlockMem(Mem::ram[page], snaptr, MEM_PG_SZ);
+            }
+        }
+    }
+    else
+    {
+        stateToSNA(s, dstBuffer, NULL);
 
-    Z80_SET_IY(readWordMemLE(snaptr));
-    Z80_SET_IX(readWordMemLE(snaptr));
+        // PC pushed to the stack in the image only, emulated RAM is untouched
+        for (uint8_t n = 0; n < 2; n++) {
+            uint16_t addr = s.sp - 2 + n;
+            if (addr >= 0x4000)
+                dstBuffer[SNA_HEADER_SIZE + addr - 0x4000] = n ? s.pc >> 8 : s.pc & 0xFF;
+        }
+    }
 
-    uint8_t inter = readByteMem(snaptr);
-    Z80_SET_IFF2((inter & 0x04) ? true : false);
-    Z80_SET_IFF1(Z80_GET_IFF2());
-    Z80_SET_R(readByteMem(snaptr));
+    return true;
+}
 
-    Z80_SET_AF(readWordMemLE(snaptr));
-    Z80_SET_SP(readWordMemLE(snaptr));
+///////////////////////////////////////////////////////////////////////////////
 
-    Z80_SET_IM(readByteMem(snaptr));
+bool FileSNA::loadFromMem(uint8_t* srcBuffer, uint32_t size)
+{
+    bool is128 = size != SNA_48K_SIZE;
+    uint8_t* snaptr = srcBuffer + SNA_HEADER_SIZE;
 
-    ESPectrum::borderColor = readByteMem(snaptr);
+    // AY and others are kept as they are
+    MachineState s;
+    s.capture();
+    stateFromSNA(s, srcBuffer, is128 ? srcBuffer + SNA_HEADER_SIZE + 3 * MEM_PG_SZ : NULL);
 
     // read 48K memory
     readBlockMem(snaptr, Mem::ram[5], MEM_PG_SZ);
     readBlockMem(snaptr, Mem::ram[2], MEM_PG_SZ);
-    readBlockMem(snaptr, Mem::ram[0], MEM_PG_SZ);
+    readBlockMem(snaptr, Mem::ram[s.bankLatch], MEM_PG_SZ);
 
-    if (size == SNA_48K_SIZE)
+    if (is128)
     {
-        snapshotArch = "48K";
+        snaptr += SNA_PAGING_SIZE;
 
-        // in 48K mode, pop PC from stack
-        uint16_t SP = Z80_GET_SP();
-        Z80_SET_PC(Mem::readword(SP));
-        Z80_SET_SP(SP + 2);
-    }
-    else
-    {
-        snapshotArch = "128K";
-
-        // in 128K mode, recover stored PC
-        Z80_SET_PC(readWordMemLE(snaptr));
-
-        // tmp_port contains page switching status, including current page number (latch)
-        uint8_t tmp_port = readByteMem(snaptr);
-        uint8_t tmp_latch = tmp_port & 0x07;
-
-        // copy what was read into page 0 to correct page
-        memcpy(Mem::ram[tmp_latch], Mem::ram[0], 0x4000);
-
-        uint8_t tr_dos = readByteMem(snaptr);     // unused
-        
         // read remaining pages
         for (int page = 0; page < 8; page++) {
-            if (page != tmp_latch && page != 2 && page != 5) {
+            if (page != s.bankLatch && page != 2 && page != 5) {
                 readBlockMem(snaptr, Mem::ram[page], 0x4000);
             }
         }
-
-        // decode tmp_port
-        Mem::videoLatch = bitRead(tmp_port, 3);
-        Mem::romLatch = bitRead(tmp_port, 4);
-        Mem::pagingLock = bitRead(tmp_port, 5);
-        Mem::bankLatch = tmp_latch;
-        Mem::romInUse = Mem::romLatch;
     }
 
-    // just architecturey things
-    if (Config::getArch() == "128K")
-    {
-        if (snapshotArch == "48K")
-        {
-            #ifdef SNAPSHOT_LOAD_FORCE_ARCH
-                Config::requestMachine("48K", "SINCLAIR", true);
-                Mem::romInUse = 0;
-            #else
-                Mem::romInUse = 1;
-            #endif
-        }
-    }
-    else if (Config::getArch() == "48K")
-    {
-        if (snapshotArch == "128K")
-        {
-            Config::requestMachine("128K", "SINCLAIR", true);
-            Mem::romInUse = 1;
-        }
-    }
+    s.restore();
+    if (!is128)
+        popPC();
 
+    setSnapshotArch(is128 ? "128K" : "48K");
     return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-
@@ -0,0 +1,465 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "hardconfig.h"
+#include "FileSZX.h"
+#include "FileUtils.h"
+#include "PS2Kbd.h"
+#include "CPU.h"
+#include "Mem.h"
+#include "ESPectrum.h"
+#include "Wiimote2Keys.h"
+#include "Config.h"
+#include "AySound.h"
+#include "Tape.h"
+#include "Zlib.h"
+#include "Rewind.h"
+#include "MachineState.h"
+#include "DirIndex.h"
+#include "Z80Access.h"
+
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef USE_INT_FLASH
+// using internal storage (spi flash)
+#include <SPIFFS.h>
+// set The Filesystem to SPIFFS
+#define THE_FS SPIFFS
+#endif
+
+#ifdef USE_SD_CARD
+// using external storage (SD card)
+#include <SD.h>
+// set The Filesystem to SD
+#define THE_FS SD
+#endif
+
+#ifdef USE_SD_CARD_ALT
+// using external storage (SD card with Arduino SFAT Lib)
+#include <SPI.h>
+#include "SdFat.h"
+typedef FsFile SzxFile;
+#define SZX_POSITION(f) (f).curPosition()
+#define SZX_SEEK(f, pos) (f).seekSet(pos)
+#define SZX_OPEN_WRITE(f, fn) (f).open((fn).c_str(), O_WRONLY | O_CREAT | O_TRUNC)
+#else
+typedef File SzxFile;
+#define SZX_POSITION(f) (f).position()
+#define SZX_SEEK(f, pos) (f).seek(pos)
+#define SZX_OPEN_WRITE(f, fn) (f) = THE_FS.open(fn, FILE_WRITE)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// File layout: 8 byte header ("ZXST", version, machine, flags), then
+// blocks made of a 4 character ID, a 32 bit length and the block data.
+// All values are little endian.
+
+#define SZX_MAJOR 1
+#define SZX_MINOR 4
+
+#define SZX_MACHINE_16K     0
+#define SZX_MACHINE_48K     1
+#define SZX_MACHINE_128K    2
+#define SZX_MACHINE_PLUS2   3
+#define SZX_MACHINE_PLUS2A  4
+#define SZX_MACHINE_PLUS3   5
+
+#define SZX_ID(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define SZX_CRTR SZX_ID('C', 'R', 'T', 'R')
+#define SZX_Z80R SZX_ID('Z', '8', '0', 'R')
+#define SZX_SPCR SZX_ID('S', 'P', 'C', 'R')
+#define SZX_RAMP SZX_ID('R', 'A', 'M', 'P')
+#define SZX_AY   SZX_ID('A', 'Y', 0, 0)
+#define SZX_TAPE SZX_ID('T', 'A', 'P', 'E')
+
+#define SZX_Z80R_SIZE 37
+#define SZX_SPCR_SIZE 8
+#define SZX_AY_SIZE   18
+#define SZX_TAPE_SIZE 28    // without file data
+
+#define SZX_RAMP_COMPRESSED 0x0001
+#define SZX_TAPE_EMBEDDED   0x0001
+#define SZX_Z80R_HALTED     0x02
+
+static inline uint16_t getWord(const uint8_t* p) { return p[0] | (p[1] << 8); }
+static inline uint32_t getDWord(const uint8_t* p) { return getWord(p) | ((uint32_t)getWord(p + 2) << 16); }
+static inline void putWord(uint8_t* p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+static inline void putDWord(uint8_t* p, uint32_t v) { putWord(p, v & 0xFFFF); putWord(p + 2, v >> 16); }
+
+// RAMP data is read and written thru the zlib codec with these
+static SzxFile* szxFile;
+static uint32_t szxLeft;    // compressed bytes left in block (load), room left (save)
+static bool szxWriteOk;
+static bool szxTooBig;      // compressed page would not be smaller
+
+static int szxRead(uint8_t* buf, int len)
+{
+    if ((uint32_t)len > szxLeft)
+        len = szxLeft;
+    int n = len > 0 ? szxFile->read(buf, len) : 0;
+    if (n > 0)
+        szxLeft -= n;
+    return n;
+}
+
+static bool szxWrite(const uint8_t* buf, int len)
+{
+    if (szxWriteOk && (uint32_t)len >= szxLeft) {
+        szxTooBig = true;
+        szxWriteOk = false;
+    }
+    szxWriteOk = szxWriteOk && szxFile->write(buf, len) == (size_t)len;
+    szxLeft -= szxWriteOk ? len : 0;
+    return szxWriteOk;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static void loadZ80R(const uint8_t* b)
+{
+    Z80_SET_AF(getWord(b + 0));
+    Z80_SET_BC(getWord(b + 2));
+    Z80_SET_DE(getWord(b + 4));
+    Z80_SET_HL(getWord(b + 6));
+    Z80_SET_AFx(getWord(b + 8));
+    Z80_SET_BCx(getWord(b + 10));
+    Z80_SET_DEx(getWord(b + 12));
+    Z80_SET_HLx(getWord(b + 14));
+    Z80_SET_IX(getWord(b + 16));
+    Z80_SET_IY(getWord(b + 18));
+    Z80_SET_SP(getWord(b + 20));
+    Z80_SET_PC(getWord(b + 22));
+    Z80_SET_I(b[24]);
+    Z80_SET_R(b[25]);
+    Z80_SET_IFF1(b[26] ? true : false);
+    Z80_SET_IFF2(b[27] ? true : false);
+    Z80_SET_IM(b[28] & 0x03);
+    Z80_SET_HALTED((b[34] & SZX_Z80R_HALTED) ? true : false);
+}
+
+static void saveZ80R(const MachineState& s, uint8_t* b)
+{
+    memset(b, 0, SZX_Z80R_SIZE);
+    putWord(b + 0, s.af);
+    putWord(b + 2, s.bc);
+    putWord(b + 4, s.de);
+    putWord(b + 6, s.hl);
+    putWord(b + 8, s.afx);
+    putWord(b + 10, s.bcx);
+    putWord(b + 12, s.dex);
+    putWord(b + 14, s.hlx);
+    putWord(b + 16, s.ix);
+    putWord(b + 18, s.iy);
+    putWord(b + 20, s.sp);
+    putWord(b + 22, s.pc);
+    b[24] = s.i;
+    b[25] = s.r;
+    b[26] = s.iff1 ? 1 : 0;
+    b[27] = s.iff2 ? 1 : 0;
+    b[28] = s.im;
+    // snapshots are taken between frames: cycle counter (29-32) is 0
+    b[34] = s.halted ? SZX_Z80R_HALTED : 0;
+}
+
+bool FileSZX::load(String szx_fn)
+{
+    KB_INT_STOP;
+
+    loadKeytableForGame(szx_fn.c_str());
+
+    SzxFile f = FileUtils::safeOpenFileRead(szx_fn);
+    uint32_t size = f.size();
+
+    uint8_t b[SZX_Z80R_SIZE];
+    if (f.read(b, 8) != 8 || memcmp(b, "ZXST", 4) != 0) {
+        Serial.printf("FileSZX::load: %s is not a SZX file\n", szx_fn.c_str());
+        f.close();
+        KB_INT_START;
+        return false;
+    }
+    uint8_t machine = b[6];
+    String fileArch = machine <= SZX_MACHINE_48K ? "48K" : "128K";
+    bool plus3 = machine == SZX_MACHINE_PLUS2A || machine == SZX_MACHINE_PLUS3;
+
+    Mem::bankLatch = 0;
+    Mem::videoLatch = 0;
+    Mem::romLatch = 0;
+    Mem::pagingLock = fileArch == "48K" ? 1 : 0;
+    Mem::modeSP3 = 0;
+    Mem::romSP3 = 0;
+
+    String tapeFile;
+    uint16_t tapeBlock = 0;
+    bool ok = true;
+
+    szxFile = &f;
+    uint32_t pos = 8;
+    while (ok && pos + 8 <= size) {
+        SZX_SEEK(f, pos);
+        if (f.read(b, 8) != 8)
+            break;
+        uint32_t id = getDWord(b);
+        uint32_t len = getDWord(b + 4);
+        pos += 8 + len;
+
+        if (id == SZX_Z80R && len >= SZX_Z80R_SIZE) {
+            f.read(b, SZX_Z80R_SIZE);
+            loadZ80R(b);
+        }
+        else if (id == SZX_SPCR && len >= SZX_SPCR_SIZE) {
+            f.read(b, SZX_SPCR_SIZE);
+            ESPectrum::borderColor = b[0] & 0x07;
+            if (fileArch == "128K") {
+                Mem::bankLatch = b[1] & 0x07;
+                Mem::videoLatch = bitRead(b[1], 3);
+                Mem::romLatch = bitRead(b[1], 4);
+                Mem::pagingLock = bitRead(b[1], 5);
+            }
+            if (plus3) {
+                Mem::modeSP3 = bitRead(b[2], 0);
+                Mem::romSP3 = bitRead(b[2], 2);
+            }
+        }
+        else if (id == SZX_AY && len >= SZX_AY_SIZE) {
+            f.read(b, SZX_AY_SIZE);
+            AySound::loadRegisters(b + 2, b[1] & 0x0F);
+        }
+        else if (id == SZX_RAMP && len >= 3) {
+            f.read(b, 3);
+            uint16_t flags = getWord(b);
+            uint8_t page = b[2];
+            if (page > 7 || (fileArch == "48K" && page != 0 && page != 2 && page != 5))
+                continue;
+            if (flags & SZX_RAMP_COMPRESSED) {
+                szxLeft = len - 3;
+                ok = Zlib::inflate(&szxRead, Mem::ram[page], MEM_PG_SZ) == MEM_PG_SZ;
+            }
+            else
+                ok = len - 3 >= MEM_PG_SZ && f.read(Mem::ram[page], MEM_PG_SZ) == MEM_PG_SZ;
+            if (!ok)
+                Serial.printf("FileSZX::load: bad RAM page %u\n", page);
+        }
+        else if (id == SZX_TAPE && len > SZX_TAPE_SIZE) {
+            f.read(b, SZX_TAPE_SIZE);
+            if (getWord(b + 2) & SZX_TAPE_EMBEDDED) {
+                Serial.println("FileSZX::load: embedded tape not supported");
+                continue;
+            }
+            tapeBlock = getWord(b);
+            uint32_t nameLen = len - SZX_TAPE_SIZE;
+            char name[128];
+            if (nameLen >= sizeof(name))
+                nameLen = sizeof(name) - 1;
+            f.read((uint8_t*)name, nameLen);
+            name[nameLen] = 0;
+            tapeFile = name;
+        }
+    }
+    f.close();
+
+    if (!ok) {
+        KB_INT_START;
+        return false;
+    }
+
+    if (fileArch == "48K")
+        Mem::romInUse = 0;
+    else {
+        Mem::romInUse = 0;
+        bitWrite(Mem::romInUse, 1, Mem::romSP3);
+        bitWrite(Mem::romInUse, 0, Mem::romLatch);
+    }
+
+    // just architecturey things
+    if (Config::getArch() == "128K")
+    {
+        if (fileArch == "48K")
+        {
+#ifdef SNAPSHOT_LOAD_FORCE_ARCH
+            Config::requestMachine("48K", "SINCLAIR", true);
+            Mem::romInUse = 0;
+#else
+            Mem::romInUse = 1;
+#endif
+        }
+    }
+    else if (Config::getArch() == "48K")
+    {
+        if (fileArch == "128K")
+        {
+            Config::requestMachine("128K", "SINCLAIR", true);
+            Mem::romInUse = 1;
+        }
+    }
+
+    Rewind::reset();
+    KB_INT_START;
+
+    // reinsert tape where it was
+    if (tapeFile.length()) {
+        if (Tape::open(tapeFile))
+            Tape::seekBlock(tapeBlock);
+        else
+            Serial.printf("FileSZX::load: tape %s not available\n", tapeFile.c_str());
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// write block header and data
+static bool writeBlock(SzxFile& f, uint32_t id, const uint8_t* data, uint32_t len)
+{
+    uint8_t h[8];
+    putDWord(h, id);
+    putDWord(h + 4, len);
+    return f.write(h, 8) == 8 && f.write(data, len) == len;
+}
+
+// RAMP block with zlib compressed page; block length patched afterwards.
+// Pages that do not compress are rewritten uncompressed over the partial
+// output, which is always shorter.
+static bool writeRamPage(SzxFile& f, uint8_t page)
+{
+    uint32_t start = SZX_POSITION(f);
+    uint8_t h[11];
+    putDWord(h, SZX_RAMP);
+    putDWord(h + 4, 0);
+    putWord(h + 8, SZX_RAMP_COMPRESSED);
+    h[10] = page;
+    if (f.write(h, sizeof(h)) != sizeof(h))
+        return false;
+
+    szxWriteOk = true;
+    szxTooBig = false;
+    szxLeft = MEM_PG_SZ;
+    int32_t len = Zlib::deflate(Mem::ram[page], MEM_PG_SZ, &szxWrite);
+    if (szxTooBig) {
+        putDWord(h + 4, MEM_PG_SZ + 3);
+        putWord(h + 8, 0);
+        SZX_SEEK(f, start);
+        return f.write(h, sizeof(h)) == sizeof(h) &&
+               f.write(Mem::ram[page], MEM_PG_SZ) == MEM_PG_SZ;
+    }
+    if (len < 0)
+        return false;
+
+    uint32_t end = SZX_POSITION(f);
+    putDWord(h, len + 3);
+    SZX_SEEK(f, start + 4);
+    bool ok = f.write(h, 4) == 4;
+    SZX_SEEK(f, end);
+    return ok;
+}
+
+bool FileSZX::save(String szx_fn)
+{
+    DirIndex::invalidate(szx_fn);
+    KB_INT_STOP;
+
+    SzxFile f;
+    SZX_OPEN_WRITE(f, szx_fn);
+    if (!f) {
+        Serial.printf("FileSZX::save: failed to open %s for writing\n", szx_fn.c_str());
+        KB_INT_START;
+        return false;
+    }
+    szxFile = &f;
+
+    MachineState s;
+    s.capture();
+    bool is128 = s.is128;
+
+    uint8_t b[SZX_Z80R_SIZE];
+    memcpy(b, "ZXST", 4);
+    b[4] = SZX_MAJOR;
+    b[5] = SZX_MINOR;
+    b[6] = is128 ? SZX_MACHINE_128K : SZX_MACHINE_48K;
+    b[7] = 0;
+    bool ok = f.write(b, 8) == 8;
+
+    uint8_t crtr[36];
+    memset(crtr, 0, sizeof(crtr));
+    strncpy((char*)crtr, "ZX-ESPectrum", 32);
+    ok = ok && writeBlock(f, SZX_CRTR, crtr, sizeof(crtr));
+
+    saveZ80R(s, b);
+    ok = ok && writeBlock(f, SZX_Z80R, b, SZX_Z80R_SIZE);
+
+    memset(b, 0, SZX_SPCR_SIZE);
+    b[0] = s.border;
+    b[1] = s.port7FFD();
+    b[2] = s.modeSP3 | (s.romSP3 << 2);
+    b[3] = s.border;
+    ok = ok && writeBlock(f, SZX_SPCR, b, SZX_SPCR_SIZE);
+
+    if (is128) {
+        b[0] = 0;
+        b[1] = s.aySelected;
+        memcpy(b + 2, s.ay, 16);
+        ok = ok && writeBlock(f, SZX_AY, b, SZX_AY_SIZE);
+
+        for (uint8_t page = 0; page < 8 && ok; page++)
+            ok = writeRamPage(f, page);
+    }
+    else {
+        ok = ok && writeRamPage(f, 5) && writeRamPage(f, 2) && writeRamPage(f, 0);
+    }
+
+    // tape is linked by file name, not embedded
+    if (ok && Tape::isOpen()) {
+        const String& name = Tape::fileName();
+        uint8_t t[SZX_TAPE_SIZE];
+        memset(t, 0, sizeof(t));
+        putWord(t, Tape::currentBlock());
+        putDWord(t + 4, name.length() + 1);
+        putDWord(t + 8, name.length() + 1);
+        int dot = name.lastIndexOf('.');
+        if (dot >= 0)
+            strncpy((char*)t + 12, name.c_str() + dot + 1, 15);
+        uint8_t h[8];
+        putDWord(h, SZX_TAPE);
+        putDWord(h + 4, SZX_TAPE_SIZE + name.length() + 1);
+        ok = f.write(h, 8) == 8 && f.write(t, sizeof(t)) == sizeof(t) &&
+             f.write((const uint8_t*)name.c_str(), name.length() + 1) == name.length() + 1;
+    }
+
+    uint32_t size = SZX_POSITION(f);
+    f.close();
+    KB_INT_START;
+
+    if (!ok) {
+        Serial.printf("FileSZX::save: error writing %s\n", szx_fn.c_str());
+        return false;
+    }
+    Serial.printf("FileSZX::save: %s, %u bytes\n", szx_fn.c_str(), size);
+    return true;
+}
@@ -36,6 +36,8 @@
 #include "hardpins.h"
 #include "messages.h"
 #include "osd.h"
+#include "RomFlash.h"
+#include "DirIndex.h"
 #include <FS.h>
 #include "Wiimote2Keys.h"
 #include "sort.h"
@@ -155,7 +157,11 @@ SdFs sd;
 void zx_reset();
 
 // Globals
+static SemaphoreHandle_t sdMutex = NULL;
+
 void IRAM_ATTR FileUtils::initFileSystem() {
+    if (sdMutex == NULL)
+        sdMutex = xSemaphoreCreateRecursiveMutex();
 #ifdef USE_INT_FLASH
 // using internal storage (spi flash)
     Serial.println("Initializing internal storage...");
@@ -327,133 +333,34 @@ File FileUtils::safeOpenFileRead(String filename)
     return f;
 }
 
-int FileUtils::getFileEntriesFromDir(String path,char * filelist) {
-    
-    KB_INT_STOP;
-    int count=0;
+// sorted listing from the directory index, one name per line
+int FileUtils::getFileEntriesFromDir(String path, char * filelist, size_t size) {
 #ifdef XDEBUG
     Serial.printf("Getting entries from: '%s'\n", path.c_str());    
 #endif
-    //String filelist;
-    //char filelist[FILE_STRING_MAX];
-
-    
-    //long bytePos=0;
-    filelist[0]=0;
-    if ((path!=DISK_ROM_DIR) && (path!=DISK_SNA_DIR)) strcat(filelist,"..\n");
-#ifdef USE_SD_CARD_ALT
-    FsFile root;
-    root.open(path.c_str());
-    if (!root || !root.isDir()) {
-        OSD::errorHalt((String)ERR_DIR_OPEN + "\n" + root);
-    }
-    FsFile file;
-    char tempname [256];
-    file.openNext(&root,O_RDONLY);
-    if (!file)
-        Serial.println("No entries found!");
-    while (file) {
-        file.getName(tempname,255);
-#ifdef XDEBUG
-        Serial.printf("Found %s: %s...%ub...", (file.isDirectory() ? "DIR" : "FILE"), tempname, file.size());
-#endif
-        String filename = tempname;
-        byte start = filename.indexOf("/", path.length()) + 1;
-        byte end = filename.indexOf("/", start);
-        filename = filename.substring(start, end);
-#ifdef XDEBUG
-        Serial.printf("%s...", filename.c_str());
-#endif
-        if (filename.startsWith(".")) {
-#ifdef XDEBUG
-            Serial.println("HIDDEN");
-#endif
-        } else 
-        if (filename.endsWith(".txt")) {
-#ifdef XDEBUG
-            Serial.println("IGNORING TXT");
-#endif
-//        } else if (Config::arch == "48K" & file.size() > SNA_48K_SIZE) {
-//            Serial.println("128K SKIP");
-        } else {
-            //if (filelist.indexOf(filename) < 0) {
-#ifdef XDEBUG
-                Serial.println("ADDING");
-                Serial.printf("Free heap after adding: %d\n", ESP.getFreeHeap());
-#endif
-                if (strlen(filelist) + filename.length() + 1 < (FILE_STRING_MAX-strlen(MENU_SNA_TITLE+1))) {
-                        count++;
-                        //filelist += filename + "\n"; 
-                        strcat(filelist,filename.c_str());                        
-                        strcat(filelist,"\n");                        
-                    } else {
-#ifdef XDEBUG
-                    Serial.printf ("Truncated list as string size reached %d, max capcity is %d\n",strlen(filelist),FILE_STRING_MAX);                    
-#endif
-                    return count;
-                }
-            //} else {
-            //    Serial.println("EXISTS");
-           // }
-        }
-        file.openNext(&root,O_RDONLY);
+    if (!DirIndex::load(path)) {
+        OSD::errorHalt((String)ERR_DIR_OPEN + "\n" + path);
     }
 
-#else
-    File root = THE_FS.open(path.c_str());
-    if (!root || !root.isDirectory()) {
-        OSD::errorHalt((String)ERR_DIR_OPEN + "\n" + root);
+    size_t len = 0;
+    int count = 0;
+    if ((path!=DISK_ROM_DIR) && (path!=DISK_SNA_DIR)) {
+        memcpy(filelist, "..\n", 3);
+        len = 3;
     }
-    File file = root.openNextFile();
-    if (!file)
-        Serial.println("No entries found!");
-    while (file) {
-#ifdef XDEBUG
-        Serial.printf("Found %s: %s...%ub...", (file.isDirectory() ? "DIR" : "FILE"), file.name(), file.size());
-#endif
-        String filename = file.name();
-        byte start = filename.indexOf("/", path.length()) + 1;
-        byte end = filename.indexOf("/", start);
-        filename = filename.substring(start, end);
-#ifdef XDEBUG
-        Serial.printf("%s...", filename.c_str());
-#endif
-        if (filename.startsWith(".")) {
-#ifdef XDEBUG
-            Serial.println("HIDDEN");
-#endif
-        } else 
-        if (filename.endsWith(".txt")) {
-#ifdef XDEBUG
-            Serial.println("IGNORING TXT");
-#endif
-//        } else if (Config::arch == "48K" & file.size() > SNA_48K_SIZE) {
-//            Serial.println("128K SKIP");
-        } else {
-   //         if (filelist.indexOf(filename) < 0) {
-#ifdef XDEBUG
-                Serial.println("ADDING");
-                Serial.printf("Free heap after adding: %d\n", ESP.getFreeHeap());
-#endif
-                if (strlen(filelist) + filename.length() + 1 < (FILE_STRING_MAX-strlen(MENU_SNA_TITLE+1))) {
-                        count++;
-                        //filelist += filename + "\n"; 
-                        strcat(filelist,filename.c_str());                        
-                        strcat(filelist,"\n");                        
-                    } else {
-#ifdef XDEBUG
-                    Serial.printf ("Truncated list as string size reached %d, max capcity is %d\n",strlen(filelist),FILE_STRING_MAX);                    
-#endif
-                    return count;
-                }
-      //      } else {
-     //           Serial.println("EXISTS");
-      //      }
+    for (uint16_t i = 0; i < DirIndex::count(); i++) {
+        const char* name = DirIndex::name(i);
+        size_t n = strlen(name);
+        if (len + n + 1 >= size) {
+            Serial.printf("Truncated list at %d of %u entries\n", count, DirIndex::count());
+            break;
         }
-        file = root.openNextFile();
+        memcpy(filelist + len, name, n);
+        len += n;
+        filelist[len++] = '\n';
+        count++;
     }
-#endif    
-    KB_INT_START;    
+    filelist[len] = 0;
     return count;
 }
 
@@ -502,6 +409,179 @@ bool FileUtils::hasZ80extension(String filename)
     return false;
 }
 
+bool FileUtils::hasSZXextension(String filename)
+{
+    if (filename.endsWith(".szx")) return true;
+    if (filename.endsWith(".SZX")) return true;
+    return false;
+}
+
+bool FileUtils::hasTAPextension(String filename)
+{
+    if (filename.endsWith(".tap")) return true;
+    if (filename.endsWith(".TAP")) return true;
+    return false;
+}
+
+bool FileUtils::hasTZXextension(String filename)
+{
+    if (filename.endsWith(".tzx")) return true;
+    if (filename.endsWith(".TZX")) return true;
+    return false;
+}
+
+bool FileUtils::hasCSWextension(String filename)
+{
+    if (filename.endsWith(".csw")) return true;
+    if (filename.endsWith(".CSW")) return true;
+    return false;
+}
+
+bool FileUtils::hasWAVextension(String filename)
+{
+    if (filename.endsWith(".wav")) return true;
+    if (filename.endsWith(".WAV")) return true;
+    return false;
+}
+
+// serialize SD card access between emulation loop and background writers
+void FileUtils::sdLock()
+{
+    if (sdMutex != NULL)
+        xSemaphoreTakeRecursive(sdMutex, portMAX_DELAY);
+}
+
+bool FileUtils::sdTryLock(TickType_t ticks)
+{
+    return sdMutex == NULL || xSemaphoreTakeRecursive(sdMutex, ticks) == pdTRUE;
+}
+
+void FileUtils::sdUnlock()
+{
+    if (sdMutex != NULL)
+        xSemaphoreGiveRecursive(sdMutex);
+}
+
+bool FileUtils::ensureDir(const char* path)
+{
+#ifdef USE_SD_CARD_ALT
+    SD_LOCK;
+    bool ok = sd.exists(path) || sd.mkdir(path);
+    SD_UNLOCK;
+    return ok;
+#else
+    return THE_FS.exists(path) || THE_FS.mkdir(path);
+#endif
+}
+
+#ifdef USE_SD_CARD_ALT
+#define FS_EXISTS(p)     sd.exists((p).c_str())
+#define FS_RENAME(a, b)  sd.rename((a).c_str(), (b).c_str())
+#define FS_REMOVE(p)     sd.remove((p).c_str())
+#else
+#define FS_EXISTS(p)     THE_FS.exists(p)
+#define FS_RENAME(a, b)  THE_FS.rename(a, b)
+#define FS_REMOVE(p)     THE_FS.remove(p)
+#endif
+
+// rename does not overwrite, so the old file is moved aside first and
+// only removed once the new one is in place. If power is lost in
+// between, recoverFile finds either path, or the complete tmp and bak.
+bool FileUtils::replaceFile(const String& tmp, const String& path)
+{
+    String bak = path + ".bak";
+    SD_LOCK;
+    if (FS_EXISTS(bak))
+        FS_REMOVE(bak);
+    bool old = FS_EXISTS(path);
+    bool ok = !old || FS_RENAME(path, bak);
+    if (ok) {
+        ok = FS_RENAME(tmp, path);
+        if (!ok && old)
+            FS_RENAME(bak, path);
+        else if (old)
+            FS_REMOVE(bak);
+    }
+    SD_UNLOCK;
+    return ok;
+}
+
+// after an interrupted replaceFile: the temporary file is complete once
+// the old one has been moved aside, else fall back to the old one
+bool FileUtils::recoverFile(const String& path)
+{
+    String tmp = path + ".tmp";
+    String bak = path + ".bak";
+    SD_LOCK;
+    bool ok = FS_EXISTS(path);
+    if (!ok && FS_EXISTS(bak)) {
+        ok = FS_EXISTS(tmp) && FS_RENAME(tmp, path);
+        if (!ok)
+            ok = FS_RENAME(bak, path);
+        else
+            FS_REMOVE(bak);
+        if (ok)
+            Serial.printf("Recovered %s\n", path.c_str());
+    }
+    SD_UNLOCK;
+    return ok;
+}
+
+bool FileUtils::removeFile(const String& path)
+{
+    SD_LOCK;
+#ifdef USE_SD_CARD_ALT
+    bool ok = sd.remove(path.c_str());
+#else
+    bool ok = THE_FS.remove(path);
+#endif
+    SD_UNLOCK;
+    return ok;
+}
+
+// size in bytes, 0 if the file does not exist
+uint32_t FileUtils::fileSize(const String& path)
+{
+    uint32_t size = 0;
+    SD_LOCK;
+#ifdef USE_SD_CARD_ALT
+    FsFile f;
+    if (f.open(path.c_str(), O_RDONLY)) {
+        size = f.size();
+        f.close();
+    }
+#else
+    File f = THE_FS.open(path.c_str(), FILE_READ);
+    if (f) {
+        size = f.size();
+        f.close();
+    }
+#endif
+    SD_UNLOCK;
+    return size;
+}
+
+// first non existing file named dir/prefixNNNN.ext
+String FileUtils::nextFileName(const char* dir, const char* prefix, const char* ext)
+{
+    char path[64];
+    SD_LOCK;
+    for (int n = 1; n < 10000; n++) {
+        snprintf(path, sizeof(path), "%s/%s%04d.%s", dir, prefix, n, ext);
+#ifdef USE_SD_CARD_ALT
+        if (!sd.exists(path))
+            break;
+#else
+        if (!THE_FS.exists(path))
+            break;
+#endif
+    }
+    SD_UNLOCK;
+    // about to be created
+    DirIndex::invalidate(path);
+    return String(path);
+}
+
 
 /*uint16_t FileUtils::countFileEntriesFromDir(String path) {
     static char entries[FILE_STRING_MAX];
@@ -556,7 +636,91 @@ uint16_t FileUtils::countFileEntriesFromDirQuick(String path) {
 
 }
 
+#if defined(BOARD_HAS_PSRAM) && defined(ROM_CACHE_SETS)
+#define ROM_CACHE
+#endif
+
+// ROM buffers allocated at boot (SRAM if there was room), taken before
+// Mem::rom0..3 are repointed; NULL when ROMs run from flash (RomFlash)
+static uint8_t* bootRom[4];
+static bool bootRomTaken = false;
+
+static void setRomPages(uint8_t* const page[4])
+{
+    Mem::rom[0] = Mem::rom0 = page[0];
+    Mem::rom[1] = Mem::rom1 = page[1];
+    Mem::rom[2] = Mem::rom2 = page[2];
+    Mem::rom[3] = Mem::rom3 = page[3];
+}
+
+#ifdef ROM_CACHE
+// ROM sets already loaded; an entry owns its pages, and the first entry
+// gets the boot ROM buffers if there are any
+struct RomCacheEntry {
+    String   arch;
+    String   romSet;
+    uint8_t  count;
+    uint8_t* page[4];
+    uint32_t lastUse;
+};
+
+static RomCacheEntry romCache[ROM_CACHE_SETS];
+static uint8_t romCacheUsed = 0;
+static uint32_t romCacheClock = 0;
+
+static void selectRomPages(RomCacheEntry& e)
+{
+    e.lastUse = ++romCacheClock;
+    setRomPages(e.page);
+}
+
+// free entry for a new ROM set: a new one while pages can be allocated,
+// else the least recently used
+static RomCacheEntry& romCacheEntry()
+{
+    if (romCacheUsed == 0 && bootRom[0] != NULL) {
+        RomCacheEntry& e = romCache[romCacheUsed++];
+        memcpy(e.page, bootRom, sizeof(e.page));
+        return e;
+    }
+    if (romCacheUsed < ROM_CACHE_SETS) {
+        RomCacheEntry& e = romCache[romCacheUsed];
+        uint8_t p;
+        for (p = 0; p < 4; p++)
+            if ((e.page[p] = (uint8_t*)ps_malloc(MEM_PG_SZ)) == NULL) break;
+        if (p == 4) {
+            romCacheUsed++;
+            return e;
+        }
+        while (p--) free(e.page[p]);
+        if (romCacheUsed == 0)
+            OSD::errorHalt(ERR_BANK_FAIL);
+        Serial.printf("ROM cache: out of PSRAM, reusing oldest set\n");
+    }
+    RomCacheEntry* lru = &romCache[0];
+    for (uint8_t i = 1; i < romCacheUsed; i++)
+        if (romCache[i].lastUse < lru->lastUse) lru = &romCache[i];
+    return *lru;
+}
+#endif
+
 void FileUtils::loadRom(String arch, String romset) {
+    if (!bootRomTaken) {
+        bootRom[0] = Mem::rom0; bootRom[1] = Mem::rom1;
+        bootRom[2] = Mem::rom2; bootRom[3] = Mem::rom3;
+        bootRomTaken = true;
+    }
+    if (RomFlash::select(arch, romset))
+        return;
+#ifdef ROM_CACHE
+    for (uint8_t i = 0; i < romCacheUsed; i++) {
+        if (romCache[i].arch == arch && romCache[i].romSet == romset) {
+            Serial.printf("ROMSET '%s/%s' from cache\n", arch.c_str(), romset.c_str());
+            selectRomPages(romCache[i]);
+            return;
+        }
+    }
+#endif
     KB_INT_STOP;
     String path = "/rom/" + arch + "/" + romset;
     Serial.printf("Loading ROMSET '%s'\n", path.c_str());
@@ -568,7 +732,24 @@ void FileUtils::loadRom(String arch, String romset) {
         OSD::errorHalt("No ROMs found at " + path + "\nARCH: '" + arch + "' ROMSET: " + romset);
     }
     Serial.printf("Processing %u ROMs\n", n_roms);
-    for (byte f = 0; f < n_roms; f++) {
+
+    if (RomFlash::store(arch, romset, path, n_roms)) {
+        KB_INT_START;
+        return;
+    }
+
+#ifdef ROM_CACHE
+    RomCacheEntry& e = romCacheEntry();
+    e.arch = "";    // invalid until fully loaded
+    uint8_t** dest = e.page;
+#else
+    // no PSRAM: boot buffers, allocated here if ROMs were meant for flash
+    if (bootRom[0] == NULL)
+        bootRom[0] = (uint8_t*)malloc(MEM_PG_SZ);
+    uint8_t** dest = bootRom;
+#endif
+
+    for (byte f = 0; f < n_roms && f < 4; f++) {
 #ifdef USE_SD_CARD_ALT
         FsFile rom_f;
         char tempchar [256];
@@ -579,103 +760,26 @@ void FileUtils::loadRom(String arch, String romset) {
         File rom_f = FileUtils::safeOpenFileRead(path + "/" + (String)f + ".rom");
         Serial.printf("Loading ROM '%s'\n", rom_f.name());
 #endif        
-        for (int i = 0; i < rom_f.size(); i++) {
-            switch (f) {
-            case 0:
-                Mem::rom0[i] = rom_f.read();
-                break;
-            case 1:
-                Mem::rom1[i] = rom_f.read();
-                break;
-
-#ifdef BOARD_HAS_PSRAM
-
-            case 2:
-                Mem::rom2[i] = rom_f.read();
-                break;
-            case 3:
-                Mem::rom3[i] = rom_f.read();
-                break;
-#endif
-            }
+        if (dest[f] != NULL) {
+            // whole page in one read
+            size_t size = rom_f.size();
+            if (size > MEM_PG_SZ) size = MEM_PG_SZ;
+            if ((size_t)rom_f.read(dest[f], size) != size)
+                OSD::errorHalt((String)ERR_READ_FILE + "\n" + path + "/" + (String)f + ".rom");
         }
         rom_f.close();
     }
 
-    KB_INT_START;
-}
-
-// Get all sna files sorted alphabetically
-char * FileUtils::getSortedSnaFileList(String path)
-{
-    //int numfiles=countFileEntriesFromDirQuick(path);
-
-    static char filelist[FILE_STRING_MAX];
-
-//#ifdef XDEBUG
-    //Serial.printf("Number of files in Directory: %d\n", numfiles);
-    //Serial.printf("Free heap before obtaining file listing: %d\n", ESP.getFreeHeap());
-//    Serial.printf("memory needed is %d x 256 = %d\n", numfiles,numfiles*256);
-//#endif
-    
- /*   //Check we have enough memory including leaving 8k for other stuff
-    if (ESP.getFreeHeap()-8192<(numfiles * 256))
-    char filecontainter [numfiles] [256];//String* filenames = (String*)malloc(numfiles * sizeof(String));
-
-#ifdef  XDEBUG
-    Serial.printf("Free heap after allocating space for file listing: %d\n", ESP.getFreeHeap());
+#ifdef ROM_CACHE
+    e.arch = arch;
+    e.romSet = romset;
+    e.count = n_roms;
+    selectRomPages(e);
+#else
+    setRomPages(bootRom);
 #endif
-*/
-    // get string of unsorted filenames, separated by newlines
-  //  String entries = 
-    unsigned short count=(unsigned short)getFileEntriesFromDir(path,filelist);
-
-/*#ifdef  XDEBUG
-    Serial.printf("Free heap after obtaining file listing: %d\n", ESP.getFreeHeap());
-    Serial.printf("Size of file list : %d\n", strlen(filelist));
-#endif    */
-    
-  
 
-    // count filenames (they always end at newline)
-    /*unsigned short count = 0;
-    for (unsigned short i = 0; i < entries.length(); i++) {
-        if (entries.charAt(i) == ASCII_NL) {
-            count++;
-        }
-    }*/
-
-    
-//    Serial.printf("Free heap after adding all files: %d\n", ESP.getFreeHeap());
- //   Serial.printf("Number of files retrieved: %d\n", count);
-  //  Serial.printf("Attempting to allocate %d bytes\n", count * sizeof(String));
-
-    // array of filenames
-    //String* filenames = (String*)malloc(count * sizeof(String));
-    // memory must be initialized to avoid crash on assign
-    //memset(filenames, 0, count * sizeof(String));
-
-    // copy filenames from string to array
-    /*unsigned short ich = 0;
-    unsigned short ifn = 0;
-    for (unsigned short i = 0; i < entries.length(); i++) {
-        if (entries.charAt(i) == ASCII_NL) {
-            filenames[ifn++] = entries.substring(ich, i);
-            ich = i + 1;
-        }
-    }*/
-
-    // sort array
-    //sortArray(filelist, count);
-
-    // string of sorted filenames
- //   String sortedEntries = "";
-
-    // copy filenames from array to string
-    /*for (unsigned short i = 0; i < count; i++) {
-        sortedEntries += filenames[i] + '\n';
-    }*/
-
-    return filelist;
+    KB_INT_START;
 }
 
+
@@ -39,8 +39,13 @@
 #include "osd.h"
 #include <FS.h>
 #include "Wiimote2Keys.h"
+#include "Rewind.h"
+#include "MachineState.h"
+#include "DirIndex.h"
 #include "Config.h"
 #include "FileUtils.h"
+#include "AySound.h"
+#include "Z80Access.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -87,17 +92,162 @@ extern Z80_STATE _zxCpu;
     #define O_WRONLY 1
 #endif
 
+#ifdef USE_SD_CARD_ALT
+#define Z80_OPEN_WRITE(file, fn) file.open(fn.c_str(), O_WRONLY | O_CREAT | O_TRUNC)
+#else
+#define Z80_OPEN_WRITE(file, fn) file = THE_FS.open(fn, FILE_WRITE)
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 
 static uint16_t mkword(uint8_t lobyte, uint8_t hibyte) {
     return lobyte | (hibyte << 8);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//
+// Buffered input: the file is read in large chunks into a reusable buffer
+// and memory blocks are decoded from it with pointer loops, instead of
+// going thru the file layer once per byte.
+
+#define Z80_READ_CHUNK 4096
+
+#ifdef USE_SD_CARD_ALT
+static FsFile* inFile;
+#else
+static File* inFile;
+#endif
+static uint8_t* inBuf = NULL;
+static uint16_t inPos = 0;
+static uint16_t inLen = 0;
+
+// compressed block being decoded: input bytes left, and a run cut short
+// by the end of the destination page
+static uint32_t blockLeft = 0;
+static uint16_t runLeft = 0;
+static uint8_t runVal = 0;
+
+// keep unread bytes and top up the buffer; false at end of file
+static bool fill()
+{
+    uint16_t tail = inLen - inPos;
+    memmove(inBuf, inBuf + inPos, tail);
+    int n = inFile->read(inBuf + tail, Z80_READ_CHUNK - tail);
+    inPos = 0;
+    inLen = tail + (n > 0 ? n : 0);
+    return n > 0;
+}
+
+static uint8_t readByte()
+{
+    if (inPos >= inLen && !fill())
+        return 0;
+    return inBuf[inPos++];
+}
+
+static void skip(uint32_t len)
+{
+    while (len > 0) {
+        if (inPos >= inLen && !fill())
+            return;
+        uint32_t n = inLen - inPos;
+        if (n > len) n = len;
+        inPos += n;
+        len -= n;
+    }
+}
+
+// copy len bytes as is; the part not buffered is read straight into dst
+void FileZ80::readRaw(uint8_t* dst, uint16_t len)
+{
+    uint16_t n = inLen - inPos;
+    if (n > len) n = len;
+    memcpy(dst, inBuf + inPos, n);
+    inPos += n;
+    if (n < len) {
+        int r = inFile->read(dst + n, len - n);
+        if (r < len - n)
+            memset(dst + n + (r > 0 ? r : 0), 0, len - n - (r > 0 ? r : 0));
+    }
+}
+
+// decode ED ED nn bb runs of the current block into dst, stopping when
+// dstLen bytes are written or the block ends; returns bytes written
+uint16_t FileZ80::decompress(uint8_t* dst, uint16_t dstLen)
+{
+    uint8_t* out = dst;
+    uint8_t* end = dst + dstLen;
+
+    while (runLeft > 0 && out < end) {
+        *out++ = runVal;
+        runLeft--;
+    }
+
+    while (out < end && blockLeft > 0) {
+        if (inLen - inPos < 4)
+            fill();
+        uint32_t avail = inLen - inPos;
+        if (avail > blockLeft) avail = blockLeft;
+        if (avail == 0)
+            break;      // truncated file
+
+        const uint8_t* start = inBuf + inPos;
+        const uint8_t* p = start;
+        if (avail < 4) {
+            // end of block: too short for a run
+            while (p < start + avail && out < end)
+                *out++ = *p++;
+        }
+        else {
+            // at least 4 bytes readable while p < last
+            const uint8_t* last = start + avail - 3;
+            while (p < last && out < end) {
+                if (p[0] == 0xED && p[1] == 0xED) {
+                    uint16_t n = p[2];
+                    uint8_t v = p[3];
+                    p += 4;
+                    uint16_t room = end - out;
+                    if (n > room) {
+                        runLeft = n - room;
+                        runVal = v;
+                        n = room;
+                    }
+                    memset(out, v, n);
+                    out += n;
+                }
+                else
+                    *out++ = *p++;
+            }
+        }
+        inPos += p - start;
+        blockLeft -= p - start;
+    }
+    return out - dst;
+}
+
+// load a version 2/3 memory block into a 16K page; page NULL skips it
+void FileZ80::loadBlock(uint16_t dataLen, uint8_t* page)
+{
+    if (page == NULL) {
+        skip(dataLen == 0xFFFF ? MEM_PG_SZ : dataLen);
+        return;
+    }
+    if (dataLen == 0xFFFF) {
+        // not compressed
+        readRaw(page, MEM_PG_SZ);
+        return;
+    }
+    blockLeft = dataLen;
+    runLeft = 0;
+    decompress(page, MEM_PG_SZ);
+    skip(blockLeft);
+}
+
 bool FileZ80::load(String sna_fn)
 {
     KB_INT_STOP;
 
-    if (sna_fn != DISK_PSNA_FILE)
+    if (sna_fn != DISK_PZ80_FILE)
         loadKeytableForGame(sna_fn.c_str());
 
     Serial.println("FileZ80::load");
@@ -117,6 +267,15 @@ bool FileZ80::load(String sna_fn)
 
     uint32_t file_size = (uint32_t)f.size();
 
+    inBuf = (uint8_t*)malloc(Z80_READ_CHUNK);
+    if (inBuf == NULL) {
+        Serial.println("Z80.load: unable to allocate read buffer");
+        f.close();
+        KB_INT_START;
+        return false;
+    }
+    inFile = &f;
+    inPos = inLen = 0;
 
 
     uint32_t dataOffset = 0;
@@ -132,7 +291,7 @@ bool FileZ80::load(String sna_fn)
 
     // read first 30 bytes
     for (uint8_t i = 0; i < 30; i++) {
-        header[i] = f.read();
+        header[i] = readByte();
 #ifdef XDEBUG
     Serial.printf("%x, ",header[i]);
 #endif
@@ -226,16 +385,19 @@ bool FileZ80::load(String sna_fn)
             // assuming stupid 00 ED ED 00 terminator present, should check for it instead of assuming
             uint16_t dataLen = (uint16_t)(memRawLength - 4);
 
-            // load compressed data into memory
-            loadCompressedMemData(f, dataLen, 0x4000, 0xC000);
+            // load compressed data into memory, runs may cross pages
+            blockLeft = dataLen;
+            runLeft = 0;
+            decompress(Mem::ram5, MEM_PG_SZ);
+            decompress(Mem::ram2, MEM_PG_SZ);
+            decompress(Mem::ram0, MEM_PG_SZ);
         }
         else
         {
-            uint16_t dataLen = (memRawLength < 0xC000) ? memRawLength : 0xC000;
-
             // load uncompressed data into memory
-            for (int i = 0; i < dataLen; i++)
-                Mem::writebyte(0x4000 + i, f.read());
+            readRaw(Mem::ram5, MEM_PG_SZ);
+            readRaw(Mem::ram2, MEM_PG_SZ);
+            readRaw(Mem::ram0, MEM_PG_SZ);
         }
 
         // latches for 48K
@@ -249,7 +411,7 @@ bool FileZ80::load(String sna_fn)
     {
         // read 2 more bytes
         for (uint8_t i = 30; i < 32; i++) {
-            header[i] = f.read();
+            header[i] = readByte();
             dataOffset ++;
         }
 
@@ -271,12 +433,16 @@ bool FileZ80::load(String sna_fn)
         }
         else {
             Serial.printf("Z80.load: unknown version, ahblen = %d\n", ahblen);
+            free(inBuf);
+            inBuf = NULL;
+            f.close();
+            KB_INT_START;
             return false;
         }
 
         // read additional header block
         for (uint8_t i = 32; i < 32 + ahblen; i++) {
-            header[i] = f.read();
+            header[i] = readByte();
 #ifdef XDEBUG
             Serial.printf("%x, ",header[i]);
 #endif
@@ -332,24 +498,22 @@ bool FileZ80::load(String sna_fn)
             Mem::pagingLock = 1;
             Mem::videoLatch = 0;
 
-            uint16_t pageStart[12] = {0, 0, 0, 0, 0x8000, 0xC000, 0, 0, 0x4000, 0, 0};
+            uint8_t* pages[12] = {
+                NULL, NULL, NULL, NULL, Mem::ram2, Mem::ram0,
+                NULL, NULL, Mem::ram5, NULL, NULL, NULL };
 
             uint32_t dataLen = file_size;
-            while (dataOffset < dataLen) {
-                uint8_t hdr0 = f.read(); dataOffset ++;
-                uint8_t hdr1 = f.read(); dataOffset ++;
-                uint8_t hdr2 = f.read(); dataOffset ++;
+            while (dataOffset + 3 <= dataLen) {
+                uint8_t hdr0 = readByte(); dataOffset ++;
+                uint8_t hdr1 = readByte(); dataOffset ++;
+                uint8_t hdr2 = readByte(); dataOffset ++;
                 uint16_t compDataLen = mkword(hdr0, hdr1);
 #ifdef LOG_Z80_DETAILS
                 Serial.printf("compressed data length: %d\n", compDataLen);
                 Serial.printf("page number: %d\n", hdr2);
 #endif
-                uint16_t memoff = pageStart[hdr2];
-#ifdef LOG_Z80_DETAILS
-                Serial.printf("page start: 0x%X\n", memoff);
-#endif
-                loadCompressedMemData(f, compDataLen, memoff, 0x4000);
-                dataOffset += compDataLen;
+                loadBlock(compDataLen, hdr2 < 12 ? pages[hdr2] : NULL);
+                dataOffset += compDataLen == 0xFFFF ? MEM_PG_SZ : compDataLen;
             }
 
             // great success!!!
@@ -364,6 +528,13 @@ bool FileZ80::load(String sna_fn)
             Mem::videoLatch = bitRead(b35, 3);
             Mem::bankLatch = b35 & 0x07;
 
+            // sound chip registers
+            for (uint8_t r = 0; r < 16; r++) {
+                AySound::selectRegister(r);
+                AySound::setRegisterData(header[39 + r]);
+            }
+            AySound::selectRegister(header[38] & 0x0F);
+
             uint8_t* pages[12] = {
                 Mem::rom0, Mem::rom2, Mem::rom1,
                 Mem::ram0, Mem::ram1, Mem::ram2, Mem::ram3,
@@ -377,10 +548,10 @@ bool FileZ80::load(String sna_fn)
 
 #endif
             uint32_t dataLen = file_size;
-            while (dataOffset < dataLen) {
-                uint8_t hdr0 = f.read(); dataOffset ++;
-                uint8_t hdr1 = f.read(); dataOffset ++;
-                uint8_t hdr2 = f.read(); dataOffset ++;
+            while (dataOffset + 3 <= dataLen) {
+                uint8_t hdr0 = readByte(); dataOffset ++;
+                uint8_t hdr1 = readByte(); dataOffset ++;
+                uint8_t hdr2 = readByte(); dataOffset ++;
 #ifdef XDEBUG
                 Serial.printf("Block header %x, %x, %x\n",hdr0,hdr1,hdr2);
 #endif
@@ -389,18 +560,23 @@ bool FileZ80::load(String sna_fn)
                 Serial.printf("compressed data length: %d\n", compDataLen);
                 Serial.printf("page: %s\n", pagenames[hdr2]);
 #endif
-                uint8_t* memPage = pages[hdr2];
+                // ROM pages are not loaded
+                uint8_t* memPage = (hdr2 >= 3 && hdr2 <= 10) ? pages[hdr2] : NULL;
 #ifdef XDEBUG
                 Serial.printf("Loading compressed page - Length %d to Page %d\n",compDataLen,hdr2);
 #endif
-                loadCompressedMemPage(f, compDataLen, memPage, 0x4000);
-                dataOffset += compDataLen;
+                loadBlock(compDataLen, memPage);
+                dataOffset += compDataLen == 0xFFFF ? MEM_PG_SZ : compDataLen;
             }
 
             // great success!!!
         }
     }
 
+    free(inBuf);
+    inBuf = NULL;
+    f.close();
+
     // just architecturey things
     if (Config::getArch() == "128K")
     {
@@ -423,6 +599,7 @@ bool FileZ80::load(String sna_fn)
         }
     }
 
+    Rewind::reset();
     delay(100);
 
     KB_INT_START;
@@ -430,92 +607,356 @@ bool FileZ80::load(String sna_fn)
     return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+
+// version 1: bank 5 is at the start of the memory image; version 2/3:
+// bank 5 is block page 8, for 48K and 128K alike
+bool FileZ80::loadScreen(String z80_fn, uint8_t* screen)
+{
+    KB_INT_STOP;
 #ifdef USE_SD_CARD_ALT
-    void FileZ80::loadCompressedMemData(FsFile &f, uint16_t dataLen, uint16_t memoff, uint16_t memlen)
+    FsFile f;
+    f.open(z80_fn.c_str(), O_RDONLY);
 #else
-    void FileZ80::loadCompressedMemData(File f, uint16_t dataLen, uint16_t memoff, uint16_t memlen)
+    File f = THE_FS.open(z80_fn.c_str(), FILE_READ);
 #endif
-{
-    uint16_t dataOff = 0;
-    uint8_t ed_cnt = 0;
-    uint8_t repcnt = 0;
-    uint8_t repval = 0;
-    uint16_t memidx = 0;
-
-    while(dataOff < dataLen && memidx < memlen) {
-        uint8_t databyte = f.read();
-        if (ed_cnt == 0) {
-            if (databyte != 0xED)
-                Mem::writebyte(memoff + memidx++, databyte);
-            else
-                ed_cnt++;
+    if (!f) {
+        KB_INT_START;
+        return false;
+    }
+    uint32_t file_size = (uint32_t)f.size();
+
+    inBuf = (uint8_t*)malloc(Z80_READ_CHUNK);
+    if (inBuf == NULL) {
+        f.close();
+        KB_INT_START;
+        return false;
+    }
+    inFile = &f;
+    inPos = inLen = 0;
+
+    uint8_t header[32];
+    for (uint8_t i = 0; i < 30; i++)
+        header[i] = readByte();
+
+    bool ok = false;
+    if (file_size <= 32) {
+        // not a snapshot
+    }
+    else if (mkword(header[6], header[7]) != 0) {
+        if (header[12] & 0x20) {
+            blockLeft = file_size - 30;
+            runLeft = 0;
+            ok = decompress(screen, ZX_SCREEN_SIZE) == ZX_SCREEN_SIZE;
+        }
+        else {
+            readRaw(screen, ZX_SCREEN_SIZE);
+            ok = file_size >= 30 + ZX_SCREEN_SIZE;
         }
-        else if (ed_cnt == 1) {
-            if (databyte != 0xED) {
-                Mem::writebyte(memoff + memidx++, 0xED);
-                Mem::writebyte(memoff + memidx++, databyte);
-                ed_cnt = 0;
+    }
+    else {
+        header[30] = readByte();
+        header[31] = readByte();
+        uint32_t dataOffset = 32 + mkword(header[30], header[31]);
+        skip(mkword(header[30], header[31]));
+        while (!ok && dataOffset + 3 <= file_size) {
+            uint16_t compDataLen = readByte();
+            compDataLen |= readByte() << 8;
+            uint8_t page = readByte();
+            dataOffset += 3;
+            if (page == 8) {
+                if (compDataLen == 0xFFFF) {
+                    readRaw(screen, ZX_SCREEN_SIZE);
+                    ok = true;
+                }
+                else {
+                    blockLeft = compDataLen;
+                    runLeft = 0;
+                    ok = decompress(screen, ZX_SCREEN_SIZE) == ZX_SCREEN_SIZE;
+                }
+                break;
             }
-            else
-                ed_cnt++;
+            uint32_t len = compDataLen == 0xFFFF ? MEM_PG_SZ : compDataLen;
+            skip(len);
+            dataOffset += len;
         }
-        else if (ed_cnt == 2) {
-            repcnt = databyte;
-            ed_cnt++;
+    }
+
+    free(inBuf);
+    inBuf = NULL;
+    f.close();
+    KB_INT_START;
+    return ok;
+}
+
+bool FileZ80::isPersistAvailable()
+{
+    return FileUtils::recoverFile(DISK_PZ80_FILE);
+}
+
+// compress a 16K page with the ED ED nn bb scheme into dst (page sized);
+// returns the compressed length, or 0 if it would not be smaller
+static uint16_t compressPage(const uint8_t* src, uint8_t* dst)
+{
+    const uint8_t* end = src + MEM_PG_SZ;
+    uint8_t* out = dst;
+    uint8_t* limit = dst + MEM_PG_SZ - 4;   // room for a full sequence
+
+    while (src < end) {
+        if (out > limit)
+            return 0;
+        uint8_t b = *src;
+        const uint8_t* run = src + 1;
+        while (run < end && *run == b && run - src < 255)
+            run++;
+        uint16_t n = run - src;
+        if (n >= 5 || (n >= 2 && b == 0xED)) {
+            *out++ = 0xED;
+            *out++ = 0xED;
+            *out++ = n;
+            *out++ = b;
+            src = run;
         }
-        else if (ed_cnt == 3) {
-            repval = databyte;
-            for (uint16_t i = 0; i < repcnt; i++)
-                Mem::writebyte(memoff + memidx++, repval);
-            ed_cnt = 0;
+        else {
+            *out++ = *src++;
+            // the byte after a single ED is never part of a run
+            if (b == 0xED && src < end)
+                *out++ = *src++;
         }
     }
-    #ifdef LOG_Z80_DETAILS
-        Serial.printf("last byte: %d\n", (memoff+memidx-1));
-    #endif
+    return out - dst;
 }
 
+// write a version 3 memory block: 3 byte header, then compressed data, or
+// the page as is (length 0xFFFF) when compression does not help (NULL)
 #ifdef USE_SD_CARD_ALT
-    void FileZ80::loadCompressedMemPage(FsFile &f, uint16_t dataLen, uint8_t* memPage, uint16_t memlen)
+static bool writeBlock(FsFile &f, uint8_t pageNum, const uint8_t* page, const uint8_t* compressed, uint16_t len)
 #else
-    void FileZ80::loadCompressedMemPage(File f, uint16_t dataLen, uint8_t* memPage, uint16_t memlen)
+static bool writeBlock(File &f, uint8_t pageNum, const uint8_t* page, const uint8_t* compressed, uint16_t len)
 #endif
 {
-    uint16_t dataOff = 0;
-    uint8_t ed_cnt = 0;
-    uint8_t repcnt = 0;
-    uint8_t repval = 0;
-    uint16_t memidx = 0;
-
-    while(dataOff < dataLen && memidx < memlen) {
-        uint8_t databyte = f.read();
-        if (ed_cnt == 0) {
-            if (databyte != 0xED)
-                memPage[memidx++] = databyte;
-            else
-                ed_cnt++;
-        }
-        else if (ed_cnt == 1) {
-            if (databyte != 0xED) {
-                memPage[memidx++] = 0xED;
-                memPage[memidx++] = databyte;
-                ed_cnt = 0;
-            }
-            else
-                ed_cnt++;
-        }
-        else if (ed_cnt == 2) {
-            repcnt = databyte;
-            ed_cnt++;
-        }
-        else if (ed_cnt == 3) {
-            repval = databyte;
-            for (uint16_t i = 0; i < repcnt; i++)
-                memPage[memidx++] = repval;
-            ed_cnt = 0;
+    const uint8_t* data = compressed ? compressed : page;
+    uint16_t dataLen = compressed ? len : MEM_PG_SZ;
+    if (!compressed) len = 0xFFFF;
+
+    uint8_t hdr[3] = { (uint8_t)(len & 0xFF), (uint8_t)(len >> 8), pageNum };
+    if (f.write(hdr, 3) != 3)
+        return false;
+    return f.write(data, dataLen) == dataLen;
+}
+
+#define Z80_HEADER_SIZE 86
+
+// version 3 header from a machine state: 30 bytes, additional header
+// length, 54 bytes
+static void stateToHeader(const MachineState& s, uint8_t* header)
+{
+    memset(header, 0, Z80_HEADER_SIZE);
+
+    header[0] = s.af >> 8;
+    header[1] = s.af & 0xFF;
+    header[2] = s.bc & 0xFF;  header[3] = s.bc >> 8;
+    header[4] = s.hl & 0xFF;  header[5] = s.hl >> 8;
+    // PC = 0 in bytes 6-7 marks version 2 and later
+    header[8] = s.sp & 0xFF;  header[9] = s.sp >> 8;
+    header[10] = s.i;
+    header[11] = s.r & 0x7F;
+    header[12] = (s.r >> 7) | ((s.border & 0x07) << 1);
+    header[13] = s.de & 0xFF; header[14] = s.de >> 8;
+    header[15] = s.bcx & 0xFF; header[16] = s.bcx >> 8;
+    header[17] = s.dex & 0xFF; header[18] = s.dex >> 8;
+    header[19] = s.hlx & 0xFF; header[20] = s.hlx >> 8;
+    header[21] = s.afx >> 8;  // watch out for order!!!
+    header[22] = s.afx & 0xFF;
+    header[23] = s.iy & 0xFF; header[24] = s.iy >> 8;
+    header[25] = s.ix & 0xFF; header[26] = s.ix >> 8;
+    header[27] = s.iff1 ? 1 : 0;
+    header[28] = s.iff2 ? 1 : 0;
+    header[29] = s.im & 0x03;
+
+    header[30] = 54;
+    header[31] = 0;
+    header[32] = s.pc & 0xFF; header[33] = s.pc >> 8;
+    header[34] = s.is128 ? 4 : 0;
+    if (s.is128)
+        header[35] = s.port7FFD();
+
+    // sound chip: selected register and register contents
+    header[38] = s.aySelected;
+    memcpy(header + 39, s.ay, 16);
+
+    // T-state counter: T-states left in the quarter frame (lo) and the
+    // quarter, counting up mod 4 from 3 at the interrupt (hi), so that
+    // t = ((hi + 1) % 4 + 1) * quarter - (lo + 1)
+    uint32_t quarter = CPU::statesPerFrame() / 4;
+    uint32_t t = s.tstates % CPU::statesPerFrame();
+    uint16_t lo = quarter - 1 - t % quarter;
+    header[55] = lo & 0xFF;
+    header[56] = lo >> 8;
+    header[57] = (t / quarter + 3) & 0x03;
+
+    // 0-16K is ROM
+    header[61] = 0xFF;
+    header[62] = 0xFF;
+}
+
+// write header and RAM banks (48K: 5, 2, 0) to a new file; SD is locked
+// per write only, so this can run in a background task
+static bool writeSnapshot(String z80_fn, const uint8_t* header, uint8_t* const* banks, bool is128, uint8_t* scratch)
+{
+#ifdef USE_SD_CARD_ALT
+    FsFile f;
+#else
+    File f;
+#endif
+    SD_LOCK;
+    Z80_OPEN_WRITE(f, z80_fn);
+    bool ok = (bool)f;
+    if (ok)
+        ok = f.write(header, Z80_HEADER_SIZE) == Z80_HEADER_SIZE;
+    SD_UNLOCK;
+    if (!f) {
+        Serial.printf("FileZ80::save: failed to open %s for writing\n", z80_fn.c_str());
+        return false;
+    }
+
+    static const uint8_t order48[3] = { 5, 2, 0 };
+    static const uint8_t pageNum48[3] = { 8, 4, 5 };
+    uint8_t count = is128 ? 8 : 3;
+    for (uint8_t i = 0; i < count && ok; i++) {
+        uint8_t bank = is128 ? i : order48[i];
+        // compress outside the lock
+        uint16_t len = compressPage(banks[bank], scratch);
+        SD_LOCK;
+        ok = writeBlock(f, is128 ? bank + 3 : pageNum48[i], banks[bank], len ? scratch : NULL, len);
+        SD_UNLOCK;
+    }
+
+    SD_LOCK;
+    uint32_t size = f.size();
+    f.close();
+    SD_UNLOCK;
+
+    if (!ok) {
+        Serial.printf("FileZ80::save: error writing %s\n", z80_fn.c_str());
+        return false;
+    }
+    Serial.printf("FileZ80::save: %s, %u bytes\n", z80_fn.c_str(), size);
+    return true;
+}
+
+// write to a temporary file first, so a failed write never damages an
+// existing snapshot
+static bool writeSnapshotSafe(String z80_fn, const uint8_t* header, uint8_t* const* banks, bool is128, uint8_t* scratch)
+{
+    String tmp = z80_fn + ".tmp";
+    bool ok = writeSnapshot(tmp, header, banks, is128, scratch);
+    SD_LOCK;
+    ok = ok && FileUtils::replaceFile(tmp, z80_fn);
+    if (!ok)
+        FileUtils::removeFile(tmp);
+    DirIndex::invalidate(z80_fn);
+    SD_UNLOCK;
+    return ok;
+}
+
+bool FileZ80::save(String z80_fn)
+{
+    KB_INT_STOP;
+
+    uint8_t* scratch = (uint8_t*)malloc(MEM_PG_SZ);
+    if (scratch == NULL) {
+        Serial.println("FileZ80::save: unable to allocate compression buffer");
+        KB_INT_START;
+        return false;
+    }
+
+    MachineState s;
+    s.capture();
+    uint8_t header[Z80_HEADER_SIZE];
+    stateToHeader(s, header);
+    bool ok = writeSnapshotSafe(z80_fn, header, Mem::ram, s.is128, scratch);
+
+    free(scratch);
+    KB_INT_START;
+    return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Background save: the machine state is copied to a shadow in PSRAM (RAM
+// banks, then compression scratch), and written from a low priority task
+// while emulation goes on.
+
+#define ASYNC_SAVE_STACK 4096
+#define ASYNC_SAVE_CORE 0
+#define ASYNC_SAVE_PRIORITY 1
+
+static uint8_t* shadow = NULL;
+static uint8_t shadowHeader[Z80_HEADER_SIZE];
+static bool shadowIs128;
+static String asyncFile;
+static volatile uint8_t asyncState = FileZ80::ASYNC_IDLE;
+
+static void asyncSaveTask(void* unused)
+{
+    uint8_t* banks[8];
+    for (uint8_t i = 0; i < 8; i++)
+        banks[i] = shadow + i * MEM_PG_SZ;
+    bool ok = writeSnapshotSafe(asyncFile, shadowHeader, banks, shadowIs128, shadow + 8 * MEM_PG_SZ);
+    asyncState = ok ? FileZ80::ASYNC_DONE : FileZ80::ASYNC_FAILED;
+    vTaskDelete(NULL);
+}
+
+bool FileZ80::saveAsync(String z80_fn)
+{
+    if (asyncState == ASYNC_BUSY)
+        return false;
+
+    // kept for later saves
+    if (shadow == NULL) {
+#ifdef BOARD_HAS_PSRAM
+        shadow = (uint8_t*)ps_malloc(9 * MEM_PG_SZ);
+#endif
+        if (shadow == NULL) {
+            Serial.println("FileZ80::saveAsync: unable to allocate shadow copy");
+            return false;
         }
     }
-    #ifdef LOG_Z80_DETAILS
-        Serial.printf("last byte: %d\n", (memoff+memidx-1));
-    #endif
+
+    MachineState s;
+    s.capture();
+    shadowIs128 = s.is128;
+    stateToHeader(s, shadowHeader);
+    if (shadowIs128) {
+        for (uint8_t i = 0; i < 8; i++)
+            memcpy(shadow + i * MEM_PG_SZ, Mem::ram[i], MEM_PG_SZ);
+    }
+    else {
+        memcpy(shadow + 5 * MEM_PG_SZ, Mem::ram5, MEM_PG_SZ);
+        memcpy(shadow + 2 * MEM_PG_SZ, Mem::ram2, MEM_PG_SZ);
+        memcpy(shadow + 0 * MEM_PG_SZ, Mem::ram0, MEM_PG_SZ);
+    }
+    asyncFile = z80_fn;
+
+    asyncState = ASYNC_BUSY;
+    if (xTaskCreatePinnedToCore(&asyncSaveTask, "z80Save", ASYNC_SAVE_STACK, NULL,
+            ASYNC_SAVE_PRIORITY, NULL, ASYNC_SAVE_CORE) != pdPASS) {
+        asyncState = ASYNC_IDLE;
+        return false;
+    }
+    return true;
+}
+
+bool FileZ80::isSaving()
+{
+    return asyncState == ASYNC_BUSY;
+}
+
+uint8_t FileZ80::asyncStatus()
+{
+    uint8_t state = asyncState;
+    if (state == ASYNC_DONE || state == ASYNC_FAILED)
+        asyncState = ASYNC_IDLE;
+    return state;
 }
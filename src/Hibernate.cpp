@@ -0,0 +1,174 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "hardconfig.h"
+
+#ifdef HIBERNATE_PARTITION
+
+#include "Hibernate.h"
+#include "MachineState.h"
+#include "Mem.h"
+#include "Config.h"
+#include "Rewind.h"
+#include <esp_partition.h>
+#include <esp_spi_flash.h>
+#include <esp_heap_caps.h>
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Partition layout: header in the first sector, then a 16K slot for each
+// RAM bank. Pages are written first and the header last, so a valid
+// header means a complete image; it is invalidated on resume by clearing
+// the magic, which needs no erase.
+
+#define HIBERNATE_MAGIC 0x4E42485A      // "ZHBN"
+#define HIBERNATE_VERSION 1
+#define HIBERNATE_PAGES 0x1000
+#define HIBERNATE_SIZE (HIBERNATE_PAGES + 8 * MEM_PG_SZ)
+
+// flash is written from internal RAM, RAM banks may be in PSRAM
+#define HIBERNATE_CHUNK 0x1000
+
+struct HibernateHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t stateSize;
+    uint8_t banks;              // bit n set: bank n stored
+    char arch[8];
+    char romSet[24];
+    MachineState state;
+};
+
+static const esp_partition_t* findPartition()
+{
+    const esp_partition_t* part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+        (esp_partition_subtype_t)HIBERNATE_SUBTYPE, HIBERNATE_PARTITION);
+    if (part == NULL) {
+        Serial.printf("Hibernate: no '%s' partition\n", HIBERNATE_PARTITION);
+        return NULL;
+    }
+    if (part->size < HIBERNATE_SIZE) {
+        Serial.printf("Hibernate: partition too small (%u < %u)\n", part->size, HIBERNATE_SIZE);
+        return NULL;
+    }
+    return part;
+}
+
+bool Hibernate::save()
+{
+    const esp_partition_t* part = findPartition();
+    if (part == NULL)
+        return false;
+
+    uint8_t* chunk = (uint8_t*)heap_caps_malloc(HIBERNATE_CHUNK, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (chunk == NULL) {
+        Serial.println("Hibernate::save: unable to allocate buffer");
+        return false;
+    }
+
+    uint32_t start = millis();
+
+    HibernateHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = HIBERNATE_MAGIC;
+    h.version = HIBERNATE_VERSION;
+    h.stateSize = sizeof(MachineState);
+    h.state.capture();
+    strncpy(h.arch, Config::getArch().c_str(), sizeof(h.arch) - 1);
+    strncpy(h.romSet, Config::getRomSet().c_str(), sizeof(h.romSet) - 1);
+
+    bool ok = esp_partition_erase_range(part, 0, HIBERNATE_SIZE) == ESP_OK;
+
+    for (uint8_t bank = 0; bank < 8 && ok; bank++) {
+        if (!h.state.is128 && bank != 0 && bank != 2 && bank != 5)
+            continue;
+        for (uint32_t off = 0; off < MEM_PG_SZ && ok; off += HIBERNATE_CHUNK) {
+            memcpy(chunk, Mem::ram[bank] + off, HIBERNATE_CHUNK);
+            ok = esp_partition_write(part, HIBERNATE_PAGES + bank * MEM_PG_SZ + off, chunk, HIBERNATE_CHUNK) == ESP_OK;
+        }
+        h.banks |= 1 << bank;
+    }
+
+    if (ok) {
+        memcpy(chunk, &h, sizeof(h));
+        ok = esp_partition_write(part, 0, chunk, sizeof(h)) == ESP_OK;
+    }
+    free(chunk);
+
+    if (!ok) {
+        Serial.println("Hibernate::save: flash write error");
+        return false;
+    }
+    Serial.printf("Hibernate::save: %s image written in %u ms\n", h.arch, millis() - start);
+    return true;
+}
+
+bool Hibernate::resume()
+{
+    const esp_partition_t* part = findPartition();
+    if (part == NULL)
+        return false;
+
+    HibernateHeader h;
+    if (esp_partition_read(part, 0, &h, sizeof(h)) != ESP_OK)
+        return false;
+    if (h.magic != HIBERNATE_MAGIC || h.version != HIBERNATE_VERSION || h.stateSize != sizeof(MachineState))
+        return false;
+
+    uint32_t start = millis();
+
+    h.arch[sizeof(h.arch) - 1] = 0;
+    h.romSet[sizeof(h.romSet) - 1] = 0;
+    if (Config::getArch() != h.arch || Config::getRomSet() != h.romSet)
+        Config::requestMachine(h.arch, h.romSet, true);
+
+    const void* map;
+    spi_flash_mmap_handle_t handle;
+    if (esp_partition_mmap(part, HIBERNATE_PAGES, 8 * MEM_PG_SZ, SPI_FLASH_MMAP_DATA, &map, &handle) != ESP_OK) {
+        Serial.println("Hibernate::resume: unable to map partition");
+        return false;
+    }
+    for (uint8_t bank = 0; bank < 8; bank++) {
+        if (h.banks & (1 << bank))
+            memcpy(Mem::ram[bank], (const uint8_t*)map + bank * MEM_PG_SZ, MEM_PG_SZ);
+    }
+    spi_flash_munmap(handle);
+
+    h.state.restore();
+    Rewind::reset();
+
+    // used once: clear magic
+    uint32_t zero = 0;
+    esp_partition_write(part, 0, &zero, sizeof(zero));
+
+    Serial.printf("Hibernate::resume: %s image restored in %u ms\n", h.arch, millis() - start);
+    return true;
+}
+
+#endif // HIBERNATE_PARTITION
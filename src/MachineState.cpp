@@ -0,0 +1,108 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include <Arduino.h>
+#include "MachineState.h"
+#include "CPU.h"
+#include "Mem.h"
+#include "ESPectrum.h"
+#include "AySound.h"
+#include "Config.h"
+#include "Z80Access.h"
+
+void MachineState::capture()
+{
+    af = Z80_GET_AF();   bc = Z80_GET_BC();
+    de = Z80_GET_DE();   hl = Z80_GET_HL();
+    afx = Z80_GET_AFx(); bcx = Z80_GET_BCx();
+    dex = Z80_GET_DEx(); hlx = Z80_GET_HLx();
+    ix = Z80_GET_IX();   iy = Z80_GET_IY();
+    sp = Z80_GET_SP();   pc = Z80_GET_PC();
+    i = Z80_GET_I();
+    r = Z80_GET_R();
+    im = Z80_GET_IM();
+    iff1 = Z80_GET_IFF1();
+    iff2 = Z80_GET_IFF2();
+    halted = Z80_GET_HALTED();
+
+    is128 = Config::getArch() == "128K";
+    bankLatch = Mem::bankLatch;
+    videoLatch = Mem::videoLatch;
+    romLatch = Mem::romLatch;
+    pagingLock = Mem::pagingLock;
+    romInUse = Mem::romInUse;
+    modeSP3 = Mem::modeSP3;
+    romSP3 = Mem::romSP3;
+    border = ESPectrum::borderColor;
+
+    aySelected = AySound::getSelectedRegister();
+    for (uint8_t n = 0; n < 16; n++) {
+        AySound::selectRegister(n);
+        ay[n] = AySound::getRegisterData();
+    }
+    AySound::selectRegister(aySelected);
+
+    tstates = CPU::tstates;
+}
+
+void MachineState::restore() const
+{
+    Z80_SET_AF(af);   Z80_SET_BC(bc);
+    Z80_SET_DE(de);   Z80_SET_HL(hl);
+    Z80_SET_AFx(afx); Z80_SET_BCx(bcx);
+    Z80_SET_DEx(dex); Z80_SET_HLx(hlx);
+    Z80_SET_IX(ix);   Z80_SET_IY(iy);
+    Z80_SET_SP(sp);   Z80_SET_PC(pc);
+    Z80_SET_I(i);
+    Z80_SET_R(r);
+    Z80_SET_IM(im);
+    Z80_SET_IFF1(iff1);
+    Z80_SET_IFF2(iff2);
+    Z80_SET_HALTED(halted);
+
+    Mem::bankLatch = bankLatch;
+    Mem::videoLatch = videoLatch;
+    Mem::romLatch = romLatch;
+    Mem::pagingLock = pagingLock;
+    Mem::romInUse = romInUse;
+    Mem::modeSP3 = modeSP3;
+    Mem::romSP3 = romSP3;
+    ESPectrum::borderColor = border;
+
+    AySound::loadRegisters(ay, aySelected);
+}
+
+uint8_t MachineState::port7FFD() const
+{
+    uint8_t port = bankLatch;
+    bitWrite(port, 3, videoLatch);
+    bitWrite(port, 4, romLatch);
+    bitWrite(port, 5, pagingLock);
+    return port;
+}
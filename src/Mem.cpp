@@ -54,3 +54,93 @@ uint8_t Mem::modeSP3 = 0;
 uint8_t Mem::romSP3 = 0;
 uint8_t Mem::romInUse = 0;
 
+#ifdef REWIND_BUFFER
+uint8_t Mem::dirty[8 * MEM_BLOCKS];
+#endif
+
+
+#ifdef MEM_PLACEMENT
+
+#include <stdio.h>
+#include <soc/soc.h>
+
+uint8_t Mem::sampleTick = 0;
+uint32_t Mem::bankHits[8];
+
+static uint8_t placeFrames = 0;
+static uint32_t placeSwaps = 0;
+static uint8_t lastHot = 0xFF;
+static uint8_t lastCold = 0xFF;
+
+static uint8_t** const ramNamed[8] = {
+    &Mem::ram0, &Mem::ram1, &Mem::ram2, &Mem::ram3,
+    &Mem::ram4, &Mem::ram5, &Mem::ram6, &Mem::ram7 };
+
+static bool inPSRAM(const uint8_t* p)
+{
+    return (uint32_t)p >= SOC_EXTRAM_DATA_LOW && (uint32_t)p < SOC_EXTRAM_DATA_HIGH;
+}
+
+// exchange contents and pointers of two banks, so each bank keeps its data
+// and moves to the other's memory
+static void swapBanks(uint8_t a, uint8_t b)
+{
+    uint32_t* pa = (uint32_t*)Mem::ram[a];
+    uint32_t* pb = (uint32_t*)Mem::ram[b];
+    for (uint16_t i = 0; i < MEM_PG_SZ / 4; i++) {
+        uint32_t t = pa[i];
+        pa[i] = pb[i];
+        pb[i] = t;
+    }
+    Mem::ram[a] = *ramNamed[a] = (uint8_t*)pb;
+    Mem::ram[b] = *ramNamed[b] = (uint8_t*)pa;
+}
+
+void Mem::placeBanks()
+{
+    if (++placeFrames < MEM_PLACE_FRAMES)
+        return;
+    placeFrames = 0;
+
+    // always mapped, or on screen (read by the video task)
+    uint8_t fixed = (1 << 2) | (1 << 5);
+    if (videoLatch) fixed |= 1 << 7;
+
+    uint8_t hot = 0xFF, cold = 0xFF;
+    for (uint8_t bank = 0; bank < 8; bank++) {
+        if ((fixed & (1 << bank)) || ram[bank] == NULL)
+            continue;
+        if (inPSRAM(ram[bank])) {
+            if (hot == 0xFF || bankHits[bank] > bankHits[hot])
+                hot = bank;
+        }
+        else if (cold == 0xFF || bankHits[bank] < bankHits[cold])
+            cold = bank;
+    }
+
+    // hysteresis: hot bank must be used twice as much
+    if (hot != 0xFF && cold != 0xFF && bankHits[hot] > 2 * bankHits[cold] + 64) {
+        swapBanks(hot, cold);
+        lastHot = hot;
+        lastCold = cold;
+        placeSwaps++;
+    }
+
+    // older samples count less
+    for (uint8_t bank = 0; bank < 8; bank++)
+        bankHits[bank] >>= 1;
+}
+
+void Mem::printPlacement(char* buf, size_t len)
+{
+    char sram[9];
+    for (uint8_t bank = 0; bank < 8; bank++)
+        sram[bank] = ram[bank] == NULL ? '-' : inPSRAM(ram[bank]) ? 'p' : 'S';
+    sram[8] = 0;
+    if (placeSwaps)
+        snprintf(buf, len, "banks %s swaps %u last %u<->%u", sram, placeSwaps, lastHot, lastCold);
+    else
+        snprintf(buf, len, "banks %s swaps 0", sram);
+}
+
+#endif // MEM_PLACEMENT
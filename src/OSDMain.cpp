@@ -36,7 +36,14 @@
 #include "Wiimote2Keys.h"
 #include "Config.h"
 #include "FileSNA.h"
+#include "FileZ80.h"
+#include "FileSZX.h"
 #include "AySound.h"
+#include "PsgRecorder.h"
+#include "WavRecorder.h"
+#include "Tape.h"
+#include "Rewind.h"
+#include "Hibernate.h"
 
 #define MENU_REDRAW true
 #define MENU_UPDATE false
@@ -139,10 +146,61 @@ static void quickLoad()
     delay(200);
 }
 
+static void togglePsgRecording()
+{
+    if (PsgRecorder::isRecording()) {
+        PsgRecorder::stop();
+        OSD::osdCenteredMsg(OSD_PSG_REC_OFF, LEVEL_INFO);
+    }
+    else if (PsgRecorder::start())
+        OSD::osdCenteredMsg(OSD_PSG_REC_ON, LEVEL_INFO);
+    else
+        OSD::osdCenteredMsg(OSD_PSG_REC_ERR, LEVEL_WARN);
+    delay(400);
+}
+
+static void toggleWavRecording()
+{
+    if (WavRecorder::isRecording()) {
+        AySound::stopWavRecording();
+        OSD::osdCenteredMsg(OSD_WAV_REC_OFF, LEVEL_INFO);
+    }
+    else if (AySound::startWavRecording())
+        OSD::osdCenteredMsg(OSD_WAV_REC_ON, LEVEL_INFO);
+    else
+        OSD::osdCenteredMsg(OSD_WAV_REC_ERR, LEVEL_WARN);
+    delay(400);
+}
+
+static void toggleTapePlay()
+{
+    if (!Tape::isOpen())
+        OSD::osdCenteredMsg(OSD_TAPE_NONE, LEVEL_WARN);
+    else if (Tape::isPlaying()) {
+        Tape::stop();
+        OSD::osdCenteredMsg(OSD_TAPE_STOP, LEVEL_INFO);
+    }
+    else {
+        Tape::play();
+        OSD::osdCenteredMsg(OSD_TAPE_PLAY, LEVEL_INFO);
+    }
+    delay(400);
+}
+
 static void persistSave()
 {
+    if (FileZ80::isSaving()) {
+        OSD::osdCenteredMsg(OSD_PSNA_BUSY, LEVEL_WARN);
+        delay(1000);
+        return;
+    }
+    // written in background, completion is shown by persistPoll()
+    if (FileZ80::saveAsync(DISK_PZ80_FILE)) {
+        OSD::notice(OSD_PSNA_SAVING, NOTICE_KEEP);
+        return;
+    }
     OSD::osdCenteredMsg(OSD_PSNA_SAVING, LEVEL_INFO);
-    if (!FileSNA::save(DISK_PSNA_FILE)) {    
+    if (!FileZ80::save(DISK_PZ80_FILE)) {
         OSD::osdCenteredMsg(OSD_PSNA_SAVE_ERR, LEVEL_WARN);
         delay(1000);
         return;
@@ -151,20 +209,50 @@ static void persistSave()
     delay(400);
 }
 
+static void persistPoll()
+{
+    uint8_t status = FileZ80::asyncStatus();
+    if (status == FileZ80::ASYNC_DONE)
+        OSD::notice(OSD_PSNA_SAVED, NOTICE_FRAMES);
+    else if (status == FileZ80::ASYNC_FAILED)
+        OSD::notice(OSD_PSNA_SAVE_ERR, NOTICE_FRAMES);
+}
+
+// a save in progress replaces the file when done; the writer task
+// takes the SD lock, so call this before taking it
+static void persistWait()
+{
+    while (FileZ80::isSaving())
+        delay(10);
+    persistPoll();
+}
+
 static void persistLoad()
 {
-    if (!FileSNA::isPersistAvailable()) {
+    persistWait();
+
+    SD_LOCK;
+    bool z80 = FileZ80::isPersistAvailable();
+    if (!z80 && !FileSNA::isPersistAvailable()) {
         OSD::osdCenteredMsg(OSD_PSNA_NOT_AVAIL, LEVEL_INFO);
         Serial.println("No Persist");
+        SD_UNLOCK;
         delay(1000);
         return;
     }
     OSD::osdCenteredMsg(OSD_PSNA_LOADING, LEVEL_INFO);
-    FileSNA::load(DISK_PSNA_FILE);
+    // persist snapshots older than .z80 saving are still loaded
+    if (z80) {
+        ESPectrum::reset();
+        FileZ80::load(DISK_PZ80_FILE);
+    }
+    else
+        FileSNA::load(DISK_PSNA_FILE);
     // if (!FileSNA::load(DISK_PSNA_FILE)) {
     //     osdCenteredMsg(OSD_PSNA_LOAD_ERR, LEVEL_WARN);
     //     delay(1000);
     // }
+    SD_UNLOCK;
     if (Config::getArch() == "48K") AySound::reset();
     OSD::osdCenteredMsg(OSD_PSNA_LOADED, LEVEL_INFO);
     delay(400);
@@ -175,6 +263,7 @@ void OSD::do_OSD() {
     VGA& vga = ESPectrum::vga;
     static byte last_sna_row = 0;
     static unsigned int last_demo_ts = millis() / 1000;
+    persistPoll();
     if (PS2Keyboard::checkAndCleanKey(KEY_PAUSE)) {
         AySound::disable();
         osdCenteredMsg(OSD_PAUSE, LEVEL_INFO);
@@ -203,8 +292,29 @@ void OSD::do_OSD() {
         persistLoad();
         AySound::enable();
     }
+    else if (PS2Keyboard::checkAndCleanKey(KEY_F6)) {
+        statsToggle();
+    }
+    else if (PS2Keyboard::checkAndCleanKey(KEY_F7)) {
+        togglePsgRecording();
+    }
+    else if (PS2Keyboard::checkAndCleanKey(KEY_F8)) {
+        toggleWavRecording();
+    }
+    else if (PS2Keyboard::checkAndCleanKey(KEY_F9)) {
+        toggleTapePlay();
+    }
+    else if (PS2Keyboard::checkAndCleanKey(KEY_F11)) {
+        if (Rewind::stepBack())
+            OSD::notice(OSD_REWIND, NOTICE_FRAMES / 2);
+        else
+            OSD::notice(OSD_REWIND_NONE, NOTICE_FRAMES);
+    }
     else if (PS2Keyboard::checkAndCleanKey(KEY_F1)) {
         AySound::disable();
+        // menu options may access SD card at any point
+        persistWait();
+        SD_LOCK;
 
         // Main menu
         byte opt = menuRun((String)MENU_MAIN);
@@ -214,9 +324,10 @@ void OSD::do_OSD() {
             bool flagDirectory=true;
             while (flagDirectory)
             {
-                unsigned short snanum = menuRun(Config::sna_name_list);
+                menuPreview((String)DISK_SNA_DIR + currentPath);
+                unsigned short snanum = menuRunDir(MENU_SNA_TITLE, (String)DISK_SNA_DIR + currentPath, currentPath != "");
                 if (snanum > 0) {
-                    flagDirectory=changeSnapshot(rowGet(Config::sna_file_list, snanum));
+                    flagDirectory=changeSnapshot(menuRowGet(snanum));
                 } else flagDirectory=false;
             }
         }
@@ -225,11 +336,11 @@ void OSD::do_OSD() {
             String arch_menu = getArchMenu();
             byte arch_num = menuRun(arch_menu);
             if (arch_num > 0) {
-                String romset_menu = getRomsetMenu(rowGet(arch_menu, arch_num));
+                String arch = menuRowGet(arch_num);
+                String romset_menu = getRomsetMenu(arch);
                 byte romset_num = menuRun(romset_menu);
                 if (romset_num > 0) {
-                    String arch = rowGet(arch_menu, arch_num);
-                    String romSet = rowGet(romset_menu, romset_num);
+                    String romSet = menuRowGet(romset_num);
                     Config::requestMachine(arch, romSet, true);
                     vTaskDelay(2);
 
@@ -240,10 +351,19 @@ void OSD::do_OSD() {
             }
         }
         else if (opt == 3) {
-            quickSave();
+            // F2 saves to the chosen slot from then on
+            byte slot = menuRun(getQuickSlotMenu(MENU_QSNA_SAVE));
+            if (slot > 0) {
+                FileSNA::setQuickSlot(slot - 1);
+                quickSave();
+            }
         }
         else if (opt == 4) {
-            quickLoad();
+            byte slot = menuRun(getQuickSlotMenu(MENU_QSNA_LOAD));
+            if (slot > 0) {
+                FileSNA::setQuickSlot(slot - 1);
+                quickLoad();
+            }
         }
         else if (opt == 5) {
             persistSave();
@@ -271,6 +391,15 @@ void OSD::do_OSD() {
                 // ESP host reset
                 ESP.restart();
             }
+            else if (opt2 == 4) {
+                // resumed at next boot
+                osdCenteredMsg(OSD_HIBERNATING, LEVEL_INFO);
+                if (Hibernate::save())
+                    osdCenteredMsg(OSD_HIBERNATED, LEVEL_INFO);
+                else
+                    osdCenteredMsg(OSD_HIBERNATE_ERR, LEVEL_WARN);
+                delay(1000);
+            }
         }
         else if (opt == 8) {
             // Help
@@ -286,6 +415,7 @@ void OSD::do_OSD() {
             }
         }
         
+        SD_UNLOCK;
         AySound::enable();
         // Exit
     }
@@ -365,83 +495,6 @@ void OSD::osdCenteredMsg(String msg, byte warn_level) {
     vga.print(msg.c_str());
 }
 
-// Count NL chars inside a string, useful to count menu rows
-unsigned short OSD::rowCount(String menu) {
-    unsigned short count = 0;
-    for (unsigned short i = 1; i < menu.length(); i++) {
-        if (menu.charAt(i) == ASCII_NL) {
-            count++;
-        }
-    }
-    return count;
-}
-
-// Count NL chars inside a string, useful to count menu rows
-unsigned short OSD::rowCount(char * charmenu) {
-    unsigned short count = 0;
-    for (unsigned short i = 1; i < strlen(charmenu); i++) {
-        if (charmenu[i] == ASCII_NL) {
-            count++;
-        }
-    }
-    return count;
-}
-
-// Get a row text
-//String OSD::rowGet(String menu, unsigned short row) {
-String OSD::rowGet(String menu, unsigned short row) {
-    unsigned short count = 0;
-    unsigned short last = 0;
-#ifdef XDEBUG
-        Serial.println("Called rowGet (String version)");
-        Serial.printf("Row Entry: %d, Menu length in bytes: %d\n", row,menu.length());
-#endif
-    for (unsigned short i = 0; i < menu.length(); i++) {
-        if (menu.charAt(i) == ASCII_NL) {
-            if (count == row) {
-                return menu.substring(last, i);
-            }
-            count++;
-            last = i + 1;
-        }
-    }
-    return "MENU ERROR! (Unknown row?)";
-}
-
-String OSD::rowGet(char * menu, unsigned short row) {
-    unsigned short count = 0;
-    unsigned short last = 0;
-    String stemp;
-#ifdef XDEBUG
-        Serial.println("Called rowGet (char version)");
-        Serial.printf("Row Entry: %d, Menu length in bytes: %d\n", row,strlen(menu));
-#endif
-    for (unsigned short i = 0; i < strlen(menu); i++) {
-        if (menu[i] == ASCII_NL) {
-            if (count == row) {
-#ifdef XDEBUG
-                Serial.printf("About to allocate %d bytes for temp menu storage (heap report %d bytes free)\n",(i-last)+1,ESP.getFreeHeap());
-#endif
-                char * temp=(char*)malloc((i-last)+1);
-                if (temp)
-                {
-                    strncpy(temp,&menu[last], i-last);
-                    temp[i-last]=0;
-                    stemp=(String)temp;
-                    free(temp);
-                } else Serial.println("Memory allocation failed!");
-#ifdef XDEBUG
-                Serial.printf("Returning String %s\n",stemp.c_str());
-#endif                
-                return stemp;
-            }
-            count++;
-            last = i + 1;
-        }
-    }
-    return "MENU ERROR! (Unknown row?)";
-}
-
 #include "FileSNA.h"
 #include "FileZ80.h"
 
@@ -484,37 +537,8 @@ bool OSD::changeSnapshot(String filename)
 
     if (flagDirectory)
     {
-        KB_INT_STOP;        
-        //Config::sna_file_list = (String)MENU_SNA_TITLE + "\n";
-
+        // the next menuRunDir reads the new directory
         osdCenteredMsg((String)"Reading Directory",LEVEL_INFO);
-
-        strcpy(Config::sna_file_list,MENU_SNA_TITLE);
-        strcat(Config::sna_file_list,"\n");
-        strcat(Config::sna_file_list,FileUtils::getSortedSnaFileList(DISK_SNA_DIR+currentPath));
-        //Config::sna_file_list.concat(FileUtils::getSortedSnaFileList(DISK_SNA_DIR+currentPath));
-#ifdef XDEBUG        
-        Serial.println(Config::sna_file_list);        
-#endif
-#ifdef XDEBUG        
-        Serial.printf("Obtained file list - free mem: %d\n", ESP.getFreeHeap());
-        Serial.printf("Size of file list : %d\n", strlen(Config::sna_file_list));
-#endif        
-        strcpy(Config::sna_name_list,Config::sna_file_list);
-#ifdef XDEBUG        
-        Serial.printf("Created name list - free mem: %d\n", ESP.getFreeHeap());
-        Serial.printf("Size of name list : %d\n", strlen(Config::sna_name_list));
-#endif
-        /*Config::sna_name_list.replace(".SNA", "");
-        Config::sna_name_list.replace(".sna", "");
-        Config::sna_name_list.replace(".Z80", "");
-        Config::sna_name_list.replace(".z80", "");
-        Config::sna_name_list.replace("_", " ");
-        Config::sna_name_list.replace("-", " ");*/
-        KB_INT_START;
-#ifdef XDEBUG
-        //Serial.printf("Formatted name list - size is %d bytes",Config::sna_name_list.length());
-#endif
         return true;
     }
     if (FileUtils::hasSNAextension(filename))
@@ -531,6 +555,25 @@ bool OSD::changeSnapshot(String filename)
         Serial.printf("Loading Z80: %s\n", filename.c_str());
         FileZ80::load((String)DISK_SNA_DIR + currentPath + "/" + filename);
     }
+    else if (FileUtils::hasSZXextension(filename))
+    {
+        osdCenteredMsg((String)MSG_LOADING_SZX + ": " + filename, LEVEL_INFO);
+        ESPectrum::reset();
+        Serial.printf("Loading SZX: %s\n", filename.c_str());
+        FileSZX::load((String)DISK_SNA_DIR + currentPath + "/" + filename);
+    }
+    else if (FileUtils::hasTAPextension(filename) || FileUtils::hasTZXextension(filename) ||
+             FileUtils::hasCSWextension(filename) || FileUtils::hasWAVextension(filename))
+    {
+        osdCenteredMsg((String)MSG_LOADING_TAP + ": " + filename, LEVEL_INFO);
+        ESPectrum::reset();
+        Serial.printf("Inserting tape: %s\n", filename.c_str());
+        if (Tape::open((String)DISK_SNA_DIR + currentPath + "/" + filename))
+            osdCenteredMsg(MSG_TAP_INSERTED, LEVEL_INFO);
+        else
+            osdCenteredMsg(ERR_READ_FILE, LEVEL_WARN);
+        delay(400);
+    }
     osdCenteredMsg(MSG_SAVE_CONFIG, LEVEL_WARN);
     if (currentPath.length()>0) Config::ram_file = currentPath + "/" + filename; else Config::ram_file = filename;
     Config::save();
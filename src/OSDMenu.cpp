@@ -33,6 +33,8 @@
 #include "messages.h"
 #include "osd.h"
 #include "Wiimote2Keys.h"
+#include "FileSNA.h"
+#include "DirIndex.h"
 #include <math.h>
 
 #define MENU_MAX_ROWS 23
@@ -53,13 +55,32 @@ static byte w;                        // Width in pixels
 static byte h;                        // Height in pixels
 static byte x;                        // X vertical position
 static byte y;                        // Y horizontal position
-static String menu;                   // Menu string
 static unsigned short begin_row;      // First real displayed row
 static byte focus;                    // Focused virtual row
 static byte last_focus;               // To check for changes
 static unsigned short last_begin_row; // To check for changes
-char * charmenu=NULL;
-static bool char_menu;                // flag to indentify where menu is String or Char based
+
+// Menu rows: text rows (title and options) from a private copy of the
+// menu string, NL replaced by NUL and each row found thru an offset
+// array; then, for directory menus, rows from DirIndex. Rows are only
+// fetched when drawn, so navigation costs the same for any row count.
+#define MENU_PSRAM_MIN 4096           // bigger text menus go to PSRAM
+static char* menu_text = NULL;
+static uint32_t* menu_offsets = NULL;
+static unsigned short text_rows;      // rows in menu_text
+static bool dir_menu;                 // rows after the text ones from DirIndex
+static bool dir_up;                   // first directory row is ".."
+
+// snapshot preview, see menuPreview
+#define PREVIEW_GAP 4
+#define PREVIEW_DELAY_MS 150          // focus still for this long to read the file
+static bool preview_request = false;
+static bool menu_preview = false;     // current menu has a preview
+static String preview_dir;
+static unsigned short preview_x;
+static unsigned short preview_row;    // real row shown or pending
+static bool preview_pending;
+static uint32_t preview_moved;
 
 #define NUM_SPECTRUM_COLORS 16
 
@@ -73,73 +94,106 @@ uint16_t OSD::zxColor(uint8_t color, uint8_t bright) {
     return spectrum_colors[color];
 }
 
+static void* menuAlloc(size_t size) {
+#ifdef BOARD_HAS_PSRAM
+    if (size >= MENU_PSRAM_MIN)
+        return ps_malloc(size);
+#endif
+    return malloc(size);
+}
+
+// copy menu text and index its rows
+static void menuSetText(const char* text, size_t len) {
+    free(menu_text);
+    free(menu_offsets);
+    menu_text = NULL;
+    menu_offsets = NULL;
+    text_rows = 0;
+    dir_menu = false;
+
+    unsigned short rows = 0;
+    for (size_t i = 0; i < len; i++)
+        if (text[i] == ASCII_NL) rows++;
+
+    menu_text = (char*)menuAlloc(len + 1);
+    menu_offsets = (uint32_t*)menuAlloc((rows + 1) * sizeof(uint32_t));
+    if (menu_text == NULL || menu_offsets == NULL) {
+        Serial.println("newMenu: failed to allocate memory");
+        return;
+    }
+    uint32_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == ASCII_NL) {
+            menu_text[i] = 0;
+            menu_offsets[text_rows++] = start;
+            start = i + 1;
+        }
+        else
+            menu_text[i] = text[i];
+    }
+    menu_text[len] = 0;
+}
+
+// text of a menu row, 0 is the title
+static const char* menuRowText(unsigned short row) {
+    if (row < text_rows)
+        return menu_text + menu_offsets[row];
+    if (!dir_menu)
+        return "";
+    row -= text_rows;
+    if (dir_up) {
+        if (row == 0)
+            return "..";
+        row--;
+    }
+    return row < DirIndex::count() ? DirIndex::name(row) : "";
+}
+
+String OSD::menuRowGet(unsigned short row) {
+    return menuRowText(row);
+}
+
 // Set menu and force recalc
 void OSD::newMenu(String new_menu) {
-    menu = new_menu;
-    char_menu=false;
+    menuSetText(new_menu.c_str(), new_menu.length());
     menuRecalc();
     menuDraw();
 }
 
 void OSD::newMenu(char * new_menu) {    
-    if (charmenu) free(charmenu);
-#ifdef XDEBUG
-    Serial.println("newMenu (char version)");
-    Serial.printf("Free heap: %d\n", ESP.getFreeHeap());
-#endif
-    //if (charmenu) free(charmenu);
-    //charmenu=(char*)realloc(charmenu,strlen(new_menu));
-    charmenu=(char*)malloc(strlen(new_menu)+1);
-    if (menu) {
-        strcpy(charmenu,new_menu);
-        char_menu=true;
-#ifdef XDEBUG
-    Serial.println(charmenu);    
-    Serial.printf("Free heap: %d\n", ESP.getFreeHeap());
-#endif
-    } else {
-        Serial.println("newMenu: failed to allocate memory");
-        vTaskDelay(50);
-    }
+    menuSetText(new_menu, strlen(new_menu));
     menuRecalc();
     menuDraw();
 }
 
 void OSD::menuRecalc() {
+    // Rows
+    real_rows = text_rows;
+    if (dir_menu)
+        real_rows += (dir_up ? 1 : 0) + DirIndex::count();
+
     // Columns
     cols = 24;
-    byte col_count = 0;
-    if (char_menu)
-    {
-        for (unsigned short i = 0; i < strlen(charmenu); i++) {
-            if (charmenu[i] == ASCII_NL) {
-                if (col_count > cols) {
-                    cols = col_count;
-            }   
-                col_count = 0;
-            }
-            col_count++;
-        }   
-        cols = (cols > osdMaxCols() ? osdMaxCols() : cols);
-    }
-    else
-    {
-        for (unsigned short i = 0; i < menu.length(); i++) {
-            if (menu.charAt(i) == ASCII_NL) {
-                if (col_count > cols) {
-                    cols = col_count;
-            }   
-                col_count = 0;
-            }
-            col_count++;
-        }   
-        cols = (cols > osdMaxCols() ? osdMaxCols() : cols);
+    for (unsigned short row = 0; row < real_rows; row++) {
+        size_t len = strlen(menuRowText(row)) + 1;
+        if (len > cols) {
+            cols = len;
+            if (cols >= osdMaxCols())
+                break;
+        }
     }
-    // Rows
-    if (char_menu) real_rows = rowCount(charmenu); else real_rows = rowCount(menu);
+    cols = (cols > osdMaxCols() ? osdMaxCols() : cols);
+
     virtual_rows = (real_rows > MENU_MAX_ROWS ? MENU_MAX_ROWS : real_rows);
     begin_row = last_begin_row = last_focus = focus = 1;
 
+    // leave room for the preview
+    if (menu_preview) {
+        byte preview_cols = (scrAlignCenterX(PREVIEW_W + PREVIEW_GAP) * 2 - 2) / OSD_FONT_W;
+        if (cols > preview_cols)
+            cols = preview_cols;
+    }
+
     // Size
     w = (cols * OSD_FONT_W) + 2;
     h = (virtual_rows * OSD_FONT_H) + 2;
@@ -147,6 +201,12 @@ void OSD::menuRecalc() {
     // Position
     x = scrAlignCenterX(w);
     y = scrAlignCenterY(h);
+    if (menu_preview) {
+        x = scrAlignCenterX(w + PREVIEW_GAP + PREVIEW_W);
+        preview_x = x + w + PREVIEW_GAP;
+        preview_row = 0;
+        preview_pending = false;
+    }
 }
 
 // Get real row number for a virtual one
@@ -165,8 +225,8 @@ void OSD::menuAt(short int row, short int col) {
 void OSD::menuPrintRow(byte virtual_row_num, byte line_type) {
     VGA& vga = ESPectrum::vga;
     byte margin;
-    String line;
-    if (char_menu) line = rowGet(charmenu, menuRealRowFor(virtual_row_num)); else line = rowGet(menu, menuRealRowFor(virtual_row_num));
+    const char* line = menuRowText(virtual_row_num == 0 ? 0 : menuRealRowFor(virtual_row_num));
+    size_t len = strlen(line);
 
     switch (line_type) {
     case IS_TITLE:
@@ -184,12 +244,16 @@ void OSD::menuPrintRow(byte virtual_row_num, byte line_type) {
 
     menuAt(virtual_row_num, 0);
     vga.print(" ");
-    if (line.length() < cols - margin) {
-        vga.print(line.c_str());
-        for (byte i = line.length(); i < (cols - margin); i++)
+    if (len < cols - margin) {
+        vga.print(line);
+        for (byte i = len; i < (cols - margin); i++)
             vga.print(" ");
     } else {
-        vga.print(line.substring(0, cols - margin).c_str());
+        char clipped[64];
+        size_t n = cols - margin < sizeof(clipped) ? cols - margin : sizeof(clipped) - 1;
+        memcpy(clipped, line, n);
+        clipped[n] = 0;
+        vga.print(clipped);
     }
     vga.print(" ");
 }
@@ -225,7 +289,7 @@ void OSD::menuDraw() {
 
 String OSD::getArchMenu() {
     static char archlist[1024];
-    FileUtils::getFileEntriesFromDir(DISK_ROM_DIR,archlist);
+    FileUtils::getFileEntriesFromDir(DISK_ROM_DIR, archlist, sizeof(archlist));
     String menu = (String)MENU_ARCH + (String)archlist;
 #ifdef XDEBUG
     Serial.println("getArchMenu");
@@ -236,7 +300,7 @@ String OSD::getArchMenu() {
 
 String OSD::getRomsetMenu(String arch) {
     static char archlist[1024];
-    FileUtils::getFileEntriesFromDir((String)DISK_ROM_DIR + "/" + arch,archlist);
+    FileUtils::getFileEntriesFromDir((String)DISK_ROM_DIR + "/" + arch, archlist, sizeof(archlist));
     String menu = (String)MENU_ROMSET + (String)archlist;
 #ifdef XDEBUG
     Serial.println("getRomsetMenu");
@@ -245,33 +309,56 @@ String OSD::getRomsetMenu(String arch) {
     return menu;
 }
 
-// Run a new menu
-unsigned short OSD::menuRun(String new_menu) {
-    #ifdef XDEBUG
-        Serial.println("Called menuRun (String version)");
-        Serial.printf("Menu length in bytes: %d\n", new_menu.length());
+void OSD::menuPreview(String dir) {
+#ifdef OSD_PREVIEW
+    preview_dir = dir;
+    preview_request = true;
 #endif
-    newMenu(new_menu);
+}
+
+// draw the preview once the focus has stayed on a row for a while
+static void menuPreviewUpdate() {
+#ifdef OSD_PREVIEW
+    unsigned short row = OSD::menuRealRowFor(focus);
+    if (row != preview_row) {
+        preview_row = row;
+        preview_moved = millis();
+        preview_pending = true;
+    }
+    else if (preview_pending && millis() - preview_moved >= PREVIEW_DELAY_MS) {
+        preview_pending = false;
+        // directory index has the size, saves opening the file
+        uint32_t size = 0;
+        unsigned short entry = row - text_rows - (dir_up ? 1 : 0);
+        if (dir_menu && row >= text_rows + (dir_up ? 1 : 0))
+            size = DirIndex::size(entry);
+        OSD::previewDraw(preview_dir + "/" + menuRowText(row), size, preview_x, y);
+    }
+#endif
+}
+
+// Navigate the current menu until a row is chosen (0: none)
+static unsigned short menuLoop() {
     while (1) {
         updateWiimote2KeysOSD();
         if (PS2Keyboard::checkAndCleanKey(KEY_CURSOR_UP)) {
             if (focus == 1 and begin_row > 1) {
-                menuScroll(DOWN);
+                OSD::menuScroll(DOWN);
             } else if (focus > 1) {
                 focus--;
-                menuPrintRow(focus, IS_FOCUSED);
+                OSD::menuPrintRow(focus, IS_FOCUSED);
                 if (focus + 1 < virtual_rows) {
-                    menuPrintRow(focus + 1, IS_NORMAL);
+                    OSD::menuPrintRow(focus + 1, IS_NORMAL);
                 }
             }
         } else if (PS2Keyboard::checkAndCleanKey(KEY_CURSOR_DOWN)) {
             if (focus == virtual_rows - 1) {
-                menuScroll(UP);
+                OSD::menuScroll(UP);
             } else if (focus < virtual_rows - 1) {
                 focus++;
-                menuPrintRow(focus, IS_FOCUSED);
+                OSD::menuPrintRow(focus, IS_FOCUSED);
                 if (focus - 1 > 0) {
-                    menuPrintRow(focus - 1, IS_NORMAL);
+                    OSD::menuPrintRow(focus - 1, IS_NORMAL);
                 }
             }
         } else if (PS2Keyboard::checkAndCleanKey(KEY_PAGE_UP)) {
@@ -282,7 +369,7 @@ unsigned short OSD::menuRun(String new_menu) {
                 focus = 1;
                 begin_row = 1;
             }
-            menuRedraw();
+            OSD::menuRedraw();
         } else if (PS2Keyboard::checkAndCleanKey(KEY_PAGE_DOWN)) {
             if (real_rows - begin_row  - virtual_rows > virtual_rows) {
                 focus = 1;
@@ -291,84 +378,65 @@ unsigned short OSD::menuRun(String new_menu) {
                 focus = virtual_rows - 1;
                 begin_row = real_rows - virtual_rows + 1;
             }
-            menuRedraw();
+            OSD::menuRedraw();
         } else if (PS2Keyboard::checkAndCleanKey(KEY_HOME)) {
             focus = 1;
             begin_row = 1;
-            menuRedraw();
+            OSD::menuRedraw();
         } else if (PS2Keyboard::checkAndCleanKey(KEY_END)) {
             focus = virtual_rows - 1;
             begin_row = real_rows - virtual_rows + 1;
-            menuRedraw();
+            OSD::menuRedraw();
         } else if (PS2Keyboard::checkAndCleanKey(KEY_ENTER)) {
-            return menuRealRowFor(focus);
+            return OSD::menuRealRowFor(focus);
         } else if (PS2Keyboard::checkAndCleanKey(KEY_ESC) || PS2Keyboard::checkAndCleanKey(KEY_F1)) {
             return 0;
         }
+        if (menu_preview)
+            menuPreviewUpdate();
     }
 }
 
+// Run a new menu
+unsigned short OSD::menuRun(String new_menu) {
+#ifdef XDEBUG
+        Serial.println("Called menuRun (String version)");
+        Serial.printf("Menu length in bytes: %d\n", new_menu.length());
+#endif
+    menu_preview = preview_request;
+    preview_request = false;
+    newMenu(new_menu);
+    return menuLoop();
+}
+
 // Run a new menu
 unsigned short OSD::menuRun(char * new_menu) {
 #ifdef XDEBUG
         Serial.println("Called menuRun (char version)");
         Serial.printf("Menu length in bytes: %d\n", strlen(new_menu));
 #endif
+    menu_preview = preview_request;
+    preview_request = false;
     newMenu(new_menu);
-    while (1) {
-        updateWiimote2KeysOSD();
-        if (PS2Keyboard::checkAndCleanKey(KEY_CURSOR_UP)) {
-            if (focus == 1 and begin_row > 1) {
-                menuScroll(DOWN);
-            } else if (focus > 1) {
-                focus--;
-                menuPrintRow(focus, IS_FOCUSED);
-                if (focus + 1 < virtual_rows) {
-                    menuPrintRow(focus + 1, IS_NORMAL);
-                }
-            }
-        } else if (PS2Keyboard::checkAndCleanKey(KEY_CURSOR_DOWN)) {
-            if (focus == virtual_rows - 1) {
-                menuScroll(UP);
-            } else if (focus < virtual_rows - 1) {
-                focus++;
-                menuPrintRow(focus, IS_FOCUSED);
-                if (focus - 1 > 0) {
-                    menuPrintRow(focus - 1, IS_NORMAL);
-                }
-            }
-        } else if (PS2Keyboard::checkAndCleanKey(KEY_PAGE_UP)) {
-            if (begin_row > virtual_rows) {
-                focus = 1;
-                begin_row -= virtual_rows;
-            } else {
-                focus = 1;
-                begin_row = 1;
-            }
-            menuRedraw();
-        } else if (PS2Keyboard::checkAndCleanKey(KEY_PAGE_DOWN)) {
-            if (real_rows - begin_row  - virtual_rows > virtual_rows) {
-                focus = 1;
-                begin_row += virtual_rows - 1;
-            } else {
-                focus = virtual_rows - 1;
-                begin_row = real_rows - virtual_rows + 1;
-            }
-            menuRedraw();
-        } else if (PS2Keyboard::checkAndCleanKey(KEY_HOME)) {
-            focus = 1;
-            begin_row = 1;
-            menuRedraw();
-        } else if (PS2Keyboard::checkAndCleanKey(KEY_END)) {
-            focus = virtual_rows - 1;
-            begin_row = real_rows - virtual_rows + 1;
-            menuRedraw();
-        } else if (PS2Keyboard::checkAndCleanKey(KEY_ENTER)) {
-            return menuRealRowFor(focus);
-        } else if (PS2Keyboard::checkAndCleanKey(KEY_ESC) || PS2Keyboard::checkAndCleanKey(KEY_F1)) {
-            return 0;
-        }
-    }
+    return menuLoop();
+}
+
+// Run a menu listing dir, rows read from its index as they are shown
+unsigned short OSD::menuRunDir(String title, String dir, bool parent) {
+    if (!DirIndex::load(dir))
+        errorHalt((String)ERR_DIR_OPEN + "\n" + dir);
+#ifdef XDEBUG
+    Serial.printf("Called menuRunDir, %u entries\n", DirIndex::count());
+#endif
+    menu_preview = preview_request;
+    preview_request = false;
+    String text = title + "\n";
+    menuSetText(text.c_str(), text.length());
+    dir_menu = true;
+    dir_up = parent;
+    menuRecalc();
+    menuDraw();
+    return menuLoop();
 }
 
 // Scroll
@@ -444,6 +512,18 @@ void OSD::menuScrollBar() {
     }
 }
 
+// Quick save slots, used ones marked
+String OSD::getQuickSlotMenu(String title) {
+    String menu = title;
+    for (uint8_t slot = 0; slot < QUICK_SLOTS; slot++) {
+        menu += (String)MENU_QSNA_SLOT + (String)(slot + 1);
+        if (FileSNA::isQuickAvailable(slot))
+            menu += " *";
+        menu += "\n";
+    }
+    return menu;
+}
+
 // Return a test menu
 String OSD::getTestMenu(unsigned short n_lines) {
     String test_menu = "Test Menu\n";
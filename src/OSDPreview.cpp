@@ -0,0 +1,148 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "hardconfig.h"
+
+#ifdef OSD_PREVIEW
+
+#include "osd.h"
+#include "ESPectrum.h"
+#include "FileUtils.h"
+#include "FileSNA.h"
+#include "FileZ80.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Screens read, keyed by path hash and file size so a rewritten file is
+// read again
+
+#ifdef BOARD_HAS_PSRAM
+struct PreviewEntry {
+    uint32_t hash;
+    uint32_t size;
+    uint32_t lastUse;
+    uint8_t* screen;
+};
+
+static PreviewEntry cache[PREVIEW_CACHE];
+static uint32_t useClock = 0;
+
+// FNV-1a
+static uint32_t pathHash(const String& path)
+{
+    uint32_t h = 2166136261u;
+    for (unsigned int i = 0; i < path.length(); i++)
+        h = (h ^ (uint8_t)path.charAt(i)) * 16777619u;
+    return h;
+}
+#endif
+
+static bool loadScreen(const String& path, uint8_t* screen)
+{
+    if (FileUtils::hasSNAextension(path))
+        return FileSNA::loadScreen(path, screen);
+    if (FileUtils::hasZ80extension(path))
+        return FileZ80::loadScreen(path, screen);
+    return false;
+}
+
+// 2x2 pixel blocks, ink if 2 pixels or more are set
+static void drawScreen(const uint8_t* screen, unsigned short x, unsigned short y)
+{
+    VGA& vga = ESPectrum::vga;
+    for (uint8_t py = 0; py < 96; py++) {
+        uint8_t line = py * 2;
+        const uint8_t* bmp = screen + (((line & 0xC0) << 5) | ((line & 0x07) << 8) | ((line & 0x38) << 2));
+        const uint8_t* att = screen + 0x1800 + (line >> 3) * 32;
+        for (uint8_t px = 0; px < 128; px++) {
+            uint8_t col = px >> 2;
+            uint8_t shift = 6 - ((px & 3) << 1);
+            uint8_t bits = ((bmp[col] >> shift) & 3) | (((bmp[col + 0x100] >> shift) & 3) << 2);
+            uint8_t set = (bits & 1) + ((bits >> 1) & 1) + ((bits >> 2) & 1) + (bits >> 3);
+            uint8_t a = att[col];
+            uint8_t color = set >= 2 ? a & 0x07 : (a >> 3) & 0x07;
+            vga.dot(x + px, y + py, OSD::zxColor(color, (a >> 6) & 1));
+        }
+    }
+}
+
+void OSD::previewDraw(String path, uint32_t size, unsigned short x, unsigned short y)
+{
+    VGA& vga = ESPectrum::vga;
+    vga.rect(x, y, PREVIEW_W, PREVIEW_H, OSD::zxColor(0, 0));
+    x++;
+    y++;
+
+    if (!FileUtils::hasSNAextension(path) && !FileUtils::hasZ80extension(path)) {
+        vga.fillRect(x, y, PREVIEW_W - 2, PREVIEW_H - 2, OSD::zxColor(7, 0));
+        return;
+    }
+
+    if (size == 0)
+        size = FileUtils::fileSize(path);
+#ifdef BOARD_HAS_PSRAM
+    uint32_t hash = pathHash(path);
+    PreviewEntry* e = &cache[0];
+    for (uint8_t i = 0; i < PREVIEW_CACHE; i++) {
+        if (cache[i].screen != NULL && size > 0 && cache[i].hash == hash && cache[i].size == size) {
+            cache[i].lastUse = ++useClock;
+            drawScreen(cache[i].screen, x, y);
+            return;
+        }
+        if (cache[i].lastUse < e->lastUse)
+            e = &cache[i];
+    }
+
+    // least recently used (or never used) entry
+    if (e->screen == NULL)
+        e->screen = (uint8_t*)ps_malloc(ZX_SCREEN_SIZE);
+    uint8_t* screen = e->screen;
+    e->size = 0;        // invalid until read
+    e->lastUse = 0;
+#else
+    uint8_t* screen = (uint8_t*)malloc(ZX_SCREEN_SIZE);
+#endif
+
+    if (screen != NULL && size > 0 && loadScreen(path, screen)) {
+        drawScreen(screen, x, y);
+#ifdef BOARD_HAS_PSRAM
+        e->hash = hash;
+        e->size = size;
+        e->lastUse = ++useClock;
+#endif
+    }
+    else
+        vga.fillRect(x, y, PREVIEW_W - 2, PREVIEW_H - 2, OSD::zxColor(7, 0));
+
+#ifndef BOARD_HAS_PSRAM
+    free(screen);
+#endif
+}
+
+#endif // OSD_PREVIEW
@@ -0,0 +1,132 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "osd.h"
+#include "ESPectrum.h"
+#include "CPU.h"
+#include "AySound.h"
+
+#define STATS_X 2
+#define STATS_Y 2
+#define STATS_COLS 24
+#define STATS_ROWS 7
+#define STATS_REFRESH_FRAMES 25
+
+extern Font Font6x8;
+
+bool OSD::statsVisible = false;
+uint32_t OSD::statsCpuMicros = 0;
+
+// text is composed on core 1 and drawn on core 0, so keep two copies
+// and let the video task always read the last complete one
+static char statsText[2][STATS_COLS * STATS_ROWS + 1];
+static volatile uint8_t statsFront = 0;
+
+void OSD::statsToggle()
+{
+    statsVisible = !statsVisible;
+    if (statsVisible)
+        statsUpdate(true);
+}
+
+// called once per frame from the emulation loop
+void OSD::statsUpdate(bool force)
+{
+    static int ctr = 0;
+    if (!statsVisible)
+        return;
+    if (!force && ++ctr < STATS_REFRESH_FRAMES)
+        return;
+    ctr = 0;
+
+    uint8_t back = statsFront ^ 1;
+    char* buf = statsText[back];
+    int n = snprintf(buf, sizeof(statsText[0]), "cpu %u/%uus %u%%\n", statsCpuMicros, CPU::microsPerFrame(),
+        ESPectrum::speedPercent);
+    AySound::printStats(buf + n, sizeof(statsText[0]) - n);
+    statsFront = back;
+}
+
+// called from the video task after the frame has been rendered
+void OSD::statsDraw()
+{
+    if (!statsVisible)
+        return;
+    VGA& vga = ESPectrum::vga;
+    vga.fillRect(STATS_X, STATS_Y, STATS_COLS * OSD_FONT_W + 2, STATS_ROWS * OSD_FONT_H + 2, OSD::zxColor(0, 0));
+    vga.setTextColor(OSD::zxColor(4, 1), OSD::zxColor(0, 0));
+    vga.setFont(Font6x8);
+    vga.setCursor(STATS_X + 1, STATS_Y + 1);
+    vga.print(statsText[statsFront]);
+}
+
+static const char* volatile noticeText = NULL;
+static volatile uint16_t noticeFrames = 0;
+
+void OSD::notice(const char* text, uint16_t frames)
+{
+    noticeFrames = frames;
+    noticeText = text;
+}
+
+// called from the video task after the frame has been rendered
+void OSD::noticeDraw()
+{
+    const char* text = noticeText;
+    if (text == NULL)
+        return;
+    if (noticeFrames != NOTICE_KEEP && noticeFrames-- == 0) {
+        noticeText = NULL;
+        return;
+    }
+    VGA& vga = ESPectrum::vga;
+    int y = vga.yres - OSD_FONT_H - 4;
+    vga.fillRect(STATS_X, y, strlen(text) * OSD_FONT_W + 2, OSD_FONT_H + 2, OSD::zxColor(0, 0));
+    vga.setTextColor(OSD::zxColor(7, 1), OSD::zxColor(0, 0));
+    vga.setFont(Font6x8);
+    vga.setCursor(STATS_X + 1, y + 1);
+    vga.print(text);
+}
+
+// turbo mode indicator with speed multiplier, top right corner
+void OSD::turboDraw()
+{
+    if (!ESPectrum::turbo)
+        return;
+    char buf[12];
+    uint16_t speed = ESPectrum::speedPercent;
+    snprintf(buf, sizeof(buf), "TURBO x%u.%u", speed / 100, (speed % 100) / 10);
+    VGA& vga = ESPectrum::vga;
+    int x = vga.xres - 2 - strlen(buf) * OSD_FONT_W;
+    vga.fillRect(x - 1, STATS_Y, strlen(buf) * OSD_FONT_W + 2, OSD_FONT_H + 2, OSD::zxColor(0, 0));
+    vga.setTextColor(OSD::zxColor(6, 1), OSD::zxColor(0, 0));
+    vga.setFont(Font6x8);
+    vga.setCursor(x, STATS_Y + 1);
+    vga.print(buf);
+}
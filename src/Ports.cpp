@@ -33,6 +33,8 @@
 #include "PS2Kbd.h"
 #include "AySound.h"
 #include "ESPectrum.h"
+#include "CPU.h"
+#include "Tape.h"
 
 #include <Arduino.h>
 
@@ -118,6 +120,10 @@ uint8_t Ports::input(uint8_t portLow, uint8_t portHigh)
         }
         #endif
 
+        // virtual tape
+        if (Tape::isPlaying())
+            bitWrite(result, 6, Tape::ear(CPU::tstates));
+
         // Keyboard
         if (~(portHigh | 0xFE)&0xFF) result &= (base[0] & wii[0]);
         if (~(portHigh | 0xFD)&0xFF) result &= (base[1] & wii[1]);
@@ -180,7 +186,9 @@ void Ports::output(uint8_t portLow, uint8_t portHigh, uint8_t data) {
     {
         ESPectrum::borderColor = data & 0x07;
 
-        #ifdef SPEAKER_PRESENT
+        #ifdef AUDIO_BLEP_MIXER
+        AySound::setBeeper(bitRead(data, 4));
+        #elif defined(SPEAKER_PRESENT)
         digitalWrite(SPEAKER_PIN, bitRead(data, 4)); // speaker
         #endif
 
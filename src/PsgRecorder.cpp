@@ -0,0 +1,111 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "PsgRecorder.h"
+#include "AsyncWriter.h"
+#include "FileUtils.h"
+
+#define PSG_HEADER_SIZE 16
+#define PSG_END_OF_FRAME 0xFF
+
+// staging area for the current frame; flushed earlier if it fills up
+// (sample playback may write thousands of values per frame)
+#define PSG_STAGE_SIZE 512
+
+static AsyncWriter writer("psgWriter", 16384, 4096);
+static uint8_t stage[PSG_STAGE_SIZE];
+static int stageLen = 0;
+
+bool PsgRecorder::recording = false;
+String PsgRecorder::path;
+uint32_t PsgRecorder::frameCount = 0;
+
+bool PsgRecorder::start()
+{
+    if (recording)
+        return true;
+
+    FileUtils::ensureDir(DISK_REC_DIR);
+    path = FileUtils::nextFileName(DISK_REC_DIR, "ay", "psg");
+    if (!writer.open(path.c_str()))
+        return false;
+
+    uint8_t header[PSG_HEADER_SIZE] = { 'P', 'S', 'G', 0x1A };
+    writer.write(header, sizeof(header));
+
+    stageLen = 0;
+    frameCount = 0;
+    recording = true;
+    Serial.printf("PSG recording to %s\n", path.c_str());
+    return true;
+}
+
+void PsgRecorder::stop()
+{
+    if (!recording)
+        return;
+    recording = false;
+    flush();
+    bool ok = writer.close();
+    Serial.printf("PSG recording stopped: %u frames, %u bytes, %u dropped%s\n",
+        frameCount, writer.written(), writer.dropped(), ok ? "" : ", WRITE ERROR");
+}
+
+uint32_t PsgRecorder::dropped()
+{
+    return writer.dropped();
+}
+
+void PsgRecorder::flush()
+{
+    if (stageLen > 0) {
+        writer.write(stage, stageLen);
+        stageLen = 0;
+    }
+}
+
+void PsgRecorder::record(uint8_t reg, uint8_t data)
+{
+    // only the 14 sound registers; I/O ports and invalid numbers are skipped
+    if (reg > 13)
+        return;
+    if (stageLen + 2 > PSG_STAGE_SIZE)
+        flush();
+    stage[stageLen++] = reg;
+    stage[stageLen++] = data;
+}
+
+void PsgRecorder::frame()
+{
+    if (stageLen + 1 > PSG_STAGE_SIZE)
+        flush();
+    stage[stageLen++] = PSG_END_OF_FRAME;
+    frameCount++;
+    flush();
+}
@@ -0,0 +1,297 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "hardconfig.h"
+
+#ifdef REWIND_BUFFER
+
+#include "Rewind.h"
+#include "Mem.h"
+#include "MachineState.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// The reference copy holds RAM as it was at the newest capture. A capture
+// stores, for each block flagged in Mem::dirty, the XOR of the block with
+// its reference, then updates the reference. Stepping back copies the
+// blocks written since then from the reference into RAM, and XORs the
+// newest capture into the reference, which is then the previous capture.
+//
+// Captures are written one after another into a byte ring in PSRAM,
+// wrapping to the start when the next one may not fit; the oldest ones
+// are dropped as they get overwritten.
+//
+// Capture layout: MachineState, block count (16 bit), then for each block
+// its number (bank * MEM_BLOCKS + block, 16 bit) and the delta, as tokens:
+// 0x00-0x7F n: skip n + 1 unchanged bytes,
+// 0x80-0xFF n: n - 0x7F bytes to XOR follow.
+
+#define BLOCK_SIZE (1 << MEM_BLOCK_SHIFT)
+#define NUM_BLOCKS (8 * MEM_BLOCKS)
+#define MAX_BLOCK_LEN (2 + BLOCK_SIZE + 2)
+#define MAX_CAPTURES 256
+
+static_assert(REWIND_BUFFER_SIZE >= sizeof(MachineState) + 2 + NUM_BLOCKS * MAX_BLOCK_LEN,
+    "REWIND_BUFFER_SIZE is too small for a capture of all RAM");
+
+struct Capture {
+    uint32_t offset;
+    uint32_t length;
+};
+
+static uint8_t* ring = NULL;
+static uint8_t* reference = NULL;
+static Capture captureList[MAX_CAPTURES];
+static uint16_t first = 0;
+static uint16_t count = 0;
+static uint16_t frames = 0;
+
+static uint32_t lastMicros = 0;
+static uint32_t maxMicros = 0;
+static uint32_t lastLength = 0;
+
+static inline Capture& capture(uint16_t n)
+{
+    return captureList[(first + n) % MAX_CAPTURES];
+}
+
+void Rewind::setup()
+{
+#ifdef BOARD_HAS_PSRAM
+    ring = (uint8_t*)ps_malloc(REWIND_BUFFER_SIZE);
+    reference = (uint8_t*)ps_malloc(8 * MEM_PG_SZ);
+#endif
+    if (ring == NULL || reference == NULL) {
+        Serial.println("Rewind: unable to allocate buffers, disabled");
+        free(ring);
+        free(reference);
+        ring = reference = NULL;
+        return;
+    }
+    reset();
+}
+
+void Rewind::reset()
+{
+    if (reference == NULL)
+        return;
+    for (uint8_t bank = 0; bank < 8; bank++) {
+        if (Mem::ram[bank] != NULL)
+            memcpy(reference + bank * MEM_PG_SZ, Mem::ram[bank], MEM_PG_SZ);
+    }
+    memset(Mem::dirty, 0, sizeof(Mem::dirty));
+    first = 0;
+    count = 0;
+    frames = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// XOR delta of a block against its reference; empty if unchanged
+static uint8_t* encodeBlock(const uint8_t* cur, const uint8_t* ref, uint8_t* out)
+{
+    uint8_t* start = out;
+    bool changed = false;
+    uint16_t i = 0;
+    while (i < BLOCK_SIZE) {
+        uint16_t n = 0;
+        while (i + n < BLOCK_SIZE && n < 128 && cur[i + n] == ref[i + n])
+            n++;
+        if (n > 0) {
+            *out++ = n - 1;
+            i += n;
+            continue;
+        }
+        // changed bytes, up to two unchanged ones in a row
+        uint16_t from = i;
+        while (i < BLOCK_SIZE && i - from < 128 &&
+               !(cur[i] == ref[i] && (i + 1 == BLOCK_SIZE || cur[i + 1] == ref[i + 1])))
+            i++;
+        *out++ = 0x80 | (i - from - 1);
+        for (uint16_t k = from; k < i; k++)
+            *out++ = cur[k] ^ ref[k];
+        changed = true;
+    }
+    return changed ? out : start;
+}
+
+// XOR a delta into dst; returns the end of the delta
+static const uint8_t* applyBlock(const uint8_t* in, uint8_t* dst)
+{
+    uint16_t i = 0;
+    while (i < BLOCK_SIZE) {
+        uint8_t t = *in++;
+        if (t & 0x80) {
+            for (uint8_t n = (t & 0x7F) + 1; n > 0; n--)
+                dst[i++] ^= *in++;
+        }
+        else
+            i += t + 1;
+    }
+    return in;
+}
+
+// start of a free area of len bytes, dropping the oldest captures in it
+static uint8_t* reserve(uint32_t len)
+{
+    uint32_t head = 0;
+    if (count > 0) {
+        Capture& newest = capture(count - 1);
+        head = newest.offset + newest.length;
+        if (head + len > REWIND_BUFFER_SIZE)
+            head = 0;
+    }
+    while (count > 0) {
+        bool overlap = count == MAX_CAPTURES;
+        for (uint16_t n = 0; n < count && !overlap; n++) {
+            Capture& c = capture(n);
+            overlap = c.offset < head + len && c.offset + c.length > head;
+        }
+        if (!overlap)
+            break;
+        first = (first + 1) % MAX_CAPTURES;
+        count--;
+    }
+    capture(count).offset = head;
+    return ring + head;
+}
+
+static void takeCapture()
+{
+    uint32_t start = micros();
+
+    uint16_t dirtyCount = 0;
+    for (uint16_t b = 0; b < NUM_BLOCKS; b++)
+        dirtyCount += Mem::dirty[b];
+
+    // captures are not aligned
+    uint8_t* base = reserve(sizeof(MachineState) + 2 + dirtyCount * MAX_BLOCK_LEN);
+    MachineState state;
+    state.capture();
+    memcpy(base, &state, sizeof(MachineState));
+    uint8_t* out = base + sizeof(MachineState) + 2;
+    uint16_t blocks = 0;
+
+    for (uint16_t b = 0; b < NUM_BLOCKS && dirtyCount > 0; b++) {
+        if (!Mem::dirty[b])
+            continue;
+        Mem::dirty[b] = 0;
+        dirtyCount--;
+        uint8_t* cur = Mem::ram[b / MEM_BLOCKS] + (b % MEM_BLOCKS) * BLOCK_SIZE;
+        uint8_t* ref = reference + b * BLOCK_SIZE;
+        uint8_t* end = encodeBlock(cur, ref, out + 2);
+        if (end == out + 2)
+            continue;
+        out[0] = b & 0xFF;
+        out[1] = b >> 8;
+        out = end;
+        memcpy(ref, cur, BLOCK_SIZE);
+        blocks++;
+    }
+    base[sizeof(MachineState)] = blocks & 0xFF;
+    base[sizeof(MachineState) + 1] = blocks >> 8;
+
+    capture(count).length = out - base;
+    count++;
+
+    lastLength = out - base;
+    lastMicros = micros() - start;
+    if (lastMicros > maxMicros)
+        maxMicros = lastMicros;
+}
+
+void Rewind::endFrame()
+{
+    if (ring == NULL)
+        return;
+    if (++frames < REWIND_INTERVAL)
+        return;
+    frames = 0;
+    takeCapture();
+}
+
+// back to the newest capture, which is then dropped
+static void restoreNewest()
+{
+    // RAM written since
+    for (uint16_t b = 0; b < NUM_BLOCKS; b++) {
+        if (!Mem::dirty[b])
+            continue;
+        Mem::dirty[b] = 0;
+        memcpy(Mem::ram[b / MEM_BLOCKS] + (b % MEM_BLOCKS) * BLOCK_SIZE, reference + b * BLOCK_SIZE, BLOCK_SIZE);
+    }
+
+    Capture& c = capture(count - 1);
+    const uint8_t* in = ring + c.offset;
+    MachineState state;
+    memcpy(&state, in, sizeof(MachineState));
+    state.restore();
+    count--;
+
+    // reference goes back to the previous capture; those blocks now
+    // differ in RAM. The oldest capture has nothing to go back to.
+    if (count == 0)
+        return;
+    in += sizeof(MachineState);
+    uint16_t blocks = in[0] | (in[1] << 8);
+    in += 2;
+    while (blocks-- > 0) {
+        uint16_t b = in[0] | (in[1] << 8);
+        in = applyBlock(in + 2, reference + b * BLOCK_SIZE);
+        Mem::dirty[b] = 1;
+    }
+}
+
+bool Rewind::stepBack()
+{
+    if (ring == NULL || count == 0)
+        return false;
+    // a capture just taken is not worth a step
+    if (frames < REWIND_INTERVAL / 2 && count > 1)
+        restoreNewest();
+    restoreNewest();
+    frames = 0;
+    return true;
+}
+
+uint16_t Rewind::captures()
+{
+    return count;
+}
+
+void Rewind::printStats(char* buf, size_t len)
+{
+    uint32_t used = 0;
+    for (uint16_t n = 0; n < count; n++)
+        used += capture(n).length;
+    snprintf(buf, len, "rewind %u caps %uK last %uB %u/%uus",
+        count, used >> 10, lastLength, lastMicros, maxMicros);
+}
+
+#endif // REWIND_BUFFER
@@ -0,0 +1,275 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "hardconfig.h"
+
+#ifdef ROM_FLASH_PARTITION
+
+#include "RomFlash.h"
+#include "FileUtils.h"
+#include "Mem.h"
+#include <esp_partition.h>
+#include <esp_spi_flash.h>
+#include <esp_heap_caps.h>
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Partition layout: 16K slots. Slot 0 is the directory: a magic word and
+// then one entry per stored set; slots 1.. hold ROM pages. Sets are only
+// appended (pages first, then the entry), in erased flash, so no erase is
+// needed until the partition is full; then it is erased as a whole.
+
+#define ROM_FLASH_MAGIC 0x4D4F525A      // "ZROM"
+#define ROM_FLASH_ERASED 0xFFFFFFFF
+
+// flash is written from internal RAM
+#define ROM_FLASH_CHUNK 0x1000
+
+struct RomFlashEntry {
+    uint32_t magic;
+    char arch[8];
+    char romSet[24];
+    uint8_t count;
+    uint8_t first;              // slot of page 0
+    uint8_t pad[2];
+};
+
+#define ROM_FLASH_ENTRIES ((MEM_PG_SZ - sizeof(uint32_t)) / sizeof(RomFlashEntry))
+
+static const esp_partition_t* part = NULL;
+static const uint8_t* mapped = NULL;
+static spi_flash_mmap_handle_t mapHandle;
+static uint8_t slots = 0;
+
+static const RomFlashEntry* entry(uint8_t i)
+{
+    return (const RomFlashEntry*)(mapped + sizeof(uint32_t)) + i;
+}
+
+static bool format()
+{
+    uint32_t magic = ROM_FLASH_MAGIC;
+    if (esp_partition_erase_range(part, 0, part->size) != ESP_OK
+     || esp_partition_write(part, 0, &magic, sizeof(magic)) != ESP_OK) {
+        Serial.println("RomFlash: unable to format partition");
+        return false;
+    }
+    Serial.println("RomFlash: partition formatted");
+    return true;
+}
+
+bool RomFlash::setup()
+{
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+        (esp_partition_subtype_t)ROM_FLASH_SUBTYPE, ROM_FLASH_PARTITION);
+    if (part == NULL) {
+        Serial.printf("RomFlash: no '%s' partition\n", ROM_FLASH_PARTITION);
+        return false;
+    }
+    slots = part->size / MEM_PG_SZ;
+    if (slots < 1 + 4) {
+        Serial.printf("RomFlash: partition too small (%u)\n", part->size);
+        part = NULL;
+        return false;
+    }
+
+    const void* map;
+    if (esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, &map, &mapHandle) != ESP_OK) {
+        Serial.println("RomFlash: unable to map partition");
+        part = NULL;
+        return false;
+    }
+    mapped = (const uint8_t*)map;
+
+    if (*(const uint32_t*)mapped != ROM_FLASH_MAGIC && !format()) {
+        spi_flash_munmap(mapHandle);
+        mapped = NULL;
+        part = NULL;
+        return false;
+    }
+    Serial.printf("RomFlash: %u page slots mapped at %p\n", slots - 1, mapped);
+    return true;
+}
+
+bool RomFlash::select(const String& arch, const String& romSet)
+{
+    if (mapped == NULL)
+        return false;
+
+    for (uint8_t i = 0; i < ROM_FLASH_ENTRIES && entry(i)->magic != ROM_FLASH_ERASED; i++) {
+        const RomFlashEntry* e = entry(i);
+        if (e->magic != ROM_FLASH_MAGIC || arch != e->arch || romSet != e->romSet)
+            continue;
+        uint8_t* page[4];
+        for (uint8_t p = 0; p < 4; p++)
+            page[p] = p < e->count ? (uint8_t*)mapped + (e->first + p) * MEM_PG_SZ : NULL;
+        Mem::rom[0] = Mem::rom0 = page[0];
+        Mem::rom[1] = Mem::rom1 = page[1];
+        Mem::rom[2] = Mem::rom2 = page[2];
+        Mem::rom[3] = Mem::rom3 = page[3];
+        Serial.printf("ROMSET '%s/%s' from flash\n", arch.c_str(), romSet.c_str());
+        return true;
+    }
+    return false;
+}
+
+bool RomFlash::store(const String& arch, const String& romSet, const String& path, uint8_t count)
+{
+    if (mapped == NULL || count > 4 || arch.length() >= sizeof(RomFlashEntry::arch)
+     || romSet.length() >= sizeof(RomFlashEntry::romSet))
+        return false;
+
+    // first free directory entry and page slot
+    uint8_t n = 0;
+    uint8_t next = 1;
+    for (; n < ROM_FLASH_ENTRIES && entry(n)->magic != ROM_FLASH_ERASED; n++) {
+        const RomFlashEntry* e = entry(n);
+        if (e->magic == ROM_FLASH_MAGIC && e->first + e->count > next)
+            next = e->first + e->count;
+    }
+    if (n == ROM_FLASH_ENTRIES || next + count > slots) {
+        if (!format())
+            return false;
+        n = 0;
+        next = 1;
+    }
+
+    uint8_t* chunk = (uint8_t*)heap_caps_malloc(ROM_FLASH_CHUNK, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (chunk == NULL) {
+        Serial.println("RomFlash::store: unable to allocate buffer");
+        return false;
+    }
+
+    uint32_t start = millis();
+    bool ok = true;
+
+    for (uint8_t f = 0; f < count && ok; f++) {
+#ifdef USE_SD_CARD_ALT
+        FsFile rom_f = FileUtils::safeOpenFileRead(path + "/" + (String)f + ".rom");
+#else
+        File rom_f = FileUtils::safeOpenFileRead(path + "/" + (String)f + ".rom");
+#endif
+        size_t size = rom_f.size();
+        if (size > MEM_PG_SZ) size = MEM_PG_SZ;
+        for (size_t off = 0; off < size && ok; off += ROM_FLASH_CHUNK) {
+            size_t len = size - off < ROM_FLASH_CHUNK ? size - off : ROM_FLASH_CHUNK;
+            ok = (size_t)rom_f.read(chunk, len) == len
+              && esp_partition_write(part, (next + f) * MEM_PG_SZ + off, chunk, len) == ESP_OK;
+        }
+        rom_f.close();
+    }
+
+    if (ok) {
+        RomFlashEntry e;
+        memset(&e, 0, sizeof(e));
+        e.magic = ROM_FLASH_MAGIC;
+        strcpy(e.arch, arch.c_str());
+        strcpy(e.romSet, romSet.c_str());
+        e.count = count;
+        e.first = next;
+        memcpy(chunk, &e, sizeof(e));
+        ok = esp_partition_write(part, sizeof(uint32_t) + n * sizeof(e), chunk, sizeof(e)) == ESP_OK;
+    }
+    free(chunk);
+
+    if (!ok) {
+        Serial.println("RomFlash::store: write error");
+        return false;
+    }
+    Serial.printf("RomFlash::store: %s/%s written in %u ms\n", arch.c_str(), romSet.c_str(), millis() - start);
+    return select(arch, romSet);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Benchmark: opcode fetches from a 16K page, a short sequential run then a
+// jump, as Mem::readbyte does for ROM. The first pass starts cold.
+
+#define BENCH_FETCHES (256 * 1024)
+
+static uint32_t IRAM_ATTR fetchCycles(const uint8_t* page, uint32_t* sum)
+{
+    uint16_t pc = 0;
+    uint16_t lfsr = 0xACE1;
+    uint32_t s = 0;
+    uint32_t start = ESP.getCycleCount();
+    for (uint32_t i = 0; i < BENCH_FETCHES; i++) {
+        s += page[pc];
+        if ((i & 7) == 7) {
+            lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xB400);
+            pc = lfsr;
+        }
+        pc = (pc + 1) & (MEM_PG_SZ - 1);
+    }
+    uint32_t cycles = ESP.getCycleCount() - start;
+    *sum += s;
+    return cycles;
+}
+
+static void benchPage(const char* name, const uint8_t* page)
+{
+    if (page == NULL) {
+        Serial.printf("  %-6s not available\n", name);
+        return;
+    }
+    uint32_t sum = 0;
+    uint32_t cold = fetchCycles(page, &sum);
+    uint32_t warm = fetchCycles(page, &sum);
+    Serial.printf("  %-6s cold %u.%02u, warm %u.%02u cycles/fetch (%08x)\n", name,
+        cold / BENCH_FETCHES, cold % BENCH_FETCHES * 100 / BENCH_FETCHES,
+        warm / BENCH_FETCHES, warm % BENCH_FETCHES * 100 / BENCH_FETCHES, sum);
+}
+
+void RomFlash::benchmark()
+{
+    if (mapped == NULL) {
+        Serial.println("RomFlash: no mapped partition");
+        return;
+    }
+    const uint8_t* flash = mapped + MEM_PG_SZ;
+    Serial.printf("ROM fetch benchmark, %u fetches:\n", BENCH_FETCHES);
+    benchPage("flash", flash);
+
+    uint8_t* sram = (uint8_t*)heap_caps_malloc(MEM_PG_SZ, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#ifdef BOARD_HAS_PSRAM
+    uint8_t* psram = (uint8_t*)ps_malloc(MEM_PG_SZ);
+#else
+    uint8_t* psram = NULL;
+#endif
+    if (sram) memcpy(sram, flash, MEM_PG_SZ);
+    if (psram) memcpy(psram, flash, MEM_PG_SZ);
+
+    benchPage("SRAM", sram);
+    benchPage("PSRAM", psram);
+
+    free(sram);
+    free(psram);
+}
+
+#endif // ROM_FLASH_PARTITION
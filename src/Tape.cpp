@@ -0,0 +1,1331 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "Tape.h"
+#include "FileUtils.h"
+#include "PS2Kbd.h"
+#include "CPU.h"
+#include "Mem.h"
+#include "Config.h"
+#include "Ports.h"
+#include "AsyncWriter.h"
+#include "Z80Access.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Block index
+//
+// a .tap file is a sequence of blocks, each one preceded by its length
+// (2 bytes, little endian); block data is flag byte + data + checksum.
+// a .tzx file has a 10 byte header, then blocks made of an ID byte and
+// a body whose length depends on the ID. TAP blocks are indexed as TZX
+// standard speed blocks (0x10), without the pause field.
+// .csw and .wav captures are a single stream, indexed as one block with
+// an internal ID, which is decoded as it is read.
+
+struct TapeBlock
+{
+    uint32_t offset;    // file offset of block body (TAP: of length word)
+    uint8_t  id;
+};
+
+#define TAPE_INDEX_GROW 64
+
+#define TZX_HEADER_SIZE 10
+static const char tzxSignature[8] = { 'Z', 'X', 'T', 'a', 'p', 'e', '!', 0x1A };
+static const char cswSignature[23] = "Compressed Square Wave";  // + 0x1A
+
+// internal IDs for stream blocks
+#define ID_CSW 0xF1
+#define ID_WAV 0xF2
+
+enum TapeFormat { FORMAT_TAP, FORMAT_TZX, FORMAT_CSW, FORMAT_WAV };
+static const char* formatNames[] = { "TAP", "TZX", "CSW", "WAV" };
+
+static TapeBlock* blocks = NULL;
+static uint16_t numBlocks = 0;
+static uint16_t block = 0;
+static uint8_t format = FORMAT_TAP;
+static String tapeName;
+
+// stream parameters (CSW, WAV)
+static uint32_t streamLength = 0;   // bytes of pulse or sample data
+static uint32_t streamRate = 0;     // samples per second
+static uint8_t  wavBits = 8;
+static uint8_t  wavFrameBytes = 1;  // bytes per sample frame (all channels)
+
+#ifdef USE_SD_CARD_ALT
+static FsFile tapeFile;
+#define TAPE_SEEK(pos) tapeFile.seekSet(pos)
+#else
+static File tapeFile;
+#define TAPE_SEEK(pos) tapeFile.seek(pos)
+#endif
+
+bool Tape::inserted = false;
+bool Tape::playing = false;
+uint8_t Tape::level = 0;
+int32_t Tape::edge = 0;
+
+// Z80 flags
+#define FLAG_C  0x01
+#define FLAG_N  0x02
+#define FLAG_PV 0x04
+#define FLAG_H  0x10
+#define FLAG_Z  0x40
+#define FLAG_S  0x80
+
+static inline uint16_t getWord(const uint8_t* p)  { return p[0] | (p[1] << 8); }
+static inline uint32_t get24(const uint8_t* p)    { return p[0] | (p[1] << 8) | (p[2] << 16); }
+static inline uint32_t getDWord(const uint8_t* p) { return get24(p) | (p[3] << 24); }
+
+// length of a TZX block body, from its first bytes (at least 20)
+static uint32_t tzxBodyLength(uint8_t id, const uint8_t* h)
+{
+    switch (id) {
+    case 0x10: return 4 + getWord(h + 2);
+    case 0x11: return 18 + get24(h + 15);
+    case 0x12: return 4;
+    case 0x13: return 1 + 2 * h[0];
+    case 0x14: return 10 + get24(h + 7);
+    case 0x15: return 8 + get24(h + 5);
+    case 0x20: return 2;
+    case 0x21: return 1 + h[0];
+    case 0x22: return 0;
+    case 0x23: return 2;
+    case 0x24: return 2;
+    case 0x25: return 0;
+    case 0x26: return 2 + 2 * getWord(h);
+    case 0x27: return 0;
+    case 0x28: return 2 + getWord(h);
+    case 0x2A: return 4;
+    case 0x2B: return 5;
+    case 0x30: return 1 + h[0];
+    case 0x31: return 2 + h[1];
+    case 0x32: return 2 + getWord(h);
+    case 0x33: return 1 + 3 * h[0];
+    case 0x35: return 20 + getDWord(h + 16);
+    case 0x40: return 4 + get24(h + 1);
+    case 0x5A: return 9;
+    // 0x16, 0x17, 0x18, 0x19 and any later extension: 4 byte length first
+    default:   return 4 + getDWord(h);
+    }
+}
+
+static bool addBlock(uint16_t& capacity, uint32_t offset, uint8_t id)
+{
+    if (numBlocks == capacity) {
+        capacity += TAPE_INDEX_GROW;
+        TapeBlock* grown = (TapeBlock*)realloc(blocks, capacity * sizeof(TapeBlock));
+        if (grown == NULL)
+            return false;
+        blocks = grown;
+    }
+    blocks[numBlocks].offset = offset;
+    blocks[numBlocks].id = id;
+    numBlocks++;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Read-ahead reader for the pulse decoder
+//
+// two chunk buffers: the decoder consumes one while a low priority task
+// reads the following chunk of the file into the other, so SD latency is
+// hidden and no more than two chunks of a file are ever held in RAM.
+// Seeks within the current chunk (TZX blocks) cost nothing.
+
+#define READ_CHUNK_SIZE 4096
+#define READER_CORE 0
+#define READER_STACK 3072
+#define READER_LOCK_TICKS 2     // retry period while the SD card is busy
+
+struct ReadChunk
+{
+    uint8_t* data;
+    uint32_t base;      // file offset of data[0]
+    int32_t  len;       // valid bytes
+};
+
+static ReadChunk chunks[2];
+static uint8_t cur = 0;
+static uint16_t rdPos = 0;
+
+static TaskHandle_t readerTask = NULL;
+static SemaphoreHandle_t readerDone = NULL;
+static volatile uint8_t aheadIndex = 0;
+static volatile bool readerQuit = false;
+static volatile bool readerCancel = false;
+static bool aheadPending = false;
+
+// read from the emulation task
+static int32_t readChunk(ReadChunk& c)
+{
+    SD_LOCK;
+    KB_INT_STOP;
+    TAPE_SEEK(c.base);
+    int n = tapeFile.read(c.data, READ_CHUNK_SIZE);
+    KB_INT_START;
+    SD_UNLOCK;
+    return n > 0 ? n : 0;
+}
+
+// read ahead from the reader task. The emulation task may wait for it
+// while holding the SD lock (OSD menus), so the lock is only polled and
+// the read given up when cancelled; the chunk is then read on demand.
+// The keyboard interrupt is left alone, it belongs to the emulation task.
+static int32_t readAhead(ReadChunk& c)
+{
+    while (!FileUtils::sdTryLock(READER_LOCK_TICKS))
+        if (readerCancel)
+            return 0;
+    TAPE_SEEK(c.base);
+    int n = tapeFile.read(c.data, READ_CHUNK_SIZE);
+    SD_UNLOCK;
+    return n > 0 ? n : 0;
+}
+
+static void readerLoop(void* unused)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (readerQuit)
+            break;
+        ReadChunk& c = chunks[aheadIndex];
+        c.len = readAhead(c);
+        xSemaphoreGive(readerDone);
+    }
+    xSemaphoreGive(readerDone);
+    vTaskDelete(NULL);
+}
+
+static void waitAhead()
+{
+    if (aheadPending) {
+        readerCancel = true;
+        xSemaphoreTake(readerDone, portMAX_DELAY);
+        readerCancel = false;
+        aheadPending = false;
+    }
+}
+
+// start reading the chunk after the current one into the other buffer
+static void requestAhead()
+{
+    uint8_t next = cur ^ 1;
+    chunks[next].base = chunks[cur].base + chunks[cur].len;
+    chunks[next].len = 0;
+    if (chunks[cur].len < READ_CHUNK_SIZE)
+        return;     // end of file
+    aheadIndex = next;
+    aheadPending = true;
+    xTaskNotifyGive(readerTask);
+}
+
+// read chunk at pos now, then read ahead
+static void fillCurrent(uint32_t pos)
+{
+    waitAhead();
+    chunks[cur].base = pos;
+    chunks[cur].len = readChunk(chunks[cur]);
+    rdPos = 0;
+    requestAhead();
+}
+
+static bool startReader()
+{
+    for (int i = 0; i < 2; i++) {
+        chunks[i].data = (uint8_t*)malloc(READ_CHUNK_SIZE);
+        chunks[i].base = 0;
+        chunks[i].len = 0;
+        if (chunks[i].data == NULL)
+            return false;
+    }
+    cur = 0;
+    rdPos = 0;
+    readerQuit = false;
+    aheadPending = false;
+    if (readerDone == NULL)
+        readerDone = xSemaphoreCreateBinary();
+    return xTaskCreatePinnedToCore(&readerLoop, "tapeReader", READER_STACK, NULL, 1, &readerTask, READER_CORE) == pdPASS;
+}
+
+static void stopReader()
+{
+    if (readerTask != NULL) {
+        waitAhead();
+        readerQuit = true;
+        xTaskNotifyGive(readerTask);
+        xSemaphoreTake(readerDone, portMAX_DELAY);
+        readerTask = NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        free(chunks[i].data);
+        chunks[i].data = NULL;
+    }
+}
+
+static void seekTo(uint32_t pos)
+{
+    ReadChunk& c = chunks[cur];
+    if (pos >= c.base && pos < c.base + c.len)
+        rdPos = pos - c.base;
+    else
+        fillCurrent(pos);
+}
+
+// switch to the chunk read ahead, waiting for it only if not done yet
+static bool nextChunk()
+{
+    uint32_t pos = chunks[cur].base + chunks[cur].len;
+    waitAhead();
+    uint8_t next = cur ^ 1;
+    if (chunks[next].base == pos && chunks[next].len > 0) {
+        cur = next;
+        rdPos = 0;
+        requestAhead();
+        return true;
+    }
+    fillCurrent(pos);
+    return chunks[cur].len > 0;
+}
+
+static inline uint8_t readByte()
+{
+    if (rdPos >= chunks[cur].len && !nextChunk())
+        return 0;
+    return chunks[cur].data[rdPos++];
+}
+
+static uint16_t readWord()
+{
+    uint8_t lo = readByte();
+    return lo | (readByte() << 8);
+}
+
+static uint32_t read24()
+{
+    uint16_t lo = readWord();
+    return lo | (readByte() << 16);
+}
+
+static uint32_t readDWord()
+{
+    uint16_t lo = readWord();
+    return lo | (readWord() << 16);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Pulse decoder
+//
+// each ring entry is the length in T-states of the level that follows an
+// edge. PULSE_LOW forces the level low instead of toggling it (pauses),
+// PULSE_HOLD keeps the level (long silences in captures), PULSE_STOP stops
+// the tape once reached (TZX stop blocks, end of tape).
+
+#define PULSE_RING_SIZE 1024
+#define PULSE_LOW  0x80000000
+#define PULSE_STOP 0x40000000
+#define PULSE_HOLD 0x20000000
+#define PULSE_MASK 0x1FFFFFFF
+
+// standard ROM timings
+#define STD_PILOT      2168
+#define STD_SYNC1      667
+#define STD_SYNC2      735
+#define STD_ZERO       855
+#define STD_ONE        1710
+#define STD_PILOT_HDR  8063
+#define STD_PILOT_DATA 3223
+#define STD_PAUSE      1000
+
+// TZX timings are given for a 3.5MHz clock
+#define TZX_CLOCK      3500000
+#define TZX_MS         (TZX_CLOCK / 1000)
+
+static uint32_t pulses[PULSE_RING_SIZE];
+static uint16_t pulseHead = 0;
+static uint16_t pulseTail = 0;
+
+// scale of TZX T-states to machine T-states, 16.16 fixed point
+static uint32_t clockScale = 0x10000;
+
+enum DecodeState { DEC_BLOCK, DEC_PILOT, DEC_SYNC1, DEC_SYNC2, DEC_DATA, DEC_PULSES, DEC_PAUSE,
+                   DEC_CSW, DEC_WAV, DEC_STOPPED };
+
+// captures: edge detector hysteresis around the running average (16 bit
+// scale), and longest run without edges decoded in one go (in samples)
+#define WAV_HYSTERESIS 1024
+#define WAV_MAX_RUN    4096
+
+static struct {
+    uint8_t  state;
+    uint16_t pilot, sync1, sync2, zero, one;
+    uint16_t pilotCount;
+    bool     toneOnly;      // pure tone block, no sync nor data
+    uint8_t  lastBits;      // bits used in last data byte
+    uint16_t pause;         // ms
+    uint32_t dataLeft;      // bytes not yet read
+    uint8_t  byte;
+    uint8_t  bitsLeft;
+    uint8_t  half;          // each bit is two pulses
+    uint16_t pulsesLeft;    // pulse sequence block
+    uint16_t loopStart;
+    uint16_t loopCount;
+    uint32_t streamLeft;    // stream bytes not yet read
+    uint32_t fraction;      // samples to T-states remainder
+    int32_t  average;       // WAV running average, 24.8
+    uint8_t  wavLevel;
+    uint32_t run;           // WAV samples since last edge
+} dec;
+
+static inline bool ringFull()
+{
+    return (uint16_t)(pulseHead - pulseTail) >= PULSE_RING_SIZE;
+}
+
+static inline void push(uint32_t length, uint32_t flags = 0)
+{
+    uint32_t scaled = ((uint64_t)length * clockScale) >> 16;
+    if (scaled > PULSE_MASK)
+        scaled = PULSE_MASK;
+    pulses[pulseHead++ & (PULSE_RING_SIZE - 1)] = scaled | flags;
+}
+
+// capture samples to TZX T-states, keeping the remainder
+static uint32_t samplesToTStates(uint32_t samples)
+{
+    uint64_t t = (uint64_t)samples * TZX_CLOCK + dec.fraction;
+    dec.fraction = t % streamRate;
+    return t / streamRate;
+}
+
+// next WAV sample, first channel, as signed 16 bit
+static int32_t readSample()
+{
+    int32_t s;
+    if (wavBits == 8)
+        s = ((int32_t)readByte() - 128) << 8;
+    else
+        s = (int16_t)readWord();
+    for (int i = wavBits / 8; i < wavFrameBytes; i++)
+        readByte();
+    return s;
+}
+
+static void resetDecoder()
+{
+    dec.state = DEC_BLOCK;
+    dec.loopCount = 0;
+    pulseHead = pulseTail = 0;
+}
+
+// start decoding block at current position
+static void startBlock()
+{
+    if (block >= numBlocks) {
+        push(0, PULSE_STOP);
+        dec.state = DEC_STOPPED;
+        return;
+    }
+
+    const TapeBlock& b = blocks[block++];
+    seekTo(b.offset);
+    dec.toneOnly = false;
+    dec.lastBits = 8;
+    dec.bitsLeft = 0;
+    dec.half = 0;
+
+    switch (b.id) {
+    case 0x10:
+        dec.pause = format == FORMAT_TAP ? STD_PAUSE : readWord();
+        dec.dataLeft = readWord();
+        dec.pilot = STD_PILOT;
+        dec.sync1 = STD_SYNC1;
+        dec.sync2 = STD_SYNC2;
+        dec.zero = STD_ZERO;
+        dec.one = STD_ONE;
+        // flag byte tells header from data, peek it
+        if (dec.dataLeft > 0) {
+            uint8_t flag = readByte();
+            rdPos--;
+            dec.pilotCount = flag < 128 ? STD_PILOT_HDR : STD_PILOT_DATA;
+        }
+        dec.state = dec.dataLeft ? DEC_PILOT : DEC_PAUSE;
+        break;
+    case 0x11:
+        dec.pilot = readWord();
+        dec.sync1 = readWord();
+        dec.sync2 = readWord();
+        dec.zero = readWord();
+        dec.one = readWord();
+        dec.pilotCount = readWord();
+        dec.lastBits = readByte();
+        dec.pause = readWord();
+        dec.dataLeft = read24();
+        dec.state = DEC_PILOT;
+        break;
+    case 0x12:
+        dec.pilot = readWord();
+        dec.pilotCount = readWord();
+        dec.toneOnly = true;
+        dec.state = DEC_PILOT;
+        break;
+    case 0x13:
+        dec.pulsesLeft = readByte();
+        dec.state = DEC_PULSES;
+        break;
+    case 0x14:
+        dec.zero = readWord();
+        dec.one = readWord();
+        dec.lastBits = readByte();
+        dec.pause = readWord();
+        dec.dataLeft = read24();
+        dec.state = DEC_DATA;
+        break;
+    case 0x20:
+        dec.pause = readWord();
+        if (dec.pause == 0) {
+            push(0, PULSE_STOP);
+            dec.state = DEC_STOPPED;
+        }
+        else dec.state = DEC_PAUSE;
+        break;
+    case 0x24:
+        dec.loopCount = readWord();
+        dec.loopStart = block;
+        break;
+    case 0x25:
+        if (dec.loopCount && --dec.loopCount)
+            block = dec.loopStart;
+        break;
+    case 0x2A:
+        // stop the tape if in 48K mode
+        if (Config::getArch() == "48K") {
+            push(0, PULSE_STOP);
+            dec.state = DEC_STOPPED;
+        }
+        break;
+    case ID_CSW:
+        dec.streamLeft = streamLength;
+        dec.fraction = 0;
+        dec.state = DEC_CSW;
+        break;
+    case ID_WAV:
+        dec.streamLeft = streamLength;
+        dec.fraction = 0;
+        dec.average = 0;
+        dec.wavLevel = 0;
+        dec.run = 0;
+        dec.state = DEC_WAV;
+        break;
+    default:
+        // informational and unsupported blocks produce no pulses
+        break;
+    }
+}
+
+// CSW RLE: each byte is a pulse length in samples, 0 means a 32 bit one follows
+static void decodeCsw()
+{
+    if (dec.streamLeft == 0) {
+        dec.state = DEC_BLOCK;
+        return;
+    }
+    uint32_t n = readByte();
+    dec.streamLeft--;
+    if (n == 0 && dec.streamLeft >= 4) {
+        n = readDWord();
+        dec.streamLeft -= 4;
+    }
+    push(samplesToTStates(n));
+}
+
+// WAV: edge detector with hysteresis around a running average, so DC
+// offset and noise in the capture do not produce spurious edges
+static void decodeWav()
+{
+    for (;;) {
+        if (dec.streamLeft < wavFrameBytes) {
+            if (dec.run)
+                push(samplesToTStates(dec.run), PULSE_HOLD);
+            dec.state = DEC_BLOCK;
+            return;
+        }
+        int32_t s = readSample();
+        dec.streamLeft -= wavFrameBytes;
+        dec.run++;
+
+        dec.average += ((s << 8) - dec.average) >> 12;
+        int32_t v = s - (dec.average >> 8);
+        if (dec.wavLevel ? v < -WAV_HYSTERESIS : v > WAV_HYSTERESIS) {
+            dec.wavLevel ^= 1;
+            push(samplesToTStates(dec.run));
+            dec.run = 0;
+            return;
+        }
+        if (dec.run >= WAV_MAX_RUN) {
+            // long silence: advance time without an edge
+            push(samplesToTStates(dec.run), PULSE_HOLD);
+            dec.run = 0;
+            return;
+        }
+    }
+}
+
+// decode pulses until the ring is full or the tape stops
+static void decode()
+{
+    while (!ringFull()) {
+        switch (dec.state) {
+        case DEC_BLOCK:
+            startBlock();
+            break;
+        case DEC_PILOT:
+            if (dec.pilotCount > 0) {
+                push(dec.pilot);
+                dec.pilotCount--;
+            }
+            else dec.state = dec.toneOnly ? DEC_BLOCK : DEC_SYNC1;
+            break;
+        case DEC_SYNC1:
+            push(dec.sync1);
+            dec.state = DEC_SYNC2;
+            break;
+        case DEC_SYNC2:
+            push(dec.sync2);
+            dec.state = DEC_DATA;
+            break;
+        case DEC_DATA:
+            if (dec.bitsLeft == 0) {
+                if (dec.dataLeft == 0) {
+                    dec.state = DEC_PAUSE;
+                    break;
+                }
+                dec.byte = readByte();
+                dec.dataLeft--;
+                dec.bitsLeft = dec.dataLeft ? 8 : dec.lastBits;
+                if (dec.bitsLeft == 0 || dec.bitsLeft > 8)
+                    dec.bitsLeft = 8;
+            }
+            push(dec.byte & 0x80 ? dec.one : dec.zero);
+            if (dec.half) {
+                dec.byte <<= 1;
+                dec.bitsLeft--;
+            }
+            dec.half ^= 1;
+            break;
+        case DEC_PULSES:
+            if (dec.pulsesLeft > 0) {
+                push(readWord());
+                dec.pulsesLeft--;
+            }
+            else dec.state = DEC_BLOCK;
+            break;
+        case DEC_PAUSE:
+            if (dec.pause > 0)
+                push(dec.pause * TZX_MS, PULSE_LOW);
+            dec.state = DEC_BLOCK;
+            break;
+        case DEC_CSW:
+            decodeCsw();
+            break;
+        case DEC_WAV:
+            decodeWav();
+            break;
+        case DEC_STOPPED:
+            return;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// CSW v1 and v2 header; only RLE compression
+static bool parseCsw(const uint8_t* h, uint32_t size, uint16_t& capacity)
+{
+    uint8_t major = h[0x17];
+    uint8_t compression;
+    uint32_t data;
+    if (major == 1) {
+        streamRate = getWord(h + 0x19);
+        compression = h[0x1B];
+        data = 0x20;
+    }
+    else {
+        streamRate = getDWord(h + 0x19);
+        compression = h[0x21];
+        data = 0x34 + h[0x23];
+    }
+    if (compression != 1 || streamRate == 0 || data >= size) {
+        Serial.printf("Tape: unsupported CSW (v%u, compression %u)\n", major, compression);
+        return false;
+    }
+    streamLength = size - data;
+    return addBlock(capacity, data, ID_CSW);
+}
+
+// RIFF WAVE with 8 or 16 bit PCM; walks chunks up to "data"
+static bool parseWav(uint32_t size, uint16_t& capacity)
+{
+    uint8_t h[24];
+    uint32_t pos = 12;
+    bool fmt = false;
+    while (pos + 8 <= size) {
+        TAPE_SEEK(pos);
+        if (tapeFile.read(h, 8) != 8)
+            return false;
+        uint32_t len = getDWord(h + 4);
+        if (memcmp(h, "fmt ", 4) == 0) {
+            if (len < 16 || tapeFile.read(h, 16) != 16)
+                return false;
+            uint16_t tag = getWord(h);
+            uint16_t channels = getWord(h + 2);
+            streamRate = getDWord(h + 4);
+            wavBits = getWord(h + 14);
+            wavFrameBytes = getWord(h + 12);
+            if ((tag != 1 && tag != 0xFFFE) || channels == 0 || streamRate == 0 ||
+                (wavBits != 8 && wavBits != 16) || wavFrameBytes < wavBits / 8) {
+                Serial.printf("Tape: unsupported WAV (format %u, %u bits)\n", tag, wavBits);
+                return false;
+            }
+            fmt = true;
+        }
+        else if (memcmp(h, "data", 4) == 0) {
+            if (!fmt)
+                return false;
+            streamLength = len < size - pos - 8 ? len : size - pos - 8;
+            return addBlock(capacity, pos + 8, ID_WAV);
+        }
+        pos += 8 + len + (len & 1);
+    }
+    return false;
+}
+
+bool Tape::open(String filename)
+{
+    close();
+
+    SD_LOCK;
+    KB_INT_STOP;
+    tapeFile = FileUtils::safeOpenFileRead(filename);
+    uint32_t size = tapeFile.size();
+    uint16_t capacity = 0;
+    bool valid = true;
+
+    uint8_t h[64];
+    memset(h, 0, sizeof(h));
+    int n = tapeFile.read(h, sizeof(h));
+    if (n >= TZX_HEADER_SIZE && memcmp(h, tzxSignature, sizeof(tzxSignature)) == 0)
+        format = FORMAT_TZX;
+    else if (n >= 0x20 && memcmp(h, cswSignature, sizeof(cswSignature) - 1) == 0)
+        format = FORMAT_CSW;
+    else if (n >= 12 && memcmp(h, "RIFF", 4) == 0 && memcmp(h + 8, "WAVE", 4) == 0)
+        format = FORMAT_WAV;
+    else
+        format = FORMAT_TAP;
+
+    if (format == FORMAT_CSW)
+        valid = parseCsw(h, size, capacity);
+    else if (format == FORMAT_WAV)
+        valid = parseWav(size, capacity);
+    else if (format == FORMAT_TAP) {
+        uint32_t pos = 0;
+        while (valid && pos + 2 <= size) {
+            TAPE_SEEK(pos);
+            if (tapeFile.read(h, 2) != 2) { valid = false; break; }
+            uint16_t length = getWord(h);
+            if (pos + 2 + length > size) { valid = false; break; }
+            valid = addBlock(capacity, pos, 0x10);
+            pos += 2 + length;
+        }
+    }
+    else {
+        uint32_t pos = TZX_HEADER_SIZE;
+        while (valid && pos < size) {
+            TAPE_SEEK(pos);
+            memset(h, 0, sizeof(h));
+            if (tapeFile.read(h, sizeof(h)) < 1) { valid = false; break; }
+            uint8_t id = h[0];
+            uint32_t length = tzxBodyLength(id, h + 1);
+            if (pos + 1 + length > size) {
+                // truncated last block: keep what was indexed
+                Serial.printf("Tape: truncated TZX block 0x%02X at %u\n", id, pos);
+                break;
+            }
+            valid = addBlock(capacity, pos + 1, id);
+            pos += 1 + length;
+        }
+    }
+    KB_INT_START;
+    SD_UNLOCK;
+
+    if (!valid || numBlocks == 0) {
+        Serial.printf("Tape: %s is not a valid tape file\n", filename.c_str());
+        close();
+        return false;
+    }
+
+    if (!startReader()) {
+        Serial.println("Tape: unable to allocate read buffers");
+        close();
+        return false;
+    }
+
+    Serial.printf("Tape: %s, %s, %u blocks\n", filename.c_str(), formatNames[format], numBlocks);
+    tapeName = filename;
+    inserted = true;
+    rewind();
+    return true;
+}
+
+void Tape::close()
+{
+#ifdef TAPE_SAVE_TRAP
+    saveEnd = true;
+#endif
+    inserted = false;
+    playing = false;
+    stopReader();
+    if (tapeFile) {
+        SD_LOCK;
+        tapeFile.close();
+        SD_UNLOCK;
+    }
+    free(blocks);
+    blocks = NULL;
+    numBlocks = 0;
+    block = 0;
+    tapeName = "";
+}
+
+void Tape::rewind()
+{
+    playing = false;
+    block = 0;
+    level = 0;
+    resetDecoder();
+}
+
+void Tape::play()
+{
+    if (!inserted || playing)
+        return;
+    if (dec.state == DEC_STOPPED)
+        dec.state = DEC_BLOCK;
+
+    uint32_t clock = (uint64_t)CPU::statesPerFrame() * 1000000 / CPU::microsPerFrame();
+    clockScale = ((uint64_t)clock << 16) / TZX_CLOCK;
+
+    Serial.printf("Tape: playing from block %u\n", block);
+    decode();
+    edge = CPU::tstates;
+    playing = true;
+}
+
+void Tape::stop()
+{
+#ifdef TAPE_SAVE_TRAP
+    saveEnd = true;
+#endif
+    playing = false;
+}
+
+uint16_t Tape::blockCount()
+{
+    return numBlocks;
+}
+
+uint16_t Tape::currentBlock()
+{
+    return block;
+}
+
+const String& Tape::fileName()
+{
+    return tapeName;
+}
+
+void Tape::seekBlock(uint16_t n)
+{
+    rewind();
+    block = n < numBlocks ? n : numBlocks;
+}
+
+void Tape::nextEdge()
+{
+    if (pulseHead == pulseTail) {
+        decode();
+        if (pulseHead == pulseTail) {
+            playing = false;
+            return;
+        }
+    }
+
+    uint32_t p = pulses[pulseTail++ & (PULSE_RING_SIZE - 1)];
+    if (p & PULSE_STOP) {
+        playing = false;
+        Serial.printf("Tape: stopped at block %u\n", block);
+        return;
+    }
+    if (p & PULSE_LOW)
+        level = 0;
+    else if (!(p & PULSE_HOLD))
+        level ^= 1;
+    edge += p & PULSE_MASK;
+}
+
+void Tape::endFrame(uint32_t frameStates)
+{
+#ifdef TAPE_SAVE_TRAP
+    saveIdle();
+#endif
+    if (!playing)
+        return;
+
+    // keep up with edges even if the CPU did not read EAR this frame
+    while (playing && (int32_t)(frameStates - edge) >= 0)
+        nextEdge();
+    edge -= frameStates;
+
+    // decode ahead here, so SD card reads do not happen mid-frame
+    decode();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Edge detection loop acceleration
+//
+// loaders wait for the next edge in a tight loop that samples EAR and
+// counts iterations in B. While the level cannot change, the result of
+// each iteration is known: B incremented, A = 0 and flags from AND 20h.
+// Those iterations are done at once, crediting their T-states, so the
+// loop is left at exactly the same T-state and with the same registers
+// as if executed. Only loops out of contended memory are accelerated.
+
+#ifdef TAPE_ACCELERATE
+
+#define ANY 0x100
+
+struct EdgeLoop
+{
+    uint8_t  length;
+    uint16_t code[13];
+    uint8_t  tstates;       // per iteration
+    uint8_t  m1;            // opcode fetches per iteration (R register)
+    bool     breakTest;     // RET NC after RRA: SPACE exits the loop
+};
+
+static const EdgeLoop edgeLoops[] = {
+    // ROM LD-SAMPLE: INC B / RET Z / LD A,7F / IN A,(FE) / RRA / RET NC /
+    //                XOR C / AND 20h / JR Z,LD-SAMPLE
+    { 13, { 0x04, 0xC8, 0x3E, ANY, 0xDB, 0xFE, 0x1F, 0xD0, 0xA9, 0xE6, 0x20, 0x28, 0xF3 }, 59, 9, true },
+    // same without BREAK test, common in turbo loaders
+    { 12, { 0x04, 0xC8, 0x3E, ANY, 0xDB, 0xFE, 0x1F, 0xA9, 0xE6, 0x20, 0x28, 0xF4 }, 54, 8, false },
+};
+
+// A and F after an iteration that did not find an edge (AND 20h -> 0)
+#define EDGE_LOOP_AF 0x0054
+
+static const EdgeLoop* matchEdgeLoop(uint16_t pc)
+{
+    for (int i = 0; i < sizeof(edgeLoops) / sizeof(edgeLoops[0]); i++) {
+        const EdgeLoop& l = edgeLoops[i];
+        int j;
+        for (j = 0; j < l.length; j++)
+            if (l.code[j] != ANY && Mem::readbyte(pc + j) != l.code[j])
+                break;
+        if (j == l.length)
+            return &l;
+    }
+    return NULL;
+}
+
+void Tape::edgeLoop(uint16_t pc)
+{
+    // all loops start with INC B
+    if (Mem::readbyte(pc) != 0x04 || ADDRESS_IN_LOW_RAM(pc))
+        return;
+
+    const EdgeLoop* l = matchEdgeLoop(pc);
+    if (l == NULL)
+        return;
+
+    uint16_t bc = Z80_GET_BC();
+    uint8_t b = bc >> 8;
+    uint8_t c = bc & 0xFF;
+
+    // level already differs from the one in C: next iteration finds the edge
+    uint32_t now = CPU::tstates;
+    if (((ear(now) << 5) ^ c) & 0x20)
+        return;
+    if (!playing)
+        return;
+
+    // a key pressed would leave the loop
+    if (l->breakTest && !(Ports::input(0xFE, Mem::readbyte(pc + 3)) & 0x01))
+        return;
+
+    // every skipped iteration samples EAR before the edge
+    uint32_t n = (uint32_t)(edge - (int32_t)now) / l->tstates;
+
+    // B must not wrap (timeout exit), and stay within the frame
+    if (n > (uint32_t)(0xFF - b))
+        n = 0xFF - b;
+    uint32_t frameStates = CPU::statesPerFrame();
+    if (now >= frameStates)
+        return;
+    if (n > (frameStates - now) / l->tstates)
+        n = (frameStates - now) / l->tstates;
+    if (n == 0)
+        return;
+
+    Z80_SET_BC(((b + n) << 8) | c);
+    Z80_SET_AF(EDGE_LOOP_AF);
+    uint8_t r = Z80_GET_R();
+    Z80_SET_R((r & 0x80) | ((r + n * l->m1) & 0x7F));
+    CPU::tstates = now + n * l->tstates;
+}
+
+#endif // TAPE_ACCELERATE
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ROM loader entry
+
+void Tape::romLoader()
+{
+#ifdef TAPE_LOAD_TRAP
+    if (ldBytes())
+        return;
+#endif
+    play();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// LD-BYTES trap
+//
+// on entry: A = expected flag byte, carry set for LOAD or reset for VERIFY,
+// IX = destination, DE = length. On exit, as the ROM does: IX and DE
+// advanced by bytes loaded, A = checksum (0 if ok) and carry set if ok.
+
+#ifdef TAPE_LOAD_TRAP
+
+// first bytes of LD-BYTES: INC D / EX AF,AF' / DEC D / DI
+static const uint8_t ldBytesSignature[4] = { 0x14, 0x08, 0x15, 0xF3 };
+
+// blocks which produce no signal the ROM would need
+static inline bool isSilentBlock(uint8_t id)
+{
+    switch (id) {
+    case 0x20: case 0x21: case 0x22: case 0x30: case 0x31:
+    case 0x32: case 0x33: case 0x35: case 0x5A:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// index of next block with a signal, skipping silent ones
+static uint16_t nextSignalBlock(uint16_t b)
+{
+    while (b < numBlocks && isSilentBlock(blocks[b].id)) {
+        // a TZX stop block must stop here
+        if (blocks[b].id == 0x20) {
+            uint8_t h[2];
+            TAPE_SEEK(blocks[b].offset);
+            if (tapeFile.read(h, 2) != 2 || getWord(h) == 0)
+                break;
+        }
+        b++;
+    }
+    return b;
+}
+
+// memory behind a Z80 address as seen now, NULL for ROM
+static inline uint8_t* pagePtr(uint16_t addr)
+{
+    switch (addr >> 14) {
+    case 1:  return Mem::ram5 + (addr & 0x3FFF);
+    case 2:  return Mem::ram2 + (addr & 0x3FFF);
+    case 3:  return Mem::ram[Mem::bankLatch] + (addr & 0x3FFF);
+    default: return NULL;
+    }
+}
+
+// flags after CP 1 as the ROM exits with LD A,H / CP 01
+static inline uint8_t cp1Flags(uint8_t a)
+{
+    uint8_t res = a - 1;
+    uint8_t f = FLAG_N | (res & FLAG_S);
+    if (res == 0)        f |= FLAG_Z;
+    if ((a & 0x0F) == 0) f |= FLAG_H;
+    if (a == 0x80)       f |= FLAG_PV;
+    if (a == 0)          f |= FLAG_C;
+    return f;
+}
+
+// returns false if the tape has to be played in real time instead
+bool Tape::ldBytes()
+{
+    // only with the standard loader paged in
+    if (memcmp(Mem::rom[Mem::romInUse] + TAPE_LD_BYTES, ldBytesSignature, sizeof(ldBytesSignature)) != 0)
+        return false;
+
+    // only at a block boundary, with nothing pending from real time play
+    if ((dec.state != DEC_BLOCK && dec.state != DEC_STOPPED) || pulseHead != pulseTail)
+        return false;
+
+    SD_LOCK;
+    KB_INT_STOP;
+
+    uint16_t b = nextSignalBlock(block);
+
+    // end of tape: nothing to play, the ROM waits as with a real player
+    if (b >= numBlocks) {
+        KB_INT_START;
+        SD_UNLOCK;
+        return true;
+    }
+    // other than a standard block: play it in real time
+    if (blocks[b].id != 0x10) {
+        KB_INT_START;
+        SD_UNLOCK;
+        block = b;
+        return false;
+    }
+    block = b + 1;
+
+    uint8_t h[4];
+    uint32_t pos = blocks[b].offset;
+    if (format != FORMAT_TAP) pos += 2;     // skip pause
+    TAPE_SEEK(pos);
+    tapeFile.read(h, 2);
+    uint16_t blockLength = getWord(h);
+
+    uint16_t af = Z80_GET_AF();
+    uint8_t expectedFlag = af >> 8;
+    bool verify = !(af & FLAG_C);
+    uint16_t ix = Z80_GET_IX();
+    uint16_t de = Z80_GET_DE();
+
+    uint8_t result;
+    bool error = false;
+
+    uint8_t flag = 0;
+    if (blockLength == 0 || tapeFile.read(&flag, 1) != 1 || flag != expectedFlag) {
+        // wrong block type (or empty): ROM returns at once with carry reset
+        error = true;
+        result = flag;
+    }
+    else {
+        // ROM reads DE bytes then the checksum; a short block times out
+        uint16_t available = blockLength - 1;
+        uint16_t count = de < available ? de : available;
+        uint16_t loaded = count;
+        uint8_t parity = flag;
+        uint8_t scratch[256];
+
+        while (count > 0) {
+            // copy directly into the paged memory, up to the end of the page
+            uint16_t n = 0x4000 - (ix & 0x3FFF);
+            if (n > count) n = count;
+            uint8_t* dst = pagePtr(ix);
+            if (verify || dst == NULL) {
+                if (n > sizeof(scratch)) n = sizeof(scratch);
+                if (tapeFile.read(scratch, n) != n) { error = true; break; }
+                for (int i = 0; i < n; i++) {
+                    parity ^= scratch[i];
+                    if (verify && dst != NULL && dst[i] != scratch[i])
+                        error = true;
+                }
+            }
+            else {
+                if (tapeFile.read(dst, n) != n) { error = true; break; }
+                Mem::markDirty(ix, n);
+                for (int i = 0; i < n; i++)
+                    parity ^= dst[i];
+            }
+            ix += n;
+            de -= n;
+            count -= n;
+        }
+
+        if (!error && de == 0 && loaded < available) {
+            uint8_t checksum;
+            if (tapeFile.read(&checksum, 1) == 1)
+                parity ^= checksum;
+            else
+                error = true;
+        }
+        else error = true;
+
+        result = parity;
+    }
+
+    // a custom loader will follow if the next block is not a standard one
+    uint16_t next = nextSignalBlock(block);
+    bool playNext = next < numBlocks && blocks[next].id != 0x10;
+
+    KB_INT_START;
+    SD_UNLOCK;
+
+    uint8_t f;
+    if (error)
+        f = cp1Flags(result ? result : 0xFF) & ~FLAG_C;
+    else
+        f = cp1Flags(result);
+
+    Z80_SET_AF((result << 8) | f);
+    Z80_SET_IX(ix);
+    Z80_SET_DE(de);
+
+    // exit via SA/LD-RET: restores border, enables interrupts and
+    // returns to the caller of LD-BYTES
+    Z80_SET_PC(TAPE_SA_LD_RET);
+
+    if (playNext) {
+        block = next;
+        play();
+    }
+    return true;
+}
+
+#endif // TAPE_LOAD_TRAP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// SA-BYTES trap
+//
+// on entry: A = flag byte, IX = start, DE = length. The block is queued
+// for a background writer and appended to /sna/saveNNNN.tap (created on
+// the first save), so saving takes no emulated time at all. The file is
+// closed, and the writer's buffer and task freed, when the tape is stopped
+// or ejected or after a few seconds without saves; the next save then
+// starts a new file.
+
+#ifdef TAPE_SAVE_TRAP
+
+// a whole 48K block fits twice, so back to back saves are never dropped
+#define SAVE_BUFFER_SIZE 131072
+#define SAVE_CHUNK_SIZE  8192
+#define SAVE_IDLE_FRAMES 500    // 10 seconds
+
+static AsyncWriter saveWriter("tapWriter", SAVE_BUFFER_SIZE, SAVE_CHUNK_SIZE);
+static String saveFile;
+static uint16_t saveIdleFrames = 0;
+bool Tape::saveEnd = false;
+
+// first bytes of SA-BYTES: LD HL,SA/LD-RET / PUSH HL
+static const uint8_t saBytesSignature[4] = { 0x21, 0x3F, 0x05, 0xE5 };
+
+const String& Tape::saveFileName()
+{
+    return saveFile;
+}
+
+// called at the end of each frame, out of any SD lock the writer task needs
+void Tape::saveIdle()
+{
+    if (!saveWriter.isOpen()) {
+        saveEnd = false;
+        return;
+    }
+    if (!saveEnd && ++saveIdleFrames < SAVE_IDLE_FRAMES)
+        return;
+    saveEnd = false;
+    if (saveWriter.close())
+        Serial.printf("Tape: closed %s\n", saveFile.c_str());
+    else
+        Serial.printf("Tape: error writing %s\n", saveFile.c_str());
+    saveFile = "";
+}
+
+// returns false if the ROM has to save in real time instead
+bool Tape::saBytes()
+{
+    if (memcmp(Mem::rom[Mem::romInUse] + TAPE_SA_BYTES, saBytesSignature, sizeof(saBytesSignature)) != 0)
+        return false;
+
+    uint8_t flag = Z80_GET_AF() >> 8;
+    uint16_t ix = Z80_GET_IX();
+    uint16_t de = Z80_GET_DE();
+
+    if (!saveWriter.isOpen()) {
+        FileUtils::ensureDir(DISK_SNA_DIR);
+        saveFile = FileUtils::nextFileName(DISK_SNA_DIR, "save", "tap");
+        if (!saveWriter.open(saveFile.c_str())) {
+            saveFile = "";
+            return false;
+        }
+    }
+
+    // whole block or nothing, a partial one would corrupt the file
+    uint32_t blockLength = (uint32_t)de + 2;
+    if (blockLength + 2 > saveWriter.available() || blockLength > 0xFFFF) {
+        Serial.printf("Tape: no room to save %u bytes\n", de);
+        return false;
+    }
+
+    uint8_t buf[256];
+    buf[0] = blockLength & 0xFF;
+    buf[1] = blockLength >> 8;
+    buf[2] = flag;
+    saveWriter.write(buf, 3);
+
+    uint8_t parity = flag;
+    uint16_t left = de;
+    while (left > 0) {
+        uint16_t n = left < sizeof(buf) ? left : sizeof(buf);
+        for (int i = 0; i < n; i++) {
+            buf[i] = Mem::readbyte(ix++);
+            parity ^= buf[i];
+        }
+        saveWriter.write(buf, n);
+        left -= n;
+    }
+    saveWriter.write(&parity, 1);
+    saveWriter.flush();
+    saveIdleFrames = 0;
+
+    Serial.printf("Tape: saved %u bytes (flag %02X) to %s\n", de, flag, saveFile.c_str());
+
+    // as the ROM leaves them, then exit via SA/LD-RET: it steps DE and IX
+    // for the flag and the parity byte too, and ends on LD A,D / INC A
+    Z80_SET_IX(ix + 1);
+    Z80_SET_DE(0xFFFF);
+    Z80_SET_AF(FLAG_Z | FLAG_C);
+    Z80_SET_PC(TAPE_SA_LD_RET);
+    return true;
+}
+
+#endif // TAPE_SAVE_TRAP
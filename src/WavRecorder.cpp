@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "WavRecorder.h"
+#include "AsyncWriter.h"
+#include "FileUtils.h"
+#include "WavHeader.h"
+
+// two halves of 16K: at 16KHz mono each half holds half a second
+#define WAV_BUFFER_SIZE 32768
+// space reserved upfront, about 8 minutes at 16KHz mono
+#define WAV_PREALLOCATE (16 * 1024 * 1024)
+
+static AsyncWriter writer("wavWriter", WAV_BUFFER_SIZE, WAV_BUFFER_SIZE / 2);
+
+bool WavRecorder::recording = false;
+String WavRecorder::path;
+uint32_t WavRecorder::rate = 0;
+uint16_t WavRecorder::channels = 1;
+
+bool WavRecorder::start(uint32_t sampleRate, uint16_t numChannels)
+{
+    if (recording)
+        return true;
+
+    FileUtils::ensureDir(DISK_REC_DIR);
+    path = FileUtils::nextFileName(DISK_REC_DIR, "audio", "wav");
+    if (!writer.open(path.c_str(), WAV_PREALLOCATE))
+        return false;
+
+    rate = sampleRate;
+    channels = numChannels;
+
+    // placeholder, real sizes are written on stop
+    uint8_t header[WAV_HEADER_SIZE];
+    wavMakeHeader(header, rate, channels, 0);
+    writer.write(header, sizeof(header));
+
+    recording = true;
+    Serial.printf("WAV recording to %s\n", path.c_str());
+    return true;
+}
+
+void WavRecorder::stop()
+{
+    if (!recording)
+        return;
+    recording = false;
+
+    // data written is known only after the writer has finished, but the
+    // header goes in with close(): compute it from what was queued
+    uint32_t dataBytes = writer.queued() - WAV_HEADER_SIZE;
+    uint8_t header[WAV_HEADER_SIZE];
+    wavMakeHeader(header, rate, channels, dataBytes);
+    bool ok = writer.close(header, sizeof(header));
+
+    Serial.printf("WAV recording stopped: %u bytes, %u buffers dropped%s\n",
+        writer.written(), writer.dropped(), ok ? "" : ", WRITE ERROR");
+}
+
+uint32_t WavRecorder::dropped()
+{
+    return writer.dropped();
+}
+
+uint32_t WavRecorder::seconds()
+{
+    return (writer.queued() - WAV_HEADER_SIZE) / (rate * channels * 2);
+}
+
+void WavRecorder::add(const int16_t* pcm, int count)
+{
+    writer.write(pcm, count * channels * sizeof(int16_t));
+}
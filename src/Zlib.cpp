@@ -0,0 +1,458 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#include "Zlib.h"
+#include <stdlib.h>
+#include <string.h>
+
+// length and distance codes (RFC 1951, 3.2.5)
+static const uint16_t lenBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t lenExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t distBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t distExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// order of code length code lengths in dynamic block headers
+static const uint8_t clOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+uint32_t Zlib::adler32(const uint8_t* data, uint32_t len)
+{
+    uint32_t a = 1, b = 0;
+    while (len > 0) {
+        // largest block before the sums can overflow
+        uint32_t n = len < 5552 ? len : 5552;
+        len -= n;
+        while (n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Inflate
+
+#define IN_BUFFER_SIZE 256
+
+static Zlib::ReadFunc inRead;
+static uint8_t inBuf[IN_BUFFER_SIZE];
+static uint16_t inPos;
+static uint16_t inLen;
+static uint32_t bitBuf;
+static uint8_t bitCount;
+static bool overrun;
+
+static int getByte()
+{
+    if (inPos >= inLen) {
+        int n = inRead(inBuf, IN_BUFFER_SIZE);
+        if (n <= 0) {
+            overrun = true;
+            return -1;
+        }
+        inLen = n;
+        inPos = 0;
+    }
+    return inBuf[inPos++];
+}
+
+// n <= 16; past end of input reads zeros and sets overrun
+static uint32_t getBits(uint8_t n)
+{
+    while (bitCount < n) {
+        int b = getByte();
+        bitBuf |= (uint32_t)(b < 0 ? 0 : b) << bitCount;
+        bitCount += 8;
+    }
+    uint32_t v = bitBuf & ((1UL << n) - 1);
+    bitBuf >>= n;
+    bitCount -= n;
+    return v;
+}
+
+// canonical Huffman code: number of codes per length, symbols by code
+struct Huffman
+{
+    uint16_t counts[16];
+    uint16_t symbols[288];
+};
+
+static Huffman lenTree;
+static Huffman distTree;
+
+static void buildTree(Huffman& t, const uint8_t* lengths, uint16_t n)
+{
+    uint16_t offs[16];
+    memset(t.counts, 0, sizeof(t.counts));
+    for (uint16_t i = 0; i < n; i++)
+        t.counts[lengths[i]]++;
+    t.counts[0] = 0;
+    uint16_t sum = 0;
+    for (uint8_t len = 0; len < 16; len++) {
+        offs[len] = sum;
+        sum += t.counts[len];
+    }
+    for (uint16_t i = 0; i < n; i++)
+        if (lengths[i])
+            t.symbols[offs[lengths[i]]++] = i;
+}
+
+// one bit at a time: codes are stored MSB first
+static int decodeSym(const Huffman& t)
+{
+    int code = 0, first = 0, index = 0;
+    for (uint8_t len = 1; len < 16; len++) {
+        code |= getBits(1);
+        int count = t.counts[len];
+        if (code - count < first)
+            return t.symbols[index + (code - first)];
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static void fixedTrees()
+{
+    uint8_t lengths[288];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    buildTree(lenTree, lengths, 288);
+    memset(lengths, 5, 30);
+    buildTree(distTree, lengths, 30);
+}
+
+static bool dynamicTrees()
+{
+    uint8_t lengths[286 + 32];
+    uint16_t hlit = getBits(5) + 257;
+    uint16_t hdist = getBits(5) + 1;
+    uint8_t hclen = getBits(4) + 4;
+    if (hlit > 286 || hdist > 30)
+        return false;
+
+    memset(lengths, 0, 19);
+    for (uint8_t i = 0; i < hclen; i++)
+        lengths[clOrder[i]] = getBits(3);
+    buildTree(lenTree, lengths, 19);
+
+    uint16_t n = hlit + hdist;
+    for (uint16_t i = 0; i < n; ) {
+        int sym = decodeSym(lenTree);
+        if (sym < 0)
+            return false;
+        if (sym < 16) {
+            lengths[i++] = sym;
+            continue;
+        }
+        uint8_t val = 0;
+        uint8_t rep;
+        if (sym == 16) {
+            if (i == 0)
+                return false;
+            val = lengths[i - 1];
+            rep = 3 + getBits(2);
+        }
+        else if (sym == 17)
+            rep = 3 + getBits(3);
+        else
+            rep = 11 + getBits(7);
+        if (i + rep > n)
+            return false;
+        while (rep--)
+            lengths[i++] = val;
+    }
+    if (lengths[256] == 0)
+        return false;
+
+    buildTree(lenTree, lengths, hlit);
+    buildTree(distTree, lengths + hlit, hdist);
+    return true;
+}
+
+int32_t Zlib::inflate(ReadFunc read, uint8_t* dst, uint32_t dstLen)
+{
+    inRead = read;
+    inPos = inLen = 0;
+    bitBuf = 0;
+    bitCount = 0;
+    overrun = false;
+
+    int cmf = getByte();
+    int flg = getByte();
+    if (flg < 0 || (cmf & 0x0F) != 8 || ((cmf << 8) | flg) % 31 || (flg & 0x20))
+        return -1;
+
+    uint32_t out = 0;
+    bool last;
+    do {
+        last = getBits(1);
+        uint8_t type = getBits(2);
+
+        if (type == 0) {
+            // stored: skip to byte boundary, then LEN, NLEN and raw bytes
+            bitBuf = 0;
+            bitCount = 0;
+            uint16_t len = getBits(16);
+            uint16_t nlen = getBits(16);
+            if (len != (uint16_t)~nlen || out + len > dstLen)
+                return -1;
+            while (len--) {
+                int b = getByte();
+                if (b < 0)
+                    return -1;
+                dst[out++] = b;
+            }
+            continue;
+        }
+        if (type == 1)
+            fixedTrees();
+        else if (type != 2 || !dynamicTrees())
+            return -1;
+
+        for (;;) {
+            int sym = decodeSym(lenTree);
+            if (sym < 0 || overrun)
+                return -1;
+            if (sym < 256) {
+                if (out >= dstLen)
+                    return -1;
+                dst[out++] = sym;
+            }
+            else if (sym == 256)
+                break;
+            else {
+                sym -= 257;
+                if (sym >= 29)
+                    return -1;
+                uint32_t len = lenBase[sym] + getBits(lenExtra[sym]);
+                int ds = decodeSym(distTree);
+                if (ds < 0 || ds >= 30)
+                    return -1;
+                uint32_t dist = distBase[ds] + getBits(distExtra[ds]);
+                if (dist > out || out + len > dstLen)
+                    return -1;
+                // dst is the window; copies may overlap (runs)
+                uint8_t* p = dst + out;
+                const uint8_t* q = p - dist;
+                out += len;
+                while (len--)
+                    *p++ = *q++;
+            }
+        }
+    } while (!last);
+
+    // Adler-32 of the uncompressed data, big endian
+    bitBuf = 0;
+    bitCount = 0;
+    uint32_t check = 0;
+    for (uint8_t i = 0; i < 4; i++)
+        check = (check << 8) | getBits(8);
+    if (overrun || check != adler32(dst, out))
+        return -1;
+    return out;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Deflate
+
+#define OUT_BUFFER_SIZE 256
+#define HASH_BITS 12
+#define HASH_EMPTY 0xFFFF
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+
+static Zlib::WriteFunc outWrite;
+static uint8_t outBuf[OUT_BUFFER_SIZE];
+static uint16_t outLen;
+static uint32_t outTotal;
+static uint32_t outBits;
+static uint8_t outCount;
+static bool outError;
+
+static void flushOut()
+{
+    if (outLen && !outWrite(outBuf, outLen))
+        outError = true;
+    outLen = 0;
+}
+
+static void putByte(uint8_t b)
+{
+    outBuf[outLen++] = b;
+    outTotal++;
+    if (outLen == OUT_BUFFER_SIZE)
+        flushOut();
+}
+
+static void putBits(uint32_t v, uint8_t n)
+{
+    outBits |= v << outCount;
+    outCount += n;
+    while (outCount >= 8) {
+        putByte(outBits & 0xFF);
+        outBits >>= 8;
+        outCount -= 8;
+    }
+}
+
+// Huffman codes go MSB first
+static void putCode(uint16_t code, uint8_t len)
+{
+    uint16_t rev = 0;
+    for (uint8_t i = 0; i < len; i++) {
+        rev = (rev << 1) | (code & 1);
+        code >>= 1;
+    }
+    putBits(rev, len);
+}
+
+// fixed literal/length code (RFC 1951, 3.2.6)
+static void putSymbol(uint16_t sym)
+{
+    if (sym < 144)
+        putCode(0x30 + sym, 8);
+    else if (sym < 256)
+        putCode(0x190 + sym - 144, 9);
+    else if (sym < 280)
+        putCode(sym - 256, 7);
+    else
+        putCode(0xC0 + sym - 280, 8);
+}
+
+static void putMatch(uint16_t len, uint16_t dist)
+{
+    uint8_t i = 28;
+    while (lenBase[i] > len)
+        i--;
+    putSymbol(257 + i);
+    putBits(len - lenBase[i], lenExtra[i]);
+
+    uint8_t j = 29;
+    while (distBase[j] > dist)
+        j--;
+    putCode(j, 5);
+    putBits(dist - distBase[j], distExtra[j]);
+}
+
+static inline uint16_t hash(const uint8_t* p)
+{
+    uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+    return (uint32_t)(v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+// inside a run of one byte value the table keeps the run start, which
+// the next run of that value matches for longer than the byte before
+static inline void insertHash(uint16_t* head, const uint8_t* src, uint32_t i)
+{
+    const uint8_t* p = src + i;
+    if (i > 0 && p[-1] == p[0] && p[0] == p[1] && p[1] == p[2])
+        return;
+    head[hash(p)] = i;
+}
+
+int32_t Zlib::deflate(const uint8_t* src, uint32_t len, WriteFunc write)
+{
+    if (len > 32768)
+        return -1;
+    uint16_t* head = (uint16_t*)malloc((1 << HASH_BITS) * sizeof(uint16_t));
+    if (head == NULL)
+        return -1;
+    memset(head, 0xFF, (1 << HASH_BITS) * sizeof(uint16_t));
+
+    outWrite = write;
+    outLen = 0;
+    outTotal = 0;
+    outBits = 0;
+    outCount = 0;
+    outError = false;
+
+    // 32K window, no dictionary, fastest
+    putByte(0x78);
+    putByte(0x01);
+    // single final block, fixed Huffman codes
+    putBits(1, 1);
+    putBits(1, 2);
+
+    uint32_t i = 0;
+    while (i < len) {
+        uint16_t matchLen = 0;
+        uint16_t matchDist = 0;
+        if (i + MIN_MATCH <= len) {
+            uint16_t cand = head[hash(src + i)];
+            insertHash(head, src, i);
+            if (cand != HASH_EMPTY) {
+                uint32_t max = len - i < MAX_MATCH ? len - i : MAX_MATCH;
+                uint32_t n = 0;
+                while (n < max && src[cand + n] == src[i + n])
+                    n++;
+                if (n >= MIN_MATCH) {
+                    matchLen = n;
+                    matchDist = i - cand;
+                }
+            }
+        }
+        if (matchLen) {
+            putMatch(matchLen, matchDist);
+            for (uint32_t k = i + 1; k < i + matchLen && k + MIN_MATCH <= len; k++)
+                insertHash(head, src, k);
+            i += matchLen;
+        }
+        else
+            putSymbol(src[i++]);
+    }
+    putSymbol(256);
+    if (outCount)
+        putBits(0, 8 - outCount);
+
+    uint32_t check = adler32(src, len);
+    for (int8_t s = 24; s >= 0; s -= 8)
+        putByte(check >> s);
+    flushOut();
+    free(head);
+
+    return outError ? -1 : outTotal;
+}
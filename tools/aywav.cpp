@@ -0,0 +1,146 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+// Host test for the band-limited AY/beeper mixer: plays a short sequence
+// (AY tones, noise, envelope and beeper) through the same AyChip and
+// BlepBuffer code used by the emulator, and writes it to a WAV file.
+//
+// Build and run from the repository root:
+//
+//   g++ -O2 -Iinclude tools/aywav.cpp src/AyChip.cpp src/BlepBuffer.cpp -o aywav
+//   ./aywav out.wav [ABC|ACB|MONO] [sample rate]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "AyChip.h"
+#include "BlepBuffer.h"
+#include "WavHeader.h"
+
+#define CLOCK_RATE 3546900
+#define FRAME_STATES 70908
+#define BEEPER_AMPLITUDE 8191
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s out.wav [ABC|ACB|MONO] [sample rate]\n", argv[0]);
+        return 1;
+    }
+    int mode = argc > 2 ? AyChip::parseStereoMode(argv[2]) : AY_STEREO_ABC;
+    if (mode < 0) {
+        fprintf(stderr, "unknown stereo mode %s\n", argv[2]);
+        return 1;
+    }
+    uint32_t rate = argc > 3 ? atoi(argv[3]) : 44100;
+
+    FILE* f = fopen(argv[1], "wb");
+    if (!f) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    BlepBuffer blep(4096, 2);
+    blep.setRates(CLOCK_RATE, rate);
+    AyChip ay;
+    ay.setOutput(&blep);
+    ay.setStereoMode(mode);
+
+    uint8_t header[WAV_HEADER_SIZE];
+    wavMakeHeader(header, rate, 2, 0);
+    fwrite(header, 1, sizeof(header), f);
+
+    static int16_t pcm[4096 * 2];
+    uint32_t dataBytes = 0;
+    int beeper = 0;
+
+    for (int frame = 0; frame < 50 * 8; frame++) {
+        int sec = frame / 50;
+        if (frame % 50 == 0) {
+            // each second, a different test
+            switch (sec) {
+            case 0: // A alone, 440Hz
+                ay.writeRegister(0, 252, 0); ay.writeRegister(1, 0, 0);
+                ay.writeRegister(7, 0x3E, 0); ay.writeRegister(8, 15, 0);
+                break;
+            case 1: // B alone
+                ay.writeRegister(8, 0, 0);
+                ay.writeRegister(2, 168, 0); ay.writeRegister(3, 0, 0);
+                ay.writeRegister(7, 0x3D, 0); ay.writeRegister(9, 15, 0);
+                break;
+            case 2: // C alone
+                ay.writeRegister(9, 0, 0);
+                ay.writeRegister(4, 126, 0); ay.writeRegister(5, 0, 0);
+                ay.writeRegister(7, 0x3B, 0); ay.writeRegister(10, 15, 0);
+                break;
+            case 3: // noise on A
+                ay.writeRegister(10, 0, 0);
+                ay.writeRegister(6, 8, 0);
+                ay.writeRegister(7, 0x37, 0); ay.writeRegister(8, 12, 0);
+                break;
+            case 4: // sawtooth envelope on B
+                ay.writeRegister(8, 0, 0);
+                ay.writeRegister(7, 0x3D, 0); ay.writeRegister(9, 0x10, 0);
+                ay.writeRegister(11, 20, 0); ay.writeRegister(12, 0, 0);
+                ay.writeRegister(13, 8, 0);
+                break;
+            case 5: // high tone, aliases badly without band limiting
+                ay.writeRegister(9, 0, 0);
+                ay.writeRegister(0, 9, 0); ay.writeRegister(7, 0x3E, 0);
+                ay.writeRegister(8, 15, 0);
+                break;
+            case 6: // silence on AY
+                ay.writeRegister(8, 0, 0);
+                break;
+            }
+        }
+        if (sec >= 6) {
+            // beeper at 1KHz (and a sweep in the last second)
+            uint32_t half = (sec == 6) ? CLOCK_RATE / 2000 : 200 + (frame % 50) * 20;
+            for (uint32_t t = (frame * FRAME_STATES) % half; t < FRAME_STATES; t += half) {
+                blep.addDelta(t, beeper ? -BEEPER_AMPLITUDE : BEEPER_AMPLITUDE);
+                beeper ^= 1;
+            }
+        }
+
+        ay.endFrame(FRAME_STATES);
+        blep.endFrame(FRAME_STATES);
+        int n = blep.readSamples(pcm, 4096);
+        // WAV is little endian, as are all hosts this is expected to run on
+        fwrite(pcm, 4, n, f);
+        dataBytes += n * 4;
+    }
+
+    wavMakeHeader(header, rate, 2, dataBytes);
+    fseek(f, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), f);
+    fclose(f);
+
+    printf("%s: %u samples at %u Hz\n", argv[1], dataBytes / 4, rate);
+    return 0;
+}
@@ -0,0 +1,135 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// ZX-ESPectrum - ZX Spectrum emulator for ESP32
+//
+// Copyright (c) 2020, 2021 David Crespo [dcrespo3d]
+// https://github.com/dcrespo3d/ZX-ESPectrum-Wiimote
+//
+// Based on previous work by Ramón Martinez, Jorge Fuertes and many others
+// https://github.com/rampa069/ZX-ESPectrum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+// Renders a .psg AY register dump (as recorded with F7) to a WAV file,
+// using the same AyChip and BlepBuffer code as the emulator.
+// Register writes are applied at the start of their frame, as PSG files
+// do not keep timing within a frame.
+//
+// Build and run from the repository root:
+//
+//   g++ -O2 -Iinclude tools/psg2wav.cpp src/AyChip.cpp src/BlepBuffer.cpp -o psg2wav
+//   ./psg2wav in.psg out.wav [ABC|ACB|MONO] [sample rate]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "AyChip.h"
+#include "BlepBuffer.h"
+#include "WavHeader.h"
+
+// Spectrum 128K timing
+#define CLOCK_RATE 3546900
+#define FRAME_STATES 70908
+
+#define PSG_HEADER_SIZE 16
+
+static BlepBuffer blep(4096, 2);
+static AyChip ay;
+static int16_t pcm[4096 * 2];
+static uint32_t dataBytes = 0;
+
+static void renderFrame(FILE* out)
+{
+    ay.endFrame(FRAME_STATES);
+    blep.endFrame(FRAME_STATES);
+    int n = blep.readSamples(pcm, 4096);
+    fwrite(pcm, 4, n, out);
+    dataBytes += n * 4;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s in.psg out.wav [ABC|ACB|MONO] [sample rate]\n", argv[0]);
+        return 1;
+    }
+    int mode = argc > 3 ? AyChip::parseStereoMode(argv[3]) : AY_STEREO_ABC;
+    if (mode < 0) {
+        fprintf(stderr, "unknown stereo mode %s\n", argv[3]);
+        return 1;
+    }
+    uint32_t rate = argc > 4 ? atoi(argv[4]) : 44100;
+
+    FILE* in = fopen(argv[1], "rb");
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+    uint8_t header[PSG_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), in) != sizeof(header) || memcmp(header, "PSG\x1a", 4) != 0) {
+        fprintf(stderr, "%s: not a PSG file\n", argv[1]);
+        return 1;
+    }
+
+    FILE* out = fopen(argv[2], "wb");
+    if (!out) {
+        perror(argv[2]);
+        return 1;
+    }
+    uint8_t wav[WAV_HEADER_SIZE];
+    wavMakeHeader(wav, rate, 2, 0);
+    fwrite(wav, 1, sizeof(wav), out);
+
+    blep.setRates(CLOCK_RATE, rate);
+    ay.setOutput(&blep);
+    ay.setStereoMode(mode);
+
+    uint32_t frames = 0;
+    int c;
+    while ((c = fgetc(in)) != EOF) {
+        if (c == 0xFF) {
+            // end of frame
+            renderFrame(out);
+            frames++;
+        } else if (c == 0xFE) {
+            // n * 4 empty frames
+            int n = fgetc(in);
+            if (n == EOF) break;
+            for (int i = 0; i < n * 4; i++, frames++)
+                renderFrame(out);
+        } else if (c == 0xFD) {
+            // end of music
+            break;
+        } else {
+            int data = fgetc(in);
+            if (data == EOF) break;
+            ay.writeRegister(c, data, 0);
+        }
+    }
+    fclose(in);
+
+    wavMakeHeader(wav, rate, 2, dataBytes);
+    fseek(out, 0, SEEK_SET);
+    fwrite(wav, 1, sizeof(wav), out);
+    fclose(out);
+
+    printf("%s: %u frames, %u samples at %u Hz\n", argv[2], frames, dataBytes / 4, rate);
+    return 0;
+}